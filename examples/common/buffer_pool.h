@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace erpc {
+
+static const uint32_t kBufferBlockSize = 16 * 1024; // size of one pooled block
+static const uint32_t kMaxFreeBlocks = 1024;        // max idle blocks kept by one pool
+
+class BufferPool;
+typedef std::shared_ptr<BufferPool> BufferPoolPtr;
+
+// a refcounted block of memory, the header is followed by capacity bytes of data
+typedef struct BufferBlock {
+    std::atomic<uint32_t> refs { 1 }; // number of holders(input buffer and views)
+    uint32_t capacity { 0 };          // size of data
+    BufferPoolPtr pool;               // the pool this block returns to
+
+    char* data() {
+        return reinterpret_cast<char*>(this + 1);
+    }
+} BufferBlock;
+
+// free list of fixed size blocks, so that steady state receive does not malloc.
+// blocks are taken on the loop thread, and may be released on any thread
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+public:
+    BufferPool()                                   = default;
+    BufferPool(const BufferPool& other)            = delete;
+    BufferPool& operator=(const BufferPool& other) = delete;
+    ~BufferPool() {
+        for (auto block : _free_blocks) {
+            Destroy(block);
+        }
+    }
+
+public:
+    static BufferPoolPtr Create() {
+        auto pool = std::make_shared<BufferPool>();
+        pool->_free_blocks.reserve(kMaxFreeBlocks);
+        return pool;
+    }
+
+    // get a block with at least capacity bytes and one ref; bigger than kBufferBlockSize is malloced and never pooled
+    BufferBlock* Acquire(uint32_t capacity) {
+        BufferBlock* block = nullptr;
+        if (capacity <= kBufferBlockSize) {
+            capacity = kBufferBlockSize;
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_free_blocks.empty()) {
+                block = _free_blocks.back();
+                _free_blocks.pop_back();
+            }
+        }
+        if (!block) {
+            block = new (::operator new(sizeof(BufferBlock) + capacity)) BufferBlock();
+            block->capacity = capacity;
+        }
+        block->refs.store(1, std::memory_order_relaxed);
+        block->pool = shared_from_this();
+        return block;
+    }
+
+    static void AddRef(BufferBlock* block) {
+        block->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // drop one ref, the last one gives the block back to its pool
+    static void Release(BufferBlock* block) {
+        if (block->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        // keep the pool alive while putting the block back
+        BufferPoolPtr pool;
+        pool.swap(block->pool);
+        if (block->capacity == kBufferBlockSize) {
+            std::lock_guard<std::mutex> lock(pool->_mutex);
+            if (pool->_free_blocks.size() < kMaxFreeBlocks) {
+                pool->_free_blocks.push_back(block);
+                return;
+            }
+        }
+        Destroy(block);
+    }
+
+private:
+    static void Destroy(BufferBlock* block) {
+        block->~BufferBlock();
+        ::operator delete(block);
+    }
+
+private:
+    std::mutex _mutex;
+    std::vector<BufferBlock*> _free_blocks; // idle blocks
+};
+
+// read only view of bytes in a pooled block, holding a ref so that the block is reused only after all views released
+class BufferView {
+public:
+    BufferView() = default;
+    // refer to size bytes at data inside block, take a new ref of block
+    BufferView(BufferBlock* block, const char* data, size_t size)
+        : _block(block),
+          _data(data),
+          _size(size) {
+        if (_block) {
+            BufferPool::AddRef(_block);
+        }
+    }
+    BufferView(const BufferView& other)
+        : BufferView(other._block, other._data, other._size) {}
+    BufferView(BufferView&& other)
+        : _block(other._block),
+          _data(other._data),
+          _size(other._size) {
+        other._block = nullptr;
+        other._data = nullptr;
+        other._size = 0;
+    }
+    BufferView& operator=(BufferView other) {
+        std::swap(_block, other._block);
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+        return *this;
+    }
+    ~BufferView() {
+        if (_block) {
+            BufferPool::Release(_block);
+        }
+    }
+
+public:
+    const char* data() const {
+        return _data;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    // view of len bytes from offset inside this view, sharing the block
+    BufferView Sub(size_t offset, size_t len) const {
+        return BufferView(_block, _data + offset, len);
+    }
+
+    // copy out the content
+    std::string ToString() const {
+        return std::string(_data, _size);
+    }
+
+private:
+    BufferBlock* _block { nullptr };
+    const char* _data { nullptr };
+    size_t _size { 0 };
+};
+
+} // namespace erpc
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace erpc {
+
+// handle of a connection: fd in the low 32 bits, generation in the high 32 bits. every connection gets a new
+// generation, so a handle kept after its connection closed never matches a later connection reusing the fd
+typedef uint64_t ConnectionId;
+
+static const ConnectionId kInvalidConnectionId = 0; // generations start at 1, so no connection has this id
+
+inline ConnectionId MakeConnectionId(int32_t fd, uint32_t generation) {
+    return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+
+inline int32_t ConnectionFd(ConnectionId id) {
+    return static_cast<int32_t>(id & 0xffffffffu);
+}
+
+inline uint32_t ConnectionGeneration(ConnectionId id) {
+    return static_cast<uint32_t>(id >> 32);
+}
+
+// a new generation, unique in the process until it wraps after 2^32 connections, never 0
+inline uint32_t NextConnectionGeneration() {
+    static std::atomic<uint32_t> generation { 0 };
+    uint32_t next = 0;
+    while ((next = generation.fetch_add(1, std::memory_order_relaxed) + 1) == 0) {
+    }
+    return next;
+}
+
+// id for a new connection(or any fd watched by a loop) on fd
+inline ConnectionId NewConnectionId(int32_t fd) {
+    return MakeConnectionId(fd, NextConnectionGeneration());
+}
+
+static const uint32_t kOwnerChunkBits = 12; // fds per chunk of ConnectionOwners, as a power of 2
+static const uint32_t kOwnerChunks = 1024;  // chunks of ConnectionOwners, fds from 2^22 on are not tracked
+
+// which loop of a server owns the connection on every fd, for threads outside of the loops to find it. the owning
+// loop writes it before anyone else learns the id of the connection, and it is never cleared: a stale entry only
+// sends a task to a loop which then does not find the id. chunks of slots are allocated on first use and kept, so
+// reading is lock free from any thread
+class ConnectionOwners {
+public:
+    ConnectionOwners() {
+        for (uint32_t i = 0; i < kOwnerChunks; ++i) {
+            _chunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    ConnectionOwners(const ConnectionOwners& other)            = delete;
+    ConnectionOwners& operator=(const ConnectionOwners& other) = delete;
+    ~ConnectionOwners() {
+        for (uint32_t i = 0; i < kOwnerChunks; ++i) {
+            delete[] _chunks[i].load(std::memory_order_relaxed);
+        }
+    }
+
+public:
+    // the connection on fd belongs to loop index from now on, on that loop
+    void Set(int32_t fd, uint32_t index) {
+        if (fd < 0 || (static_cast<uint32_t>(fd) >> kOwnerChunkBits) >= kOwnerChunks) {
+            return;
+        }
+        std::atomic<uint32_t>* chunk = Chunk(fd);
+        if (!chunk) {
+            // loops may race for a new chunk, the first one wins
+            std::atomic<uint32_t>* fresh = new std::atomic<uint32_t>[1u << kOwnerChunkBits];
+            for (uint32_t i = 0; i < (1u << kOwnerChunkBits); ++i) {
+                fresh[i].store(0, std::memory_order_relaxed);
+            }
+            if (_chunks[fd >> kOwnerChunkBits].compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) {
+                chunk = fresh;
+            } else {
+                delete[] fresh;
+            }
+        }
+        chunk[fd & ((1u << kOwnerChunkBits) - 1)].store(index + 1, std::memory_order_release);
+    }
+
+    // index of the loop which had the last connection on fd, -1 if none. any thread
+    int32_t Get(int32_t fd) const {
+        if (fd < 0 || (static_cast<uint32_t>(fd) >> kOwnerChunkBits) >= kOwnerChunks) {
+            return -1;
+        }
+        std::atomic<uint32_t>* chunk = Chunk(fd);
+        if (!chunk) {
+            return -1;
+        }
+        return static_cast<int32_t>(chunk[fd & ((1u << kOwnerChunkBits) - 1)].load(std::memory_order_acquire)) - 1;
+    }
+
+private:
+    std::atomic<uint32_t>* Chunk(int32_t fd) const {
+        return _chunks[fd >> kOwnerChunkBits].load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<std::atomic<uint32_t>*> _chunks[kOwnerChunks]; // slots of loop index + 1 by fd, 0 means none
+};
+
+// connections of one loop in a vector indexed by fd: fds are small and dense, so a lookup is one index and a
+// generation compare, no hashing. the slot of a closed fd stays, and is reused by the next connection on it.
+// not thread safe, owned by one loop
+template <typename T>
+class ConnectionTable {
+public:
+    typedef std::shared_ptr<T> Ptr;
+
+    // put conn on the fd of id, replacing whatever was there
+    void Insert(ConnectionId id, const Ptr& conn) {
+        int32_t fd = ConnectionFd(id);
+        if (static_cast<size_t>(fd) >= _slots.size()) {
+            _slots.resize(std::max<size_t>(fd + 1, _slots.size() * 2));
+        }
+        Slot& slot = _slots[fd];
+        if (!slot.conn) {
+            ++_size;
+        }
+        slot.id = id;
+        slot.conn = conn;
+    }
+
+    // the connection on fd, nullptr if none
+    Ptr Get(int32_t fd) const {
+        if (fd < 0 || static_cast<size_t>(fd) >= _slots.size()) {
+            return nullptr;
+        }
+        return _slots[fd].conn;
+    }
+
+    // the connection of id, nullptr if it closed(even if another one is on its fd now)
+    Ptr Find(ConnectionId id) const {
+        int32_t fd = ConnectionFd(id);
+        if (id == kInvalidConnectionId || fd < 0 || static_cast<size_t>(fd) >= _slots.size() || _slots[fd].id != id) {
+            return nullptr;
+        }
+        return _slots[fd].conn;
+    }
+
+    // drop the connection on fd, return whether there was one
+    bool Erase(int32_t fd) {
+        if (fd < 0 || static_cast<size_t>(fd) >= _slots.size() || !_slots[fd].conn) {
+            return false;
+        }
+        _slots[fd].conn.reset();
+        _slots[fd].id = kInvalidConnectionId;
+        --_size;
+        return true;
+    }
+
+    // fds of all connections, e.g. to close them
+    std::vector<int32_t> Fds() const {
+        std::vector<int32_t> fds;
+        fds.reserve(_size);
+        for (size_t fd = 0; fd < _slots.size(); ++fd) {
+            if (_slots[fd].conn) {
+                fds.push_back(static_cast<int32_t>(fd));
+            }
+        }
+        return fds;
+    }
+
+    size_t Size() const {
+        return _size;
+    }
+
+    bool Empty() const {
+        return _size == 0;
+    }
+
+private:
+    typedef struct Slot {
+        ConnectionId id { kInvalidConnectionId }; // id of the connection on this fd
+        Ptr conn;
+    } Slot;
+
+    std::vector<Slot> _slots; // indexed by fd
+    size_t _size { 0 }; // number of connections
+};
+
+} // namespace erpc
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "buffer_pool.h"
+#include "connection_table.h"
+#include "frame_codec.h"
+#include "metrics.h"
+#include "rpc_service.h"
+#include "timer_wheel.h"
+#include "worker_pool.h"
+
+namespace erpc {
+
+static const uint32_t kMaxBufferSize = 4096; // max buffer size
+static const uint32_t kMaxEpollSize = 100; // max epoll size
+static const uint32_t kEpollWaitTime = 10; // how often a thread waiting for a loop checks it is still running(ms)
+static const uint32_t kMaxEvents = 100;    // epoll wait return max size
+
+// packet of send/recv binary content
+typedef struct Packet {
+public:
+    Packet()
+        : msg { "" } {}
+    Packet(const std::string& msg)
+        : msg { msg } {}
+    Packet(int fd, const std::string& msg)
+        : fd(fd),
+          msg(msg) {}
+    // refer to received bytes in the pooled receive buffer, without copy
+    Packet(int fd, const BufferView& view)
+        : fd(fd),
+          view(view) {}
+
+    // content of packet: the view if it refers to a pooled buffer, otherwise msg
+    const char* data() const {
+        return view.empty() ? msg.data() : view.data();
+    }
+
+    size_t size() const {
+        return view.empty() ? msg.size() : view.size();
+    }
+
+    int fd { -1 };     // meaning socket
+    ConnectionId conn_id { kInvalidConnectionId }; // connection received from, not sent to if it closed since
+    std::string msg;   // real binary content
+    BufferView view;   // real binary content in a pooled buffer(zero copy), msg is empty then
+} Packet;
+
+typedef std::shared_ptr<Packet> PacketPtr;
+
+// callback when packet received
+using callback_recv_t = std::function<void(const PacketPtr& data)>;
+
+// callback when packet received, zero copy: data.view refers to the receive buffer, which is reused
+// after the last copy of the view released. nothing is malloced on the way from read() to this callback
+using callback_recv_view_t = std::function<void(const Packet& data)>;
+
+// base class of EpollTcpServer and EpollTcpClient, focus on Start(), Stop(), SendData(), RegisterOnRecvCallback()...
+class EpollTcpBase {
+public:
+    EpollTcpBase()                                     = default;
+    EpollTcpBase(const EpollTcpBase& other)            = delete;
+    EpollTcpBase& operator=(const EpollTcpBase& other) = delete;
+    EpollTcpBase(EpollTcpBase&& other)                 = delete;
+    EpollTcpBase& operator=(EpollTcpBase&& other)      = delete;
+    virtual ~EpollTcpBase()                            = default;
+
+public:
+    virtual bool Start() = 0;
+    virtual bool Stop()  = 0;
+    virtual int32_t SendData(const PacketPtr& data) = 0;
+    virtual int32_t SendData(const Packet& data) = 0;
+    virtual void RegisterOnRecvCallback(callback_recv_t callback) = 0;
+    virtual void RegisterOnRecvCallback(callback_recv_view_t callback) = 0;
+    virtual void UnRegisterOnRecvCallback() = 0;
+    virtual void SetFrameCodec(FrameCodecType type) = 0;
+    // counters and gauges of every loop, safe to call from any thread
+    virtual MetricsSnapshot Metrics() const = 0;
+    // timers run on a loop thread. called on a loop thread(in a callback or timer) the timer belongs to that
+    // loop and only that loop can cancel it; called before Start() it is added to every loop, e.g. for a
+    // periodic task per loop, and can not be cancelled(kInvalidTimerId is returned)
+    virtual TimerId RunAfter(uint32_t delay_ms, callback_timer_t callback) = 0;
+    virtual TimerId RunEvery(uint32_t interval_ms, callback_timer_t callback) = 0;
+    virtual bool CancelTimer(TimerId id) = 0;
+    // close connections with nothing read or written for idle_ms, 0(default) means never. call before Start()
+    virtual void SetIdleTimeout(uint32_t idle_ms) = 0;
+    // run recv callbacks on workers instead of the loop(nullptr, the default, means inline). SendData() called
+    // inside such a callback is routed back to the loop owning the connection. messages of one connection may
+    // run on different workers at once, so replies are not ordered. call before Start()
+    virtual void SetWorkerPool(const WorkerPoolPtr& workers) = 0;
+    // serve rpc: every message is a request dispatched to its method in service, which writes the response
+    // straight into the output buffer of the connection; the recv callback is not called then. needs a
+    // length prefix codec, runs on the loops even with a worker pool. call before Start(), return false if
+    // not supported
+    virtual bool SetRpcService(const RpcServicePtr& service) = 0;
+};
+
+using ETBase = EpollTcpBase;
+
+typedef std::shared_ptr<ETBase> ETBasePtr;
+
+} // namespace erpc
@@ -0,0 +1,267 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+
+#include "logger.h"
+
+namespace erpc {
+
+// the loop running on current thread
+static thread_local EventLoop* t_current_event_loop = nullptr;
+
+// monotonic clock in microseconds, for the busy poll window
+static uint64_t NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+EventLoop::EventLoop(uint32_t index)
+    : _index { index } {
+}
+
+EventLoop::~EventLoop() {
+    Stop();
+    if (!InLoopThread()) {
+        // a thread detached by a Stop() on itself may be finishing its last iteration, it still uses the epoll fd
+        while (_looping.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    if (_epoll_fd >= 0) {
+        ::close(_epoll_fd);
+    }
+}
+
+bool EventLoop::Init() {
+    if (_epoll_fd >= 0) {
+        return true;
+    }
+    _epoll_fd = epoll_create(kMaxEpollSize);
+    if (_epoll_fd < 0) {
+        ERPC_LOG_ERROR("epoll_create failed! errno=%d", errno);
+        return false;
+    }
+    // other threads wake the loop through this eventfd
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = kInvalidConnectionId;
+    if (!_inbox.Init() || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _inbox.fd(), &ev) < 0) {
+        ERPC_LOG_ERROR("create wakeup eventfd failed! errno=%d", errno);
+        return false;
+    }
+    _now_ms = TimerWheel::NowMs();
+    return true;
+}
+
+bool EventLoop::Start() {
+    if (_thread.joinable() || !Init()) {
+        return false;
+    }
+    // running before the thread is, so that RunSync() right after waits for the loop
+    _running = true;
+    _thread = std::thread(&EventLoop::Loop, this);
+    return true;
+}
+
+bool EventLoop::Stop() {
+    _quit = true;
+    _running = false;
+    if (_epoll_fd >= 0) {
+        // wake it up from epoll_wait
+        Post([] {});
+    }
+    if (_thread.joinable()) {
+        if (std::this_thread::get_id() == _thread.get_id()) {
+            // stopped by a callback of its own, the thread ends after this iteration
+            _thread.detach();
+        } else {
+            _thread.join();
+        }
+    }
+    return true;
+}
+
+EventLoop* EventLoop::Current() {
+    return t_current_event_loop;
+}
+
+int32_t EventLoop::Add(ConnectionId id, uint32_t events, EventHandler* handler) {
+    int32_t fd = ConnectionFd(id);
+    if (fd < 0 || id == kInvalidConnectionId) {
+        return -1;
+    }
+    if (static_cast<size_t>(fd) >= _watches.size()) {
+        _watches.resize(std::max<size_t>(fd + 1, _watches.size() * 2));
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u64 = id;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ERPC_LOG_ERROR("epoll_ctl failed! fd=%d errno=%d", fd, errno);
+        return -1;
+    }
+    _watches[fd].id = id;
+    _watches[fd].handler = handler;
+    return 0;
+}
+
+int32_t EventLoop::Modify(ConnectionId id, uint32_t events) {
+    int32_t fd = ConnectionFd(id);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u64 = id;
+    ERPC_LOG_DEBUG("mod fd %d events read %d write %d", fd, ev.events & EPOLLIN, ev.events & EPOLLOUT);
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        ERPC_LOG_ERROR("epoll_ctl failed! fd=%d errno=%d", fd, errno);
+        return -1;
+    }
+    return 0;
+}
+
+void EventLoop::Remove(int32_t fd) {
+    if (fd >= 0 && static_cast<size_t>(fd) < _watches.size()) {
+        // events of fd still in this batch are dropped
+        _watches[fd].id = kInvalidConnectionId;
+        _watches[fd].handler = nullptr;
+    }
+}
+
+void EventLoop::RunSync(task_t task) {
+    if (InLoopThread() || !Running()) {
+        task();
+        return;
+    }
+    // whoever claims it first runs it: the loop, or this thread if the loop stopped before getting to it
+    auto claimed = std::make_shared<std::atomic<bool>>(false);
+    auto done = std::make_shared<std::promise<void>>();
+    std::future<void> finished = done->get_future();
+    task_t run = [task, claimed, done] {
+        if (!claimed->exchange(true)) {
+            task();
+            done->set_value();
+        }
+    };
+    Post(run);
+    while (finished.wait_for(std::chrono::milliseconds(kEpollWaitTime)) != std::future_status::ready) {
+        if (!Running()) {
+            run();
+        }
+    }
+}
+
+void EventLoop::RunDeferred() {
+    // a deferred task may defer again, run until nothing is left
+    while (!_deferred.empty()) {
+        std::vector<task_t> deferred;
+        deferred.swap(_deferred);
+        for (auto& task : deferred) {
+            task();
+        }
+    }
+}
+
+// one loop per thread, call epoll_wait and hand the ready fds to their handlers
+void EventLoop::Loop() {
+    // request some memory, if events ready, socket events will copy to this memory from kernel
+    struct epoll_event* alive_events = static_cast<epoll_event*>(calloc(kMaxEvents, sizeof(epoll_event)));
+    if (!alive_events) {
+        ERPC_LOG_ERROR("calloc memory failed for epoll_events!");
+        return;
+    }
+    _looping = true;
+    t_current_event_loop = this;
+    _running = !_quit;
+    _now_ms = TimerWheel::NowMs();
+    _timers.SetNow(_now_ms);
+
+    while (!_quit.load(std::memory_order_acquire)) {
+        // sleep until the nearest timer, or for good if there is none: posts(Stop() too) wake it up through the
+        // inbox eventfd. only look for events if some work yielded to them
+        int64_t next = _timers.NextTimeout(_now_ms);
+        int timeout = next < 0 ? -1 : static_cast<int>(std::min<int64_t>(next, INT32_MAX));
+        if (!_yielded.empty()) {
+            timeout = 0;
+        }
+        // busy poll: do not sleep within the spin window after the last events
+        bool spin = timeout != 0 && _busy_poll_us > 0 && NowUs() - _last_event_us < _busy_poll_us;
+        if (spin) {
+            timeout = 0;
+        }
+        int num = epoll_wait(_epoll_fd, alive_events, kMaxEvents, timeout);
+        _now_ms = TimerWheel::NowMs();
+        // timers added by the handlers and tasks below count from now, not from the last Advance()
+        _timers.SetNow(_now_ms);
+        if (spin) {
+            // kept apart, or a spinning loop would count millions of empty wakeups
+            _metrics.Add(kMetricSpinPolls);
+            if (num > 0) {
+                _metrics.Add(kMetricSpinHits);
+                _metrics.Add(kMetricLoopEvents, num);
+            }
+        } else {
+            _metrics.Add(kMetricLoopWaits);
+            if (num > 0) {
+                _metrics.Add(kMetricLoopEvents, num);
+            } else {
+                _metrics.Add(kMetricEmptyWakeups);
+            }
+        }
+        if (num > 0 && _busy_poll_us > 0) {
+            // the spin window starts again
+            _last_event_us = NowUs();
+        }
+
+        for (int i = 0; i < num; ++i) {
+            ConnectionId id = alive_events[i].data.u64;
+            if (id == kInvalidConnectionId) {
+                // tasks posted by other threads
+                _inbox.Drain();
+                continue;
+            }
+            // one index and compare: an id removed earlier in this batch, or replaced by a later connection
+            // on the same fd, is stale
+            int32_t fd = ConnectionFd(id);
+            if (static_cast<size_t>(fd) < _watches.size() && _watches[fd].id == id) {
+                _watches[fd].handler->OnEvents(fd, alive_events[i].events);
+            }
+        }
+
+        // go on with the work yielded in the last iteration, what it yields again waits for the next one
+        if (!_yielded.empty()) {
+            std::vector<task_t> yielded;
+            yielded.swap(_yielded);
+            for (auto& task : yielded) {
+                task();
+            }
+        }
+
+        // run expired timers, they may queue data too
+        _timers.Advance(_now_ms);
+
+        // e.g. write out everything queued by callbacks in this iteration
+        RunDeferred();
+    }
+    // what was posted before Stop() woke the loop still runs, e.g. connections handed to it would leak otherwise.
+    // a task posted later is only destroyed with the loop
+    _inbox.RunPending();
+    RunDeferred();
+    _running = false;
+    t_current_event_loop = nullptr;
+    free(alive_events);
+    // the last touch of this loop
+    _looping.store(false, std::memory_order_release);
+}
+
+} // namespace erpc
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <sys/epoll.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "connection_table.h"
+#include "epoll_tcp_base.h"
+#include "loop_inbox.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+#include "worker_pool.h"
+
+namespace erpc {
+
+// whoever watches a fd on an EventLoop: a server loop(its listen socket and connections) or a client
+class EventHandler {
+public:
+    virtual ~EventHandler() = default;
+    // events(EPOLLIN, EPOLLOUT, ...) of fd are ready, on the loop thread
+    virtual void OnEvents(int32_t fd, uint32_t events) = 0;
+};
+
+// one reactor: an epoll instance with its timers, driven by one thread. servers and any number of client
+// connections register their fds on it, so the number of threads does not grow with the number of connections.
+// everything but Post(), RunInLoop(), Modify() and RunSync() is for the loop thread only(or before the loop runs).
+// an idle loop sleeps in epoll_wait until an event, its nearest timer or a post, never polls
+class EventLoop {
+public:
+    EventLoop(const EventLoop& other)            = delete;
+    EventLoop& operator=(const EventLoop& other) = delete;
+    ~EventLoop();
+
+    // index tells the loops of a group apart, in metrics and logs
+    explicit EventLoop(uint32_t index = 0);
+
+public:
+    // create the epoll instance and the wakeup eventfd
+    bool Init();
+    // Init() if not yet, and run Loop() on a thread of its own
+    bool Start();
+    // leave Loop() at once(a post wakes it up), and wait for the thread started by Start() unless called on it
+    bool Stop();
+    // run the loop on the calling thread until Stop()
+    void Loop();
+    // busy poll: after events, go on calling epoll_wait with a zero timeout for spin_us before sleeping in it
+    // again, so the next event is picked up without a wakeup. burns the core while spinning, spin_polls_total
+    // and spin_hits_total tell how often it paid off. 0(default) means off, call before the loop runs
+    void SetBusyPoll(uint32_t spin_us) {
+        _busy_poll_us = spin_us;
+    }
+
+    // watch the fd of id(NewConnectionId(fd)) for events, calling handler when ready. epoll hands back id with
+    // every event, and events of an id which is no longer the one on its fd(closed and reused within one batch)
+    // are dropped. loop thread only
+    int32_t Add(ConnectionId id, uint32_t events, EventHandler* handler);
+    // change the events watched on the fd of id, any thread(epoll_ctl is thread safe)
+    int32_t Modify(ConnectionId id, uint32_t events);
+    // forget the handler of fd, before close(fd) which takes it out of epoll. loop thread only
+    void Remove(int32_t fd);
+
+    // run task on the loop thread soon, any thread. it is queued lock free, and the first post after the loop
+    // drained its inbox wakes it up through an eventfd
+    void Post(task_t task) {
+        _inbox.Post(std::move(task));
+    }
+    // run task now if called on the loop thread, otherwise Post() it. any thread
+    void RunInLoop(task_t task) {
+        if (InLoopThread()) {
+            task();
+        } else {
+            Post(std::move(task));
+        }
+    }
+    // run task on the loop thread and wait for it: at once if called on the loop thread or the loop is not
+    // running, e.g. to tear down the fds and timers of a user of the loop. any thread
+    void RunSync(task_t task);
+    // run task at the end of this iteration, after events and timers, e.g. to flush what callbacks queued.
+    // loop thread only
+    void Defer(task_t task) {
+        _deferred.push_back(std::move(task));
+    }
+    // run task in the next iteration, right after its events, without sleeping in epoll_wait before: e.g. to go
+    // on reading a connection which used up its turn, after the others had theirs. loop thread only
+    void Yield(task_t task) {
+        _yielded.push_back(std::move(task));
+    }
+
+    // whether called on the thread running this loop
+    bool InLoopThread() const {
+        return Current() == this;
+    }
+    // the loop running on current thread, nullptr if none
+    static EventLoop* Current();
+
+    bool Running() const {
+        return _running.load(std::memory_order_acquire);
+    }
+    uint32_t Index() const {
+        return _index;
+    }
+    // time after last epoll_wait, the clock of the loop
+    uint64_t NowMs() const {
+        return _now_ms;
+    }
+    TimerWheel& Timers() {
+        return _timers;
+    }
+    // loop wide counters(waits, events, empty wakeups), shared by all users of the loop
+    const LoopMetrics& Metrics() const {
+        return _metrics;
+    }
+    // fill in the loop wide counters of a user's snapshot
+    void MergeMetrics(MetricValues* values) const {
+        (*values)[kMetricLoopWaits] = _metrics.Get(kMetricLoopWaits);
+        (*values)[kMetricLoopEvents] = _metrics.Get(kMetricLoopEvents);
+        (*values)[kMetricEmptyWakeups] = _metrics.Get(kMetricEmptyWakeups);
+        (*values)[kMetricSpinPolls] = _metrics.Get(kMetricSpinPolls);
+        (*values)[kMetricSpinHits] = _metrics.Get(kMetricSpinHits);
+    }
+
+private:
+    typedef struct Watch {
+        ConnectionId id { kInvalidConnectionId }; // what is on the fd now
+        EventHandler* handler { nullptr };
+    } Watch;
+
+    void RunDeferred();
+
+private:
+    uint32_t _index { 0 };
+    int32_t _epoll_fd { -1 };
+    std::atomic<bool> _quit { false }; // Loop() returns when set by Stop()
+    std::atomic<bool> _running { false }; // from Start()(or Loop()) until Loop() returns
+    std::atomic<bool> _looping { false }; // a thread is inside Loop(), maybe detached by Stop()
+    std::thread _thread; // started by Start()
+    std::vector<Watch> _watches; // handler of every fd, indexed by fd
+    std::vector<task_t> _deferred; // run at the end of this iteration
+    std::vector<task_t> _yielded; // run in the next iteration, which does not wait for events
+    LoopInbox _inbox; // tasks posted by other threads, watched through its eventfd
+    TimerWheel _timers; // the epoll_wait timeout is derived from the nearest one
+    uint64_t _now_ms { 0 };
+    uint32_t _busy_poll_us { 0 }; // spin window after events, 0 means never spin
+    uint64_t _last_event_us { 0 }; // when a wait last returned events, while busy polling
+    LoopMetrics _metrics; // written by the loop only
+};
+
+typedef std::shared_ptr<EventLoop> EventLoopPtr;
+
+// the timers one user added to a shared loop, so that all of them are cancelled when it stops while the loop
+// goes on. loop thread only
+class LoopTimers {
+public:
+    LoopTimers()                                   = default;
+    LoopTimers(const LoopTimers& other)            = delete;
+    LoopTimers& operator=(const LoopTimers& other) = delete;
+
+public:
+    void Attach(EventLoop* loop) {
+        _loop = loop;
+    }
+
+    TimerId Add(uint64_t delay_ms, callback_timer_t callback, uint64_t interval_ms = 0) {
+        std::shared_ptr<TimerId> holder = std::make_shared<TimerId>(kInvalidTimerId);
+        TimerId id = _loop->Timers().AddTimer(delay_ms, [this, holder, interval_ms, callback] {
+            if (interval_ms == 0) {
+                // a one shot timer is done
+                _ids.erase(*holder);
+            }
+            callback();
+        }, interval_ms);
+        *holder = id;
+        _ids.insert(id);
+        return id;
+    }
+
+    bool Cancel(TimerId id) {
+        if (_ids.erase(id) == 0) {
+            return false;
+        }
+        return _loop->Timers().CancelTimer(id);
+    }
+
+    void CancelAll() {
+        for (TimerId id : _ids) {
+            _loop->Timers().CancelTimer(id);
+        }
+        _ids.clear();
+    }
+
+private:
+    EventLoop* _loop { nullptr };
+    std::unordered_set<TimerId> _ids; // pending timers
+};
+
+} // namespace erpc
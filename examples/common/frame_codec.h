@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace erpc {
+
+static const uint32_t kMaxFrameSize = 64 * 1024 * 1024; // max body size of one frame
+static const uint32_t kMaxFrameHeaderSize = 5; // max header size(varint of uint32)
+
+// how a tcp stream is cut into messages
+enum class FrameCodecType : uint8_t {
+    kRaw     = 0, // no framing, bytes are delivered as they are read
+    kFixed32 = 1, // 4 bytes big endian body length + body
+    kVarint  = 2, // base 128 varint body length + body
+};
+
+// length prefix framing: encode a header before every message, and find complete messages in a byte stream
+class FrameCodec {
+public:
+    FrameCodec() = default;
+    explicit FrameCodec(FrameCodecType type)
+        : _type(type) {}
+
+public:
+    FrameCodecType Type() const {
+        return _type;
+    }
+
+    // whether a body of len bytes fits in one frame the peer accepts(Decode() rejects bigger ones), any size for raw
+    bool Fits(uint64_t len) const {
+        return _type == FrameCodecType::kRaw || len <= kMaxFrameSize;
+    }
+
+    // write the header of a body of len bytes into header(at least kMaxFrameHeaderSize), return header size
+    uint32_t EncodeHeader(uint32_t len, char* header) const {
+        switch (_type) {
+        case FrameCodecType::kFixed32:
+            header[0] = static_cast<char>(len >> 24);
+            header[1] = static_cast<char>(len >> 16);
+            header[2] = static_cast<char>(len >> 8);
+            header[3] = static_cast<char>(len);
+            return 4;
+        case FrameCodecType::kVarint: {
+            uint32_t size = 0;
+            while (len >= 0x80) {
+                header[size++] = static_cast<char>((len & 0x7f) | 0x80);
+                len >>= 7;
+            }
+            header[size++] = static_cast<char>(len);
+            return size;
+        }
+        default:
+            return 0;
+        }
+    }
+
+    // find the frame at the front of data.
+    // return 1 if a complete frame is there(and set header_size and body_size), 0 if more data is needed, -1 for a bad frame
+    int32_t Decode(const char* data, size_t size, uint32_t* header_size, uint32_t* body_size) const {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+        uint32_t hsize = 0;
+        uint32_t bsize = 0;
+        switch (_type) {
+        case FrameCodecType::kFixed32:
+            if (size < 4) {
+                return 0;
+            }
+            hsize = 4;
+            bsize = (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16)
+                    | (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+            break;
+        case FrameCodecType::kVarint: {
+            uint32_t shift = 0;
+            while (true) {
+                if (hsize >= size) {
+                    return 0;
+                }
+                if (hsize >= kMaxFrameHeaderSize) {
+                    return -1;
+                }
+                uint8_t byte = p[hsize++];
+                if (shift == 28 && byte > 0x0f) {
+                    // the 5th byte holds the top 4 bits of a uint32 and ends it, more would wrap around
+                    return -1;
+                }
+                bsize |= static_cast<uint32_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+                shift += 7;
+            }
+            break;
+        }
+        default:
+            // raw stream: whatever received is one message
+            if (size == 0) {
+                return 0;
+            }
+            *header_size = 0;
+            *body_size = static_cast<uint32_t>(size);
+            return 1;
+        }
+
+        if (bsize > kMaxFrameSize) {
+            return -1;
+        }
+        if (size < static_cast<size_t>(hsize) + bsize) {
+            return 0;
+        }
+        *header_size = hsize;
+        *body_size = bsize;
+        return 1;
+    }
+
+private:
+    FrameCodecType _type { FrameCodecType::kRaw };
+};
+
+// parse codec name(raw, fixed32, varint) given on command line, unknown name means raw
+inline FrameCodecType FrameCodecTypeFromString(const std::string& name) {
+    if (name == "fixed32") {
+        return FrameCodecType::kFixed32;
+    }
+    if (name == "varint") {
+        return FrameCodecType::kVarint;
+    }
+    return FrameCodecType::kRaw;
+}
+
+} // namespace erpc
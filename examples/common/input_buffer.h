@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstring>
+
+#include "buffer_pool.h"
+
+namespace erpc {
+
+// received but not yet consumed bytes of one connection, kept in a pooled block. read() writes straight into
+// the free tail, complete messages are consumed in place from the front, and can be handed out as views
+// of the block without copy. an empty buffer gives its block back, so idle connections hold no memory
+class InputBuffer {
+public:
+    explicit InputBuffer(const BufferPoolPtr& pool)
+        : _pool(pool) {}
+    InputBuffer(const InputBuffer& other)            = delete;
+    InputBuffer& operator=(const InputBuffer& other) = delete;
+    ~InputBuffer() {
+        if (_block) {
+            BufferPool::Release(_block);
+        }
+    }
+
+public:
+    // start of readable bytes
+    const char* Peek() const {
+        return _block ? _block->data() + _read_index : nullptr;
+    }
+
+    // number of readable bytes
+    size_t Readable() const {
+        return _write_index - _read_index;
+    }
+
+    // a view of len readable bytes from p(inside readable bytes), valid after they are retrieved
+    BufferView View(const char* p, size_t len) const {
+        return BufferView(_block, p, len);
+    }
+
+    // consume len bytes from the front
+    void Retrieve(size_t len) {
+        _read_index += len;
+        if (_read_index == _write_index && _block && _block->refs.load(std::memory_order_acquire) == 1) {
+            // empty and nobody else refers to the block, reuse the whole block from start
+            _read_index = 0;
+            _write_index = 0;
+        }
+    }
+
+    // give the block back to pool if nothing left to read
+    void Shrink() {
+        if (_block && Readable() == 0) {
+            BufferPool::Release(_block);
+            _block = nullptr;
+            _read_index = 0;
+            _write_index = 0;
+        }
+    }
+
+    // make sure at least len bytes can be written after readable bytes
+    void EnsureWritable(size_t len) {
+        if (Writable() >= len) {
+            return;
+        }
+        size_t readable = Readable();
+        if (_block && _block->refs.load(std::memory_order_acquire) == 1 && _block->capacity >= readable + len) {
+            // nobody refers to the consumed bytes, move readable bytes to the front
+            memmove(_block->data(), Peek(), readable);
+            _read_index = 0;
+            _write_index = readable;
+            return;
+        }
+
+        // switch to a new block, carrying the bytes of a partial message. a message bigger than one pooled block
+        // gets a block of double size, so that a huge message is not copied again on every read
+        size_t capacity = readable + len;
+        if (capacity > kBufferBlockSize) {
+            capacity *= 2;
+        }
+        BufferBlock* block = _pool->Acquire(static_cast<uint32_t>(capacity));
+        if (readable > 0) {
+            memcpy(block->data(), Peek(), readable);
+        }
+        if (_block) {
+            // views handed out still hold the old block
+            BufferPool::Release(_block);
+        }
+        _block = block;
+        _read_index = 0;
+        _write_index = readable;
+    }
+
+    // start of free space
+    char* WritePtr() {
+        return _block->data() + _write_index;
+    }
+
+    // size of free space
+    size_t Writable() const {
+        return _block ? _block->capacity - _write_index : 0;
+    }
+
+    // len bytes have been written into free space
+    void HasWritten(size_t len) {
+        _write_index += len;
+    }
+
+private:
+    BufferPoolPtr _pool; // where blocks come from
+    BufferBlock* _block { nullptr }; // current block, holding one ref
+    size_t _read_index { 0 }; // start of readable bytes
+    size_t _write_index { 0 }; // end of readable bytes
+};
+
+} // namespace erpc
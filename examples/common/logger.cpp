@@ -0,0 +1,220 @@
+#include "logger.h"
+
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+namespace erpc {
+
+static const char* kLogLevelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+// releases the ring of a thread when the thread exits, the flusher drops it after writing it out
+typedef struct LogRingHolder {
+    ~LogRingHolder() {
+        if (ring) {
+            ring->retired.store(true, std::memory_order_release);
+        }
+    }
+    LogRingPtr ring;
+} LogRingHolder;
+
+static thread_local LogRingHolder t_log_ring;
+
+Logger& Logger::Instance() {
+    // never destroyed: detached loop threads may still log while the process exits
+    static Logger* logger = [] {
+        Logger* l = new Logger();
+        std::atexit([] { Logger::Instance().Flush(); });
+        return l;
+    }();
+    return *logger;
+}
+
+Logger::Logger() {
+    // runtime level may be given by environment: ERPC_LOG_LEVEL=debug|info|warn|error
+    const char* level = getenv("ERPC_LOG_LEVEL");
+    if (level) {
+        for (int32_t i = kLogDebug; i <= kLogError; ++i) {
+            if (strcasecmp(level, kLogLevelNames[i]) == 0) {
+                _level.store(i, std::memory_order_relaxed);
+            }
+        }
+    }
+    _flusher = std::thread(&Logger::FlushLoop, this);
+}
+
+Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lock(_wait_mutex);
+        _stop = true;
+    }
+    _cond.notify_one();
+    if (_flusher.joinable()) {
+        _flusher.join();
+    }
+    Flush();
+}
+
+void Logger::SetOutput(FILE* out) {
+    Flush();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _out = out;
+}
+
+LogRing* Logger::ThreadRing() {
+    if (!t_log_ring.ring) {
+        auto ring = std::make_shared<LogRing>();
+        ring->tid = static_cast<int32_t>(syscall(SYS_gettid));
+        std::lock_guard<std::mutex> lock(_mutex);
+        _rings.push_back(ring);
+        t_log_ring.ring = ring;
+    }
+    return t_log_ring.ring.get();
+}
+
+void Logger::Log(LogLevel level, const char* file, int32_t line, const char* fmt, ...) {
+    LogRing* ring = ThreadRing();
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t used = tail - ring->head.load(std::memory_order_acquire);
+    if (used >= kLogRingSlots) {
+        // never block the io path on the console
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    LogSlot& slot = ring->slots[tail & (kLogRingSlots - 1)];
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    slot.time_us = static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+    slot.level = level;
+
+    const char* base = strrchr(file, '/');
+    int n = snprintf(slot.text, sizeof(slot.text), "%s:%d ", base ? base + 1 : file, line);
+    if (n < 0 || n >= static_cast<int>(sizeof(slot.text))) {
+        n = 0;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int m = vsnprintf(slot.text + n, sizeof(slot.text) - n, fmt, args);
+    va_end(args);
+    if (m < 0) {
+        m = 0;
+    }
+    slot.len = std::min<uint32_t>(n + m, sizeof(slot.text) - 1);
+
+    ring->tail.store(tail + 1, std::memory_order_release);
+    if (used + 1 >= kLogRingSlots / 2 && !_urgent.exchange(true, std::memory_order_relaxed)) {
+        _cond.notify_one();
+    }
+    Wake();
+}
+
+void Logger::Wake() {
+    // pairs with the store of sleeping and the check of the rings in FlushLoop(): either the flusher sees the
+    // line, or this sees it sleeping. the lock is only taken once per idle period
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleeping.load(std::memory_order_relaxed) && _sleeping.exchange(false, std::memory_order_acq_rel)) {
+        std::lock_guard<std::mutex> lock(_wait_mutex);
+        _cond.notify_one();
+    }
+}
+
+bool Logger::Pending() const {
+    for (auto& ring : _rings) {
+        if (ring->head.load(std::memory_order_relaxed) != ring->tail.load(std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Logger::Flush() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buf.clear();
+    time_t last_sec = 0;
+    char time_buf[32] = { 0 };
+
+    for (auto it = _rings.begin(); it != _rings.end();) {
+        LogRing* ring = it->get();
+        // read retired before tail: nothing is appended after the thread marked it
+        bool retired = ring->retired.load(std::memory_order_acquire);
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            const LogSlot& slot = ring->slots[head & (kLogRingSlots - 1)];
+            time_t sec = static_cast<time_t>(slot.time_us / 1000000);
+            if (sec != last_sec) {
+                struct tm tm;
+                localtime_r(&sec, &tm);
+                strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", &tm);
+                last_sec = sec;
+            }
+            char prefix[80];
+            int n = snprintf(prefix, sizeof(prefix), "[%s.%06u] [%s] [%d] ", time_buf,
+                             static_cast<uint32_t>(slot.time_us % 1000000), kLogLevelNames[slot.level], ring->tid);
+            _buf.append(prefix, n);
+            _buf.append(slot.text, slot.len);
+            _buf.push_back('\n');
+        }
+        ring->head.store(head, std::memory_order_release);
+
+        if (retired) {
+            _retired_dropped += ring->dropped.load(std::memory_order_relaxed);
+            it = _rings.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (!_buf.empty()) {
+        fwrite(_buf.data(), 1, _buf.size(), _out);
+        fflush(_out);
+    }
+}
+
+uint64_t Logger::Dropped() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint64_t dropped = _retired_dropped;
+    for (auto& ring : _rings) {
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+void Logger::FlushLoop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_wait_mutex);
+            // nothing to write: sleep until the next line comes, no periodic wakeup while idle
+            _sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool pending = false;
+            {
+                std::lock_guard<std::mutex> rings_lock(_mutex);
+                pending = Pending();
+            }
+            if (pending) {
+                _sleeping.store(false, std::memory_order_relaxed);
+            }
+            _cond.wait(lock, [this] { return _stop || !_sleeping.load(std::memory_order_acquire); });
+            // lines are pending: gather more of them for one write, unless a ring fills up
+            _cond.wait_for(lock, std::chrono::milliseconds(kLogFlushIntervalMs),
+                           [this] { return _stop || _urgent.load(std::memory_order_relaxed); });
+            _urgent.store(false, std::memory_order_relaxed);
+            if (_stop) {
+                return;
+            }
+        }
+        Flush();
+    }
+}
+
+} // namespace erpc
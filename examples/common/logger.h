@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace erpc {
+
+// log levels, from the most verbose
+enum LogLevel : int32_t {
+    kLogDebug = 0,
+    kLogInfo  = 1,
+    kLogWarn  = 2,
+    kLogError = 3,
+};
+
+// logs below this level are removed at compile time(arguments not even evaluated),
+// e.g. build with -DERPC_LOG_MIN_LEVEL=1 to drop all debug logs from the io path
+#ifndef ERPC_LOG_MIN_LEVEL
+#define ERPC_LOG_MIN_LEVEL 0
+#endif
+
+static const uint32_t kLogLineSize = 256;       // max size of one log message, longer ones are truncated
+static const uint32_t kLogRingSlots = 1024;     // log lines buffered per thread(power of 2)
+static const uint32_t kLogFlushIntervalMs = 5;  // lines are written at most this long after the first of a batch
+
+// one formatted log message waiting for flush
+typedef struct LogSlot {
+    uint64_t time_us { 0 }; // wall clock in microseconds
+    int32_t level { kLogInfo };
+    uint32_t len { 0 };     // length of text
+    char text[kLogLineSize];
+} LogSlot;
+
+// single producer(the logging thread) single consumer(the flusher) lock free ring of log lines
+typedef struct LogRing {
+    std::atomic<uint64_t> head { 0 }; // next slot to flush, written by flusher
+    std::atomic<uint64_t> tail { 0 }; // next slot to fill, written by the logging thread
+    std::atomic<bool> retired { false }; // the thread exited, drop the ring once flushed
+    std::atomic<uint64_t> dropped { 0 }; // lines dropped because the ring was full
+    int32_t tid { 0 };                   // id of the logging thread
+    LogSlot slots[kLogRingSlots];
+} LogRing;
+
+typedef std::shared_ptr<LogRing> LogRingPtr;
+
+// asynchronous logger: the calling thread only formats into its own ring, a background thread writes
+// all rings out, so no console io or lock is on the io path. if a ring is full the line is dropped
+class Logger {
+public:
+    Logger(const Logger& other)            = delete;
+    Logger& operator=(const Logger& other) = delete;
+    ~Logger();
+
+public:
+    static Logger& Instance();
+
+    // runtime level, logs below it are skipped(default info, or ERPC_LOG_LEVEL of environment)
+    void SetLevel(LogLevel level) {
+        _level.store(level, std::memory_order_relaxed);
+    }
+
+    bool Enabled(LogLevel level) const {
+        return level >= _level.load(std::memory_order_relaxed);
+    }
+
+    // where the flusher writes(default stdout)
+    void SetOutput(FILE* out);
+
+    // format a line into the ring of current thread
+    void Log(LogLevel level, const char* file, int32_t line, const char* fmt, ...)
+        __attribute__((format(printf, 5, 6)));
+
+    // write out everything logged so far, on the calling thread
+    void Flush();
+
+    // number of lines dropped because a ring was full
+    uint64_t Dropped();
+
+private:
+    Logger();
+    // ring of current thread, created on first log
+    LogRing* ThreadRing();
+    // background flush: sleeps until a line is logged, then writes the batch kLogFlushIntervalMs later(or as
+    // soon as a ring is half full)
+    void FlushLoop();
+    // whether a ring has lines to write, under mutex
+    bool Pending() const;
+    // the flusher may be asleep with nothing pending: wake it up, on the logging thread
+    void Wake();
+
+private:
+    std::atomic<int32_t> _level { kLogInfo }; // runtime level
+    std::mutex _mutex;                        // guards rings, output and flushing
+    std::vector<LogRingPtr> _rings;           // rings of all logging threads
+    FILE* _out { stdout };                    // output of flusher
+    std::string _buf;                         // flush buffer, one write per flush
+    uint64_t _retired_dropped { 0 };          // dropped lines of rings already released
+    bool _stop { false };                     // stop the flusher, under wait_mutex
+    std::mutex _wait_mutex;                   // the flusher waits under it, the io path never takes mutex
+    std::condition_variable _cond;            // wakes the flusher
+    std::atomic<bool> _sleeping { false };    // the flusher waits for the first line, not on a timer
+    std::atomic<bool> _urgent { false };      // a ring is half full, write it out before the interval
+    std::thread _flusher;                     // background flush thread
+};
+
+} // namespace erpc
+
+#define ERPC_LOG(level, fmt, ...)                                                              \
+    do {                                                                                       \
+        if ((level) >= ERPC_LOG_MIN_LEVEL && ::erpc::Logger::Instance().Enabled(level)) {      \
+            ::erpc::Logger::Instance().Log(level, __FILE__, __LINE__, fmt, ##__VA_ARGS__);     \
+        }                                                                                      \
+    } while (0)
+
+#define ERPC_LOG_DEBUG(fmt, ...) ERPC_LOG(::erpc::kLogDebug, fmt, ##__VA_ARGS__)
+#define ERPC_LOG_INFO(fmt, ...)  ERPC_LOG(::erpc::kLogInfo, fmt, ##__VA_ARGS__)
+#define ERPC_LOG_WARN(fmt, ...)  ERPC_LOG(::erpc::kLogWarn, fmt, ##__VA_ARGS__)
+#define ERPC_LOG_ERROR(fmt, ...) ERPC_LOG(::erpc::kLogError, fmt, ##__VA_ARGS__)
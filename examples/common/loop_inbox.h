@@ -0,0 +1,81 @@
+#pragma once
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+
+#include "mpsc_queue.h"
+#include "worker_pool.h"
+
+namespace erpc {
+
+// tasks posted to a loop from other threads: a lock free queue plus an eventfd the loop watches.
+// the eventfd is written only by the first post after the loop drained, so a burst of posts costs one wakeup
+class LoopInbox {
+public:
+    LoopInbox()                                  = default;
+    LoopInbox(const LoopInbox& other)            = delete;
+    LoopInbox& operator=(const LoopInbox& other) = delete;
+    ~LoopInbox() {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+
+public:
+    bool Init() {
+        _fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_fd >= 0 && _signaled.load(std::memory_order_acquire)) {
+            // posted before there was an eventfd to write: signal now, or no later post would
+            uint64_t one = 1;
+            ssize_t r = ::write(_fd, &one, sizeof(one));
+            (void)r;
+        }
+        return _fd >= 0;
+    }
+
+    // the eventfd to watch for EPOLLIN
+    int32_t fd() const {
+        return _fd;
+    }
+
+    // queue task for the loop, callable from any thread
+    void Post(task_t task) {
+        _tasks.Push(std::move(task));
+        if (!_signaled.exchange(true, std::memory_order_acq_rel)) {
+            uint64_t one = 1;
+            ssize_t r = ::write(_fd, &one, sizeof(one));
+            (void)r;
+        }
+    }
+
+    // on the loop, after the eventfd was readable: consume it and run everything posted so far
+    uint32_t Drain() {
+        uint64_t value = 0;
+        ssize_t r = ::read(_fd, &value, sizeof(value));
+        (void)r;
+        return RunPending();
+    }
+
+    // on the loop: run everything posted so far, when the eventfd has been consumed already(io_uring read)
+    uint32_t RunPending() {
+        // re-enable the signal first, a post racing with the drain below then wakes the loop again
+        _signaled.exchange(false, std::memory_order_acq_rel);
+        uint32_t count = 0;
+        task_t task;
+        while (_tasks.Pop(&task)) {
+            task();
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    int32_t _fd { -1 }; // eventfd
+    std::atomic<bool> _signaled { false }; // eventfd written and not drained yet
+    MpscQueue<task_t> _tasks; // posted tasks
+};
+
+} // namespace erpc
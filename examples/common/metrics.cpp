@@ -0,0 +1,159 @@
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+namespace erpc {
+
+static const int32_t kMetricsPollMs = 100; // how often the endpoint thread checks for stop
+
+typedef struct MetricInfo {
+    const char* name;
+    const char* type; // counter or gauge
+    const char* help;
+} MetricInfo;
+
+// in the order of MetricId
+static const MetricInfo kMetricInfos[kMetricCount] = {
+    { "loop_waits_total", "counter", "calls of epoll_wait or io_uring_enter waiting for events" },
+    { "loop_events_total", "counter", "events returned by waits" },
+    { "empty_wakeups_total", "counter", "waits returning no event" },
+    { "spin_polls_total", "counter", "zero timeout waits while busy polling" },
+    { "spin_hits_total", "counter", "busy polling waits returning events" },
+    { "accepted_total", "counter", "connections accepted" },
+    { "closed_total", "counter", "connections closed" },
+    { "read_calls_total", "counter", "read calls" },
+    { "bytes_read_total", "counter", "bytes received" },
+    { "read_eagain_total", "counter", "reads ending with EAGAIN" },
+    { "write_calls_total", "counter", "write calls" },
+    { "bytes_written_total", "counter", "bytes sent" },
+    { "write_eagain_total", "counter", "writes ending with EAGAIN" },
+    { "callbacks_total", "counter", "messages handed to recv callback" },
+    { "callback_ns_total", "counter", "nanoseconds spent in recv callbacks" },
+    { "read_pauses_total", "counter", "connections which stopped being read for an output watermark" },
+    { "connections", "gauge", "open connections" },
+    { "output_bytes", "gauge", "bytes queued in output buffers" },
+};
+
+MetricValues SumMetrics(const MetricsSnapshot& snapshot) {
+    MetricValues sum;
+    sum.fill(0);
+    for (auto& values : snapshot) {
+        for (uint32_t i = 0; i < kMetricCount; ++i) {
+            sum[i] += values[i];
+        }
+    }
+    return sum;
+}
+
+std::string MetricsToText(const std::string& prefix, const MetricsSnapshot& snapshot) {
+    std::string text;
+    char line[256];
+    for (uint32_t i = 0; i < kMetricCount; ++i) {
+        const MetricInfo& info = kMetricInfos[i];
+        snprintf(line, sizeof(line), "# HELP %s_%s %s\n# TYPE %s_%s %s\n",
+                 prefix.c_str(), info.name, info.help, prefix.c_str(), info.name, info.type);
+        text.append(line);
+        for (size_t loop = 0; loop < snapshot.size(); ++loop) {
+            snprintf(line, sizeof(line), "%s_%s{loop=\"%zu\"} %lu\n",
+                     prefix.c_str(), info.name, loop, static_cast<unsigned long>(snapshot[loop][i]));
+            text.append(line);
+        }
+    }
+    return text;
+}
+
+MetricsEndpoint::MetricsEndpoint(const std::string& local_ip, uint16_t local_port, std::function<std::string()> dump)
+    : _local_ip { local_ip },
+      _local_port { local_port },
+      _dump { dump } {}
+
+MetricsEndpoint::~MetricsEndpoint() {
+    Stop();
+}
+
+bool MetricsEndpoint::Start() {
+    int listenfd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenfd < 0) {
+        ERPC_LOG_ERROR("create metrics socket failed! errno=%d", errno);
+        return false;
+    }
+    int reuse = 1;
+    ::setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_local_port);
+    addr.sin_addr.s_addr = inet_addr(_local_ip.c_str());
+    if (::bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listenfd, 16) != 0) {
+        ERPC_LOG_ERROR("metrics endpoint %s:%u bind/listen failed! errno=%d", _local_ip.c_str(), _local_port, errno);
+        ::close(listenfd);
+        return false;
+    }
+    _listen_fd = listenfd;
+    _thread = std::thread(&MetricsEndpoint::ServeLoop, this);
+    ERPC_LOG_INFO("metrics endpoint listening on %s:%u", _local_ip.c_str(), _local_port);
+    return true;
+}
+
+bool MetricsEndpoint::Stop() {
+    _stop = true;
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    if (_listen_fd >= 0) {
+        ::close(_listen_fd);
+        _listen_fd = -1;
+    }
+    return true;
+}
+
+void MetricsEndpoint::ServeLoop() {
+    while (!_stop) {
+        struct pollfd pfd;
+        pfd.fd = _listen_fd;
+        pfd.events = POLLIN;
+        if (::poll(&pfd, 1, kMetricsPollMs) <= 0) {
+            continue;
+        }
+        int fd = ::accept4(_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        // the request itself does not matter, wait a little for it so that the client sees a clean close
+        char request[1024];
+        pfd.fd = fd;
+        if (::poll(&pfd, 1, kMetricsPollMs) > 0) {
+            ::recv(fd, request, sizeof(request), 0);
+        }
+
+        std::string body = _dump ? _dump() : std::string();
+        char header[128];
+        int n = snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+                         body.size());
+        std::string response(header, n);
+        response.append(body);
+        size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t r = ::send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (r <= 0) {
+                break;
+            }
+            sent += r;
+        }
+        ::close(fd);
+    }
+}
+
+} // namespace erpc
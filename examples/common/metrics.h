@@ -0,0 +1,124 @@
+#pragma once
+
+#include <time.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace erpc {
+
+// metrics of one event loop
+enum MetricId : uint32_t {
+    kMetricLoopWaits = 0,   // calls of epoll_wait(or io_uring_enter waiting for completions)
+    kMetricLoopEvents,      // events(completions) returned by those waits
+    kMetricEmptyWakeups,    // waits returning no event
+    kMetricSpinPolls,       // zero timeout waits of a busy polling loop(not in the waits above)
+    kMetricSpinHits,        // those returning events
+    kMetricAccepted,        // connections accepted
+    kMetricClosed,          // connections closed
+    kMetricReadCalls,       // read() calls(recv completions)
+    kMetricBytesRead,       // bytes received
+    kMetricReadEagain,      // reads ending with EAGAIN
+    kMetricWriteCalls,      // write calls(send completions)
+    kMetricBytesWritten,    // bytes sent
+    kMetricWriteEagain,     // writes ending with EAGAIN, the socket send buffer was full
+    kMetricCallbacks,       // messages handed to recv callback
+    kMetricCallbackNs,      // nanoseconds spent in recv callbacks
+    kMetricReadPauses,      // connections which stopped being read for an output watermark
+    kMetricConnections,     // gauge: open connections
+    kMetricOutputBytes,     // gauge: bytes queued in output buffers, not written yet
+    kMetricCount,
+};
+
+typedef std::array<uint64_t, kMetricCount> MetricValues;
+
+// values of every loop of a server(or client), index is the loop index
+typedef std::vector<MetricValues> MetricsSnapshot;
+
+// counters and gauges of one loop. only the loop thread writes them(plain load+store, no locked
+// instruction on the io path), any thread may read them for a snapshot
+class LoopMetrics {
+public:
+    LoopMetrics() {
+        for (auto& value : _values) {
+            value.store(0, std::memory_order_relaxed);
+        }
+    }
+    LoopMetrics(const LoopMetrics& other)            = delete;
+    LoopMetrics& operator=(const LoopMetrics& other) = delete;
+
+public:
+    void Add(MetricId id, uint64_t n = 1) {
+        _values[id].store(_values[id].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void Sub(MetricId id, uint64_t n = 1) {
+        _values[id].store(_values[id].load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+    }
+
+    uint64_t Get(MetricId id) const {
+        return _values[id].load(std::memory_order_relaxed);
+    }
+
+    MetricValues Snapshot() const {
+        MetricValues values;
+        for (uint32_t i = 0; i < kMetricCount; ++i) {
+            values[i] = _values[i].load(std::memory_order_relaxed);
+        }
+        return values;
+    }
+
+private:
+    std::atomic<uint64_t> _values[kMetricCount];
+};
+
+// monotonic clock in nanoseconds, for timing callbacks
+inline uint64_t MetricsNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// sum of all loops
+MetricValues SumMetrics(const MetricsSnapshot& snapshot);
+
+// text dump in prometheus exposition format, one line per metric and loop, e.g.
+// erpc_server_bytes_read_total{loop="0"} 1024
+std::string MetricsToText(const std::string& prefix, const MetricsSnapshot& snapshot);
+
+// minimal http endpoint serving a text dump: every request(e.g. curl ip:port/metrics) gets the output of
+// the dump function and the connection is closed. it runs on its own thread, away from the loops
+class MetricsEndpoint {
+public:
+    MetricsEndpoint()                                        = default;
+    MetricsEndpoint(const MetricsEndpoint& other)            = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint& other) = delete;
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const std::string& local_ip, uint16_t local_port, std::function<std::string()> dump);
+
+public:
+    bool Start();
+    bool Stop();
+
+private:
+    void ServeLoop();
+
+private:
+    std::string _local_ip; // http local ip
+    uint16_t _local_port { 0 }; // http local port
+    std::function<std::string()> _dump { nullptr }; // produces the text served
+    int32_t _listen_fd { -1 }; // listen fd
+    std::atomic<bool> _stop { false }; // stop serving
+    std::thread _thread; // serving thread
+};
+
+typedef std::shared_ptr<MetricsEndpoint> MetricsEndpointPtr;
+
+} // namespace erpc
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace erpc {
+
+// unbounded lock free queue, many producers and one consumer(intrusive list with a stub node, after Vyukov).
+// Push() is one exchange and one store from any thread; Pop() is only called by the consumer, and may miss a
+// push which has not linked its node yet, the producer signals the consumer after Push() returns anyway
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue()
+        : _head(new Node()),
+          _tail(_head.load(std::memory_order_relaxed)) {}
+    MpscQueue(const MpscQueue& other)            = delete;
+    MpscQueue& operator=(const MpscQueue& other) = delete;
+    ~MpscQueue() {
+        T value;
+        while (Pop(&value)) {
+        }
+        delete _tail;
+    }
+
+public:
+    void Push(T value) {
+        Node* node = new Node();
+        node->value = std::move(value);
+        Node* prev = _head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool Pop(T* value) {
+        Node* tail = _tail;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        // next becomes the stub, its value is moved out
+        *value = std::move(next->value);
+        _tail = next;
+        delete tail;
+        return true;
+    }
+
+private:
+    typedef struct Node {
+        std::atomic<Node*> next { nullptr };
+        T value;
+    } Node;
+
+    std::atomic<Node*> _head; // last pushed node, exchanged by producers
+    Node* _tail;              // stub node before the first value, only touched by the consumer
+};
+
+} // namespace erpc
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+namespace erpc {
+
+// position of bytes reserved in an output buffer, valid until the next Consume()
+typedef struct OutputMark {
+    size_t chunk { 0 };  // index in the queued chunks
+    size_t offset { 0 }; // offset in that chunk
+} OutputMark;
+
+static const uint32_t kCoalesceSize = 4096; // small messages are appended into the last chunk up to this size
+static const int32_t kMaxIovecs = 64;       // max iovecs of one writev
+
+// unsent bytes of one connection, a queue of chunks written out by writev()
+class OutputBuffer {
+public:
+    OutputBuffer()                                     = default;
+    OutputBuffer(const OutputBuffer& other)            = delete;
+    OutputBuffer& operator=(const OutputBuffer& other) = delete;
+
+public:
+    // queue bytes at the end of buffer
+    void Append(const char* data, size_t len) {
+        if (len == 0) {
+            return;
+        }
+        // merge small messages into one chunk, so that one iovec covers many of them
+        if (_chunks.size() > _sealed && _chunks.back().size() + len <= kCoalesceSize) {
+            _chunks.back().append(data, len);
+        } else {
+            _chunks.emplace_back(data, len);
+        }
+        _size += len;
+    }
+
+    void Append(const std::string& data) {
+        Append(data.data(), data.size());
+    }
+
+    bool Empty() const {
+        return _size == 0;
+    }
+
+    // total unsent bytes
+    size_t Size() const {
+        return _size;
+    }
+
+    // bytes ever consumed, i.e. the stream position of the first unsent byte. Consumed() + Size() is the
+    // position right after the last queued byte
+    uint64_t Consumed() const {
+        return _consumed;
+    }
+
+    // fill at most max_iov iovecs with the unsent bytes(in order) but no more than max_bytes of them, return the
+    // number of iovecs filled
+    int32_t PeekIovec(struct iovec* iov, int32_t max_iov, size_t max_bytes = SIZE_MAX) const {
+        int32_t cnt = 0;
+        size_t offset = _offset;
+        for (auto it = _chunks.begin(); it != _chunks.end() && cnt < max_iov && max_bytes > 0; ++it) {
+            iov[cnt].iov_base = const_cast<char*>(it->data() + offset);
+            iov[cnt].iov_len = std::min(it->size() - offset, max_bytes);
+            max_bytes -= iov[cnt].iov_len;
+            offset = 0;
+            ++cnt;
+        }
+        return cnt;
+    }
+
+    // drop len bytes from the front, which have been written to socket
+    void Consume(size_t len) {
+        _size -= len;
+        _consumed += len;
+        while (len > 0) {
+            size_t left = _chunks.front().size() - _offset;
+            if (len < left) {
+                _offset += len;
+                return;
+            }
+            len -= left;
+            _chunks.pop_front();
+            _offset = 0;
+            if (_sealed > 0) {
+                --_sealed;
+            }
+        }
+    }
+
+    // append len bytes to be filled later through At(), e.g. a header whose length field is known only
+    // after the body has been appended. the reserved bytes are always contiguous in one chunk
+    OutputMark Reserve(size_t len) {
+        if (_chunks.size() > _sealed && _chunks.back().size() + len <= kCoalesceSize) {
+            _chunks.back().append(len, '\0');
+        } else {
+            _chunks.emplace_back(len, '\0');
+        }
+        _size += len;
+        OutputMark mark;
+        mark.chunk = _chunks.size() - 1;
+        mark.offset = _chunks.back().size() - len;
+        return mark;
+    }
+
+    // the reserved bytes at mark
+    char* At(const OutputMark& mark) {
+        return &_chunks[mark.chunk][mark.offset];
+    }
+
+    // remove len reserved bytes at mark, when fewer than reserved were needed. moves the rest of that chunk,
+    // which is at most kCoalesceSize bytes, as bigger appends go to chunks of their own
+    void Erase(const OutputMark& mark, size_t len) {
+        _chunks[mark.chunk].erase(mark.offset, len);
+        _size -= len;
+    }
+
+    // drop the bytes appended since the buffer held size bytes, e.g. a message filled in place which turned out
+    // too big. only for bytes appended after the last Seal()
+    void Truncate(size_t size) {
+        while (_size > size) {
+            std::string& back = _chunks.back();
+            size_t drop = std::min(_size - size, back.size() - (_chunks.size() == 1 ? _offset : 0));
+            back.resize(back.size() - drop);
+            _size -= drop;
+            if (back.size() == (_chunks.size() == 1 ? _offset : 0)) {
+                _chunks.pop_back();
+                if (_chunks.empty()) {
+                    _offset = 0;
+                }
+                if (_sealed > _chunks.size()) {
+                    _sealed = _chunks.size();
+                }
+            }
+        }
+    }
+
+    // keep queued chunks unchanged from now on(new bytes go to new chunks), because an asynchronous send
+    // is reading them through the iovecs of PeekIovec()
+    void Seal() {
+        _sealed = _chunks.size();
+    }
+
+private:
+    std::deque<std::string> _chunks; // queued chunks
+    size_t _offset { 0 }; // bytes of _chunks.front() already sent
+    size_t _size { 0 }; // total unsent bytes
+    size_t _sealed { 0 }; // number of front chunks which must not be appended to
+    uint64_t _consumed { 0 }; // total bytes consumed
+};
+
+} // namespace erpc
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace erpc {
+
+// every rpc message is one frame(fixed32 or varint codec) starting with this header, the body follows:
+//   type(1) flags(1) status(2) method_id(4) request_id(8), big endian like the fixed32 frame header
+static const uint32_t kRpcHeaderSize = 16;
+
+enum RpcMessageType : uint8_t {
+    kRpcRequest  = 0,
+    kRpcResponse = 1,
+    // streams(see rpc_stream.h), request_id is the stream id chosen by the client
+    kRpcStreamOpen   = 2, // client to server: open a stream to method_id, no body
+    kRpcStreamData   = 3, // one message of the stream either way, within the credit given by the receiver
+    kRpcStreamCredit = 4, // the receiver takes more data: body is the credit in bytes, 4 bytes big endian
+    kRpcStreamClose  = 5, // the sender is done: the client half closes, the server ends the stream with status
+    kRpcStreamCancel = 6, // abort the stream both ways with status, no more messages
+};
+
+inline bool IsRpcStreamMessage(uint8_t type) {
+    return type >= kRpcStreamOpen && type <= kRpcStreamCancel;
+}
+
+// status of a call, sent by the server in a response or set by the client when the call did not complete
+enum RpcStatus : uint16_t {
+    kRpcOk               = 0,
+    kRpcNoMethod         = 1, // no handler registered for method_id on the server
+    kRpcBadRequest       = 2, // handler could not parse the request
+    kRpcInternalError    = 3, // handler failed
+    kRpcTimeout          = 4, // no response before the deadline(client side)
+    kRpcConnectionClosed = 5, // connection lost or client stopped with the call pending(client side)
+    kRpcSendFailed       = 6, // the request could not be written(client side)
+    kRpcCancelled        = 7, // a stream was cancelled
+    kRpcStreamRefused    = 8, // too many streams on the connection, or the stream id is taken
+    kRpcFlowControlError = 9, // a stream got data beyond the credit it gave
+};
+
+typedef struct RpcHeader {
+    uint8_t type { kRpcRequest };
+    uint8_t flags { 0 };      // reserved, 0
+    uint16_t status { kRpcOk };
+    uint32_t method_id { 0 };
+    uint64_t request_id { 0 }; // chosen by the client, echoed in the response
+} RpcHeader;
+
+// write header into buf(at least kRpcHeaderSize)
+inline void EncodeRpcHeader(const RpcHeader& header, char* buf) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(buf);
+    p[0] = header.type;
+    p[1] = header.flags;
+    p[2] = static_cast<uint8_t>(header.status >> 8);
+    p[3] = static_cast<uint8_t>(header.status);
+    for (uint32_t i = 0; i < 4; ++i) {
+        p[4 + i] = static_cast<uint8_t>(header.method_id >> (24 - 8 * i));
+    }
+    for (uint32_t i = 0; i < 8; ++i) {
+        p[8 + i] = static_cast<uint8_t>(header.request_id >> (56 - 8 * i));
+    }
+}
+
+// read the header at the front of a message, return false if the message is too short
+inline bool DecodeRpcHeader(const char* data, size_t size, RpcHeader* header) {
+    if (size < kRpcHeaderSize) {
+        return false;
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    header->type = p[0];
+    header->flags = p[1];
+    header->status = static_cast<uint16_t>((p[2] << 8) | p[3]);
+    header->method_id = 0;
+    for (uint32_t i = 0; i < 4; ++i) {
+        header->method_id = (header->method_id << 8) | p[4 + i];
+    }
+    header->request_id = 0;
+    for (uint32_t i = 0; i < 8; ++i) {
+        header->request_id = (header->request_id << 8) | p[8 + i];
+    }
+    return true;
+}
+
+// method id of a method name(32 bit fnv-1a), so that both sides may use names without sending them
+inline uint32_t RpcMethodId(const std::string& name) {
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+inline const char* RpcStatusString(uint16_t status) {
+    switch (status) {
+    case kRpcOk:
+        return "ok";
+    case kRpcNoMethod:
+        return "no method";
+    case kRpcBadRequest:
+        return "bad request";
+    case kRpcInternalError:
+        return "internal error";
+    case kRpcTimeout:
+        return "timeout";
+    case kRpcConnectionClosed:
+        return "connection closed";
+    case kRpcSendFailed:
+        return "send failed";
+    case kRpcCancelled:
+        return "cancelled";
+    case kRpcStreamRefused:
+        return "stream refused";
+    case kRpcFlowControlError:
+        return "flow control error";
+    default:
+        return "unknown";
+    }
+}
+
+} // namespace erpc
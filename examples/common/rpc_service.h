@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "connection_table.h"
+#include "frame_codec.h"
+#include "output_buffer.h"
+#include "rpc_protocol.h"
+#include "rpc_stream.h"
+#include "wire_schema.h"
+
+namespace erpc {
+
+static const uint32_t kRpcMaxMethods = 4096; // max methods of one service
+
+// appends the response body of a call straight into the output buffer of the connection
+class RpcWriter {
+public:
+    explicit RpcWriter(OutputBuffer* output)
+        : _output(output) {}
+
+public:
+    void Append(const char* data, size_t len) {
+        _output->Append(data, len);
+    }
+
+    void Append(const std::string& data) {
+        _output->Append(data);
+    }
+
+    // reserve len bytes to fill later, see OutputBuffer::Reserve()
+    OutputMark Reserve(size_t len) {
+        return _output->Reserve(len);
+    }
+
+    char* At(const OutputMark& mark) {
+        return _output->At(mark);
+    }
+
+    OutputBuffer* Output() {
+        return _output;
+    }
+
+private:
+    OutputBuffer* _output;
+};
+
+// who a request came from, for handlers which keep per connection state
+typedef struct RpcContext {
+    int32_t fd { -1 };         // connection
+    ConnectionId conn_id { kInvalidConnectionId }; // handle of the connection
+    uint32_t loop_index { 0 }; // loop running the handler
+    uint32_t method_id { 0 };
+    uint64_t request_id { 0 };
+} RpcContext;
+
+// handler of one method, runs on the loop owning the connection. request points into the receive buffer
+// (valid during the call only), the response body goes to response; return the status of the call,
+// whatever body was written is sent with any status
+using rpc_handler_t = std::function<uint16_t(const RpcContext& ctx, const char* request, size_t size, RpcWriter* response)>;
+
+// handler of a stream method, runs on the loop owning the connection when a client opened a stream to it: set the
+// callbacks of stream, then write to it(now or later, from any thread) and Close() it with the status of the call
+using rpc_stream_handler_t = std::function<void(const RpcContext& ctx, const RpcStreamPtr& stream)>;
+
+// methods served by a server, keyed by method id. registration happens before the server starts, then the
+// table is sealed into a perfect hash over a flat array, so dispatch is two hashes and one compare: no string
+// compare, no probing and no allocation
+class RpcService {
+public:
+    RpcService()                                   = default;
+    RpcService(const RpcService& other)            = delete;
+    RpcService& operator=(const RpcService& other) = delete;
+
+public:
+    // return false if method_id is taken, or the service is sealed already
+    bool Register(uint32_t method_id, rpc_handler_t handler) {
+        if (_sealed || _methods.size() >= kRpcMaxMethods) {
+            return false;
+        }
+        for (auto& method : _methods) {
+            if (method.id == method_id) {
+                return false;
+            }
+        }
+        Method method;
+        method.id = method_id;
+        method.handler = std::move(handler);
+        _methods.push_back(std::move(method));
+        return true;
+    }
+
+    bool Register(const std::string& name, rpc_handler_t handler) {
+        return Register(RpcMethodId(name), std::move(handler));
+    }
+
+    // a stream method, in the same id space as the others: server streaming, client streaming or both ways
+    bool RegisterStream(uint32_t method_id, rpc_stream_handler_t handler) {
+        if (!Register(method_id, nullptr)) {
+            return false;
+        }
+        _methods.back().stream_handler = std::move(handler);
+        return true;
+    }
+
+    bool RegisterStream(const std::string& name, rpc_stream_handler_t handler) {
+        return RegisterStream(RpcMethodId(name), std::move(handler));
+    }
+
+    // typed handler: Request needs bool Parse(const char* data, size_t size), Response needs
+    // void SerializeTo(RpcWriter* writer); a request failing to parse is answered with kRpcBadRequest
+    template <typename Request, typename Response>
+    bool RegisterTyped(uint32_t method_id, std::function<uint16_t(const RpcContext&, const Request&, Response*)> handler) {
+        return Register(method_id, [handler](const RpcContext& ctx, const char* data, size_t size, RpcWriter* writer) {
+            Request request;
+            if (!request.Parse(data, size)) {
+                return static_cast<uint16_t>(kRpcBadRequest);
+            }
+            Response response;
+            uint16_t status = handler(ctx, request, &response);
+            if (status == kRpcOk) {
+                response.SerializeTo(writer);
+            }
+            return status;
+        });
+    }
+
+    // handler of wire_schema.h messages: the request is read in place from the receive buffer and the response
+    // built in place in the output buffer, no decode and no encode. a request failing to parse is answered with
+    // kRpcBadRequest; the response built is sent with any status
+    template <typename Request, typename Response>
+    bool RegisterWire(uint32_t method_id,
+                      std::function<uint16_t(const RpcContext&, const WireReader<Request>&, WireBuilder<Response>*)> handler) {
+        return Register(method_id, [handler](const RpcContext& ctx, const char* data, size_t size, RpcWriter* writer) {
+            WireReader<Request> request;
+            if (!request.Parse(data, size)) {
+                return static_cast<uint16_t>(kRpcBadRequest);
+            }
+            WireBuilder<Response> response(writer->Output());
+            return handler(ctx, request, &response);
+        });
+    }
+
+    template <typename Request, typename Response>
+    bool RegisterWire(const std::string& name,
+                      std::function<uint16_t(const RpcContext&, const WireReader<Request>&, WireBuilder<Response>*)> handler) {
+        return RegisterWire<Request, Response>(RpcMethodId(name), std::move(handler));
+    }
+
+    // build the lookup table, called by the server on Start(); no Register() after.
+    // hash and displace: ids are spread over buckets, and every bucket, biggest first, gets the first seed
+    // which moves all its ids to free slots of a flat table twice the number of methods
+    void Seal() {
+        if (_sealed) {
+            return;
+        }
+        _sealed = true;
+        uint32_t slot_bits = 1;
+        while ((1u << slot_bits) < 2 * _methods.size()) {
+            ++slot_bits;
+        }
+        uint32_t bucket_bits = slot_bits > 2 ? slot_bits - 2 : 1;
+        while (!TryBuild(slot_bits, bucket_bits)) {
+            // practically never: a bigger table
+            ++slot_bits;
+        }
+    }
+
+    // handler of method_id, nullptr if none. only after Seal()
+    const rpc_handler_t* Find(uint32_t method_id) const {
+        const Method* method = Lookup(method_id);
+        return method && method->handler ? &method->handler : nullptr;
+    }
+
+    // stream handler of method_id, nullptr if none. only after Seal()
+    const rpc_stream_handler_t* FindStream(uint32_t method_id) const {
+        const Method* method = Lookup(method_id);
+        return method && method->stream_handler ? &method->stream_handler : nullptr;
+    }
+
+    // serve one request message(rpc header + body): run its handler and append the framed response to
+    // output, without copying the response body. return false if the message is not a request
+    bool Serve(const FrameCodec& codec, const char* data, size_t size, RpcContext* ctx, OutputBuffer* output) const {
+        RpcHeader header;
+        if (!DecodeRpcHeader(data, size, &header) || header.type != kRpcRequest) {
+            return false;
+        }
+        ctx->method_id = header.method_id;
+        ctx->request_id = header.request_id;
+
+        // frame header and rpc header go before the body, whose length is known only afterwards
+        OutputMark mark = output->Reserve(kMaxFrameHeaderSize + kRpcHeaderSize);
+        size_t begin = output->Size();
+        const rpc_handler_t* handler = Find(header.method_id);
+        if (handler) {
+            RpcWriter writer(output);
+            header.status = (*handler)(*ctx, data + kRpcHeaderSize, size - kRpcHeaderSize, &writer);
+        } else {
+            header.status = kRpcNoMethod;
+        }
+        header.type = kRpcResponse;
+        if (!codec.Fits(kRpcHeaderSize + (output->Size() - begin))) {
+            // the client would take it for a bad frame and close the connection
+            output->Truncate(begin);
+            header.status = kRpcInternalError;
+        }
+
+        char frame_header[kMaxFrameHeaderSize];
+        uint32_t frame_header_size = codec.EncodeHeader(kRpcHeaderSize + (output->Size() - begin), frame_header);
+        // headers at the end of the reserved bytes, drop the unused front
+        uint32_t unused = kMaxFrameHeaderSize - frame_header_size;
+        char* p = output->At(mark);
+        memcpy(p + unused, frame_header, frame_header_size);
+        EncodeRpcHeader(header, p + kMaxFrameHeaderSize);
+        if (unused > 0) {
+            output->Erase(mark, unused);
+        }
+        return true;
+    }
+
+    // serve one stream message(rpc header + body) of a connection: open a stream to the handler of its method, or
+    // hand it to its stream among streams, the streams of the connection. they send through transport, which
+    // also tells the client why a stream could not be opened. return false if the message is not a stream message
+    bool ServeStream(const char* data, size_t size, RpcContext* ctx, RpcStreamTable* streams,
+                     const RpcStreamTransportPtr& transport) const {
+        RpcHeader header;
+        if (!DecodeRpcHeader(data, size, &header) || !IsRpcStreamMessage(header.type)) {
+            return false;
+        }
+        if (header.type != kRpcStreamOpen) {
+            streams->Dispatch(header, data + kRpcHeaderSize, size - kRpcHeaderSize);
+            return true;
+        }
+        ctx->method_id = header.method_id;
+        ctx->request_id = header.request_id;
+        const rpc_stream_handler_t* handler = FindStream(header.method_id);
+        RpcStreamPtr stream;
+        if (handler) {
+            stream = std::make_shared<RpcStream>(header.request_id, header.method_id, false, transport);
+        }
+        if (!stream || !streams->Add(stream)) {
+            // ends the stream on the client
+            header.type = handler ? kRpcStreamCancel : kRpcStreamClose;
+            header.status = handler ? kRpcStreamRefused : kRpcNoMethod;
+            transport->Send(header, nullptr, 0);
+            return true;
+        }
+        (*handler)(*ctx, stream);
+        return true;
+    }
+
+    size_t Size() const {
+        return _methods.size();
+    }
+
+private:
+    typedef struct Method {
+        uint32_t id { 0 };
+        rpc_handler_t handler { nullptr };
+        rpc_stream_handler_t stream_handler { nullptr }; // a stream method instead
+    } Method;
+
+    const Method* Lookup(uint32_t method_id) const {
+        uint32_t seed = _seeds[Mix(method_id, 0) >> _bucket_shift];
+        const Method* method = _slots[Mix(method_id, seed) >> _slot_shift];
+        return method && method->id == method_id ? method : nullptr;
+    }
+
+    static uint32_t Mix(uint32_t x, uint32_t seed) {
+        x ^= seed * 0x9e3779b9u;
+        x *= 0x85ebca6bu;
+        x ^= x >> 13;
+        x *= 0xc2b2ae35u;
+        x ^= x >> 16;
+        return x;
+    }
+
+    bool TryBuild(uint32_t slot_bits, uint32_t bucket_bits) {
+        static const uint32_t kMaxSeed = 1 << 16;
+        uint32_t slot_shift = 32 - slot_bits;
+        uint32_t bucket_shift = 32 - bucket_bits;
+        std::vector<std::vector<const Method*>> buckets(1u << bucket_bits);
+        for (auto& method : _methods) {
+            buckets[Mix(method.id, 0) >> bucket_shift].push_back(&method);
+        }
+        std::vector<uint32_t> order(buckets.size());
+        for (uint32_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&buckets](uint32_t a, uint32_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        std::vector<const Method*> slots(1u << slot_bits, nullptr);
+        std::vector<uint32_t> seeds(buckets.size(), 0);
+        std::vector<uint32_t> taken;
+        for (uint32_t index : order) {
+            const std::vector<const Method*>& bucket = buckets[index];
+            if (bucket.empty()) {
+                break;
+            }
+            uint32_t seed = 1;
+            for (; seed < kMaxSeed; ++seed) {
+                taken.clear();
+                for (auto method : bucket) {
+                    uint32_t slot = Mix(method->id, seed) >> slot_shift;
+                    if (slots[slot] || std::find(taken.begin(), taken.end(), slot) != taken.end()) {
+                        break;
+                    }
+                    taken.push_back(slot);
+                }
+                if (taken.size() == bucket.size()) {
+                    break;
+                }
+            }
+            if (seed == kMaxSeed) {
+                return false;
+            }
+            for (uint32_t i = 0; i < bucket.size(); ++i) {
+                slots[taken[i]] = bucket[i];
+            }
+            seeds[index] = seed;
+        }
+        _slots.swap(slots);
+        _seeds.swap(seeds);
+        _slot_shift = slot_shift;
+        _bucket_shift = bucket_shift;
+        return true;
+    }
+
+private:
+    bool _sealed { false };
+    std::vector<Method> _methods; // registered methods, not moved after sealed
+    std::vector<const Method*> _slots = std::vector<const Method*>(2, nullptr); // flat table of methods
+    std::vector<uint32_t> _seeds = std::vector<uint32_t>(2, 0); // seed of every bucket
+    uint32_t _slot_shift { 31 };
+    uint32_t _bucket_shift { 31 };
+};
+
+typedef std::shared_ptr<RpcService> RpcServicePtr;
+
+} // namespace erpc
@@ -0,0 +1,429 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "rpc_protocol.h"
+#include "worker_pool.h"
+
+namespace erpc {
+
+static const uint32_t kRpcStreamWindow = 64 * 1024; // credit of a stream each way when opened, in bytes of data messages
+static const uint32_t kRpcMaxStreams = 256;         // open streams of one connection, more are refused
+
+// a message of the peer on a stream, data is valid during the call only
+using callback_stream_message_t = std::function<void(const char* data, size_t size)>;
+// the stream ended with status, exactly once
+using callback_stream_close_t = std::function<void(uint16_t status)>;
+
+// what a stream tells its user, on the loop thread of its connection
+typedef struct RpcStreamCallbacks {
+    // a message is credited back once on_message returned. false to credit only through Grant(), e.g. while
+    // messages wait in a queue of the application
+    bool auto_credit { true };
+    callback_stream_message_t on_message { nullptr }; // a message came
+    task_t on_half_close { nullptr }; // server side: the client is done sending, the stream goes on until Close()
+    task_t on_writable { nullptr };   // credit came back after Write() had to buffer, Writable() again
+    callback_stream_close_t on_close { nullptr }; // ended: closed by the server, cancelled, or the connection is lost
+} RpcStreamCallbacks;
+
+// how a stream reaches the connection it is multiplexed on, given by the server and by RpcClient
+class RpcStreamTransport {
+public:
+    virtual ~RpcStreamTransport() = default;
+    // queue one message of a stream on the connection, on the loop thread. false if the connection is gone
+    virtual bool Send(const RpcHeader& header, const char* body, size_t size) = 0;
+    // run task on the loop thread of the connection, at once if called on it
+    virtual void RunInLoop(task_t task) = 0;
+    virtual bool InLoopThread() const = 0;
+    // stream id ended, drop it from the streams of the connection. loop thread
+    virtual void Forget(uint64_t id) = 0;
+};
+
+typedef std::shared_ptr<RpcStreamTransport> RpcStreamTransportPtr;
+
+// one stream of messages each way between a client and a server, many of them multiplexed on one connection.
+// a side sends only as many bytes(rpc header included) as the other gave credit for: kRpcStreamWindow when
+// opened, and more with every kRpcStreamCredit the receiver sends back as it consumes messages. a writer out of
+// credit buffers the messages of that stream only, so a slow reader holds up its own stream, never the connection
+// or the other streams on it; a writer waiting for on_writable once Writable() turned false keeps that buffer
+// bounded too. all state lives on the loop thread of the connection, Write(), Close(), Cancel() and Grant() may be
+// called from any thread and hand over to it
+class RpcStream : public std::enable_shared_from_this<RpcStream> {
+public:
+    RpcStream()                                  = delete;
+    RpcStream(const RpcStream& other)            = delete;
+    RpcStream& operator=(const RpcStream& other) = delete;
+
+    // made by RpcClient::OpenStream() on the client, and by RpcService for every stream opened on the server
+    RpcStream(uint64_t id, uint32_t method_id, bool client, const RpcStreamTransportPtr& transport)
+        : _id(id),
+          _method_id(method_id),
+          _client(client),
+          _transport(transport) {}
+
+public:
+    // on the loop thread before messages come: in the stream handler on the server, by OpenStream() on the client
+    void SetCallbacks(const RpcStreamCallbacks& callbacks) {
+        _callbacks = callbacks;
+    }
+
+    // send one message: at once while there is credit, otherwise it waits in the stream until the peer gives more.
+    // false if the stream is closed for writing(Close(), Cancel() or ended)
+    bool Write(const char* data, size_t size) {
+        if (_write_closed) {
+            return false;
+        }
+        _buffered += size;
+        if (_transport->InLoopThread()) {
+            WriteInLoop(data, size);
+            return true;
+        }
+        std::shared_ptr<RpcStream> self = shared_from_this();
+        std::string message(data, size);
+        _transport->RunInLoop([self, message] { self->WriteInLoop(message.data(), message.size()); });
+        return true;
+    }
+
+    bool Write(const std::string& data) {
+        return Write(data.data(), data.size());
+    }
+
+    // done writing, after the messages written before went out: the client half closes(the server may go on), the
+    // server ends the stream with status
+    void Close(uint16_t status = kRpcOk) {
+        if (_write_closed.exchange(true)) {
+            return;
+        }
+        std::shared_ptr<RpcStream> self = shared_from_this();
+        _transport->RunInLoop([self, status] { self->CloseInLoop(status); });
+    }
+
+    // end the stream both ways now, buffered messages are dropped; the peer ends it with status too
+    void Cancel(uint16_t status = kRpcCancelled) {
+        _write_closed = true;
+        std::shared_ptr<RpcStream> self = shared_from_this();
+        _transport->RunInLoop([self, status] { self->CancelInLoop(status); });
+    }
+
+    // let the peer send bytes more, without auto_credit
+    void Grant(uint32_t bytes) {
+        std::shared_ptr<RpcStream> self = shared_from_this();
+        _transport->RunInLoop([self, bytes] { self->GrantInLoop(bytes); });
+    }
+
+    uint64_t Id() const {
+        return _id;
+    }
+
+    uint32_t MethodId() const {
+        return _method_id;
+    }
+
+    // whether there is credit left for another Write() after what is buffered, any thread. once false, wait for
+    // on_writable
+    bool Writable() const {
+        return !_write_closed && static_cast<int64_t>(_buffered) < _send_window;
+    }
+
+    // bytes written but not sent yet for lack of credit
+    size_t Buffered() const {
+        return _buffered;
+    }
+
+    bool Ended() const {
+        return _ended;
+    }
+
+public:
+    // the client tells the server, on the loop thread
+    void Open() {
+        Send(kRpcStreamOpen, kRpcOk, nullptr, 0);
+    }
+
+    // a message of this stream came, on the loop thread
+    void OnMessage(const RpcHeader& header, const char* body, size_t size) {
+        if (_ended) {
+            return;
+        }
+        // a callback may end the stream and drop the last reference elsewhere
+        std::shared_ptr<RpcStream> self = shared_from_this();
+        switch (header.type) {
+        case kRpcStreamData:
+            OnData(body, size);
+            break;
+        case kRpcStreamCredit:
+            if (size >= 4) {
+                _send_window += DecodeCredit(body);
+                FlushPending();
+            }
+            break;
+        case kRpcStreamClose:
+            if (_client) {
+                // the server is done, and so is the stream
+                End(header.status);
+            } else if (!_peer_closed) {
+                _peer_closed = true;
+                if (_callbacks.on_half_close) {
+                    ++_calling;
+                    _callbacks.on_half_close();
+                    --_calling;
+                    Release();
+                }
+            }
+            break;
+        case kRpcStreamCancel:
+            End(header.status);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // end without telling the peer, e.g. the connection is lost. loop thread
+    void Abort(uint16_t status) {
+        End(status);
+    }
+
+private:
+    void OnData(const char* body, size_t size) {
+        if (_peer_closed) {
+            // nothing after a close
+            return;
+        }
+        if (_recv_window <= 0) {
+            // the peer sent without credit: it would make us buffer without bound
+            CancelInLoop(kRpcFlowControlError);
+            return;
+        }
+        uint32_t cost = kRpcHeaderSize + size;
+        _recv_window -= cost;
+        if (_callbacks.on_message) {
+            ++_calling;
+            _callbacks.on_message(body, size);
+            --_calling;
+            Release();
+        }
+        if (_ended || !_callbacks.auto_credit) {
+            return;
+        }
+        // credit back in batches of half a window, one small message for many data messages
+        _unacked += cost;
+        if (_unacked >= kRpcStreamWindow / 2) {
+            GrantInLoop(_unacked);
+        }
+    }
+
+    void WriteInLoop(const char* data, size_t size) {
+        if (_ended || _close_queued) {
+            _buffered -= size;
+            return;
+        }
+        if (_pending.empty() && _send_window > 0) {
+            // a message bigger than the credit left still goes, the window goes below 0 until credit comes
+            SendData(data, size);
+        } else {
+            _pending.emplace_back(data, size);
+            _blocked = true;
+        }
+    }
+
+    void SendData(const char* data, size_t size) {
+        _send_window -= kRpcHeaderSize + size;
+        _buffered -= size;
+        if (_send_window <= 0) {
+            _blocked = true;
+        }
+        Send(kRpcStreamData, kRpcOk, data, size);
+    }
+
+    // send what credit allows of the buffered messages, and the close queued behind them
+    void FlushPending() {
+        while (!_ended && !_pending.empty() && _send_window > 0) {
+            std::string message;
+            message.swap(_pending.front());
+            _pending.pop_front();
+            SendData(message.data(), message.size());
+        }
+        if (_ended || !_pending.empty()) {
+            return;
+        }
+        if (_close_queued) {
+            SendClose();
+            return;
+        }
+        if (_blocked && _send_window > 0 && !_write_closed) {
+            _blocked = false;
+            if (_callbacks.on_writable) {
+                ++_calling;
+                _callbacks.on_writable();
+                --_calling;
+                Release();
+            }
+        }
+    }
+
+    void CloseInLoop(uint16_t status) {
+        if (_ended || _close_queued) {
+            return;
+        }
+        _close_queued = true;
+        _close_status = status;
+        if (_pending.empty()) {
+            SendClose();
+        }
+    }
+
+    void SendClose() {
+        if (!Send(kRpcStreamClose, _close_status, nullptr, 0)) {
+            return;
+        }
+        if (!_client) {
+            // the status of the server ends the stream
+            End(_close_status);
+        }
+    }
+
+    void CancelInLoop(uint16_t status) {
+        if (_ended) {
+            return;
+        }
+        Send(kRpcStreamCancel, status, nullptr, 0);
+        End(status);
+    }
+
+    void GrantInLoop(uint32_t bytes) {
+        if (_ended || bytes == 0) {
+            return;
+        }
+        _unacked -= bytes < _unacked ? bytes : _unacked;
+        _recv_window += bytes;
+        char body[4];
+        body[0] = static_cast<char>(bytes >> 24);
+        body[1] = static_cast<char>(bytes >> 16);
+        body[2] = static_cast<char>(bytes >> 8);
+        body[3] = static_cast<char>(bytes);
+        Send(kRpcStreamCredit, kRpcOk, body, sizeof(body));
+    }
+
+    static uint32_t DecodeCredit(const char* body) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(body);
+        return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    // one message of this stream to the connection, the stream ends if it is gone
+    bool Send(uint8_t type, uint16_t status, const char* body, size_t size) {
+        RpcHeader header;
+        header.type = type;
+        header.status = status;
+        header.method_id = _method_id;
+        header.request_id = _id;
+        if (_transport->Send(header, body, size)) {
+            return true;
+        }
+        End(kRpcSendFailed);
+        return false;
+    }
+
+    void End(uint16_t status) {
+        if (_ended) {
+            return;
+        }
+        std::shared_ptr<RpcStream> self = shared_from_this();
+        _ended = true;
+        _write_closed = true;
+        for (auto& message : _pending) {
+            _buffered -= message.size();
+        }
+        _pending.clear();
+        _transport->Forget(_id);
+        if (_callbacks.on_close) {
+            ++_calling;
+            _callbacks.on_close(status);
+            --_calling;
+        }
+        Release();
+    }
+
+    // the callbacks often hold the stream: drop them once it ended and none of them is running
+    void Release() {
+        if (_ended && _calling == 0) {
+            _callbacks = RpcStreamCallbacks();
+        }
+    }
+
+private:
+    uint64_t _id { 0 };
+    uint32_t _method_id { 0 };
+    bool _client { false }; // the client side of the stream
+    RpcStreamTransportPtr _transport;
+    RpcStreamCallbacks _callbacks;
+    std::atomic<bool> _write_closed { false }; // no more Write(), any thread
+    std::atomic<bool> _ended { false };
+    std::atomic<size_t> _buffered { 0 };                  // bytes written, not sent yet
+    std::atomic<int64_t> _send_window { kRpcStreamWindow }; // bytes the peer takes, written by the loop only
+    // loop thread only below
+    std::deque<std::string> _pending; // messages waiting for credit
+    int64_t _recv_window { kRpcStreamWindow }; // bytes the peer may still send
+    uint32_t _unacked { 0 };    // bytes consumed but not credited back yet
+    bool _blocked { false };    // ran out of credit, on_writable is due when it comes back
+    bool _close_queued { false }; // Close() waits for the buffered messages
+    uint16_t _close_status { kRpcOk };
+    bool _peer_closed { false }; // server side: the client half closed
+    uint32_t _calling { 0 };    // callbacks running
+};
+
+typedef std::shared_ptr<RpcStream> RpcStreamPtr;
+
+// the streams of one connection by id, on its loop thread
+class RpcStreamTable {
+public:
+    RpcStreamTable()                                       = default;
+    RpcStreamTable(const RpcStreamTable& other)            = delete;
+    RpcStreamTable& operator=(const RpcStreamTable& other) = delete;
+
+public:
+    // false if there are kRpcMaxStreams already, or the id is taken
+    bool Add(const RpcStreamPtr& stream) {
+        if (_streams.size() >= kRpcMaxStreams) {
+            return false;
+        }
+        return _streams.emplace(stream->Id(), stream).second;
+    }
+
+    void Erase(uint64_t id) {
+        _streams.erase(id);
+    }
+
+    // hand a message to its stream. one for a stream which ended here is dropped: it was on its way meanwhile
+    void Dispatch(const RpcHeader& header, const char* body, size_t size) {
+        auto it = _streams.find(header.request_id);
+        if (it != _streams.end()) {
+            RpcStreamPtr stream = it->second;
+            stream->OnMessage(header, body, size);
+        }
+    }
+
+    // end every stream with status without telling the peer, when the connection closed
+    void AbortAll(uint16_t status) {
+        std::unordered_map<uint64_t, RpcStreamPtr> streams;
+        streams.swap(_streams);
+        for (auto& it : streams) {
+            it.second->Abort(status);
+        }
+    }
+
+    size_t Size() const {
+        return _streams.size();
+    }
+
+private:
+    std::unordered_map<uint64_t, RpcStreamPtr> _streams;
+};
+
+} // namespace erpc
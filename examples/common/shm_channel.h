@@ -0,0 +1,361 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <new>
+
+#include "event_loop.h"
+#include "logger.h"
+#include "unix_socket.h"
+
+namespace erpc {
+
+static const uint32_t kDefaultShmRingSize = 1 << 20; // bytes of each direction of a shm connection
+static const uint32_t kMinShmRingSize = 4096;         // ring sizes are powers of two in this range
+static const uint32_t kMaxShmRingSize = 1 << 30;
+static const uint32_t kShmHeaderSize = 4096;          // the indexes of a ring, on a page of their own
+static const char kShmMagic[8] = { 'e', 'r', 'p', 'c', 's', 'h', 'm', '1' };
+
+// the indexes of one ring in shared memory. each side only trusts its own index, the other one is checked
+typedef struct ShmRingHeader {
+    alignas(64) std::atomic<uint64_t> head;           // bytes consumed, moved by the reader
+    alignas(64) std::atomic<uint64_t> tail;           // bytes produced, moved by the writer
+    alignas(64) std::atomic<uint32_t> reader_waiting; // the reader found it empty: wake it after producing
+    std::atomic<uint32_t> writer_waiting;             // the writer found it full: wake it after consuming
+} ShmRingHeader;
+
+static_assert(sizeof(ShmRingHeader) <= kShmHeaderSize, "ring header does not fit its page");
+
+// hello of the handshake: the client sends it with the memfd and its wakeup eventfd, the server answers it
+// with its own eventfd(ring_size 0 if it refuses)
+typedef struct ShmHello {
+    char magic[8];
+    uint32_t ring_size { 0 };
+    uint32_t reserved { 0 };
+} ShmHello;
+
+// one direction of a channel: a single producer single consumer byte ring
+class ShmRing {
+public:
+    void Attach(char* base, uint32_t size) {
+        _header = reinterpret_cast<ShmRingHeader*>(base);
+        _data = base + kShmHeaderSize;
+        _size = size;
+        _head = _header->head.load(std::memory_order_relaxed);
+        _tail = _header->tail.load(std::memory_order_relaxed);
+    }
+
+    ShmRingHeader* Header() const {
+        return _header;
+    }
+
+    // bytes the producer may write now
+    size_t Free() const {
+        uint64_t used = _tail - _header->head.load(std::memory_order_acquire);
+        return used < _size ? _size - used : 0;
+    }
+
+    // consumer: copy up to len bytes out, return the bytes copied, -1 if the producer broke the indexes
+    ssize_t Read(char* buf, size_t len) {
+        uint64_t tail = _header->tail.load(std::memory_order_acquire);
+        if (tail - _head > _size) {
+            return -1;
+        }
+        size_t n = std::min<uint64_t>(len, tail - _head);
+        size_t offset = _head & (_size - 1);
+        size_t first = std::min<size_t>(n, _size - offset);
+        memcpy(buf, _data + offset, first);
+        memcpy(buf + first, _data, n - first);
+        _head += n;
+        _header->head.store(_head, std::memory_order_release);
+        return n;
+    }
+
+    // producer: copy as much of iov as fits in, return the bytes copied, -1 if the consumer broke the indexes
+    ssize_t Write(const struct iovec* iov, int32_t cnt) {
+        uint64_t head = _header->head.load(std::memory_order_acquire);
+        if (_tail - head > _size) {
+            return -1;
+        }
+        size_t space = _size - (_tail - head);
+        size_t n = 0;
+        for (int32_t i = 0; i < cnt && n < space; ++i) {
+            size_t len = std::min<size_t>(iov[i].iov_len, space - n);
+            const char* src = static_cast<const char*>(iov[i].iov_base);
+            size_t offset = (_tail + n) & (_size - 1);
+            size_t first = std::min<size_t>(len, _size - offset);
+            memcpy(_data + offset, src, first);
+            memcpy(_data, src + first, len - first);
+            n += len;
+        }
+        _tail += n;
+        _header->tail.store(_tail, std::memory_order_release);
+        return n;
+    }
+
+private:
+    ShmRingHeader* _header { nullptr };
+    char* _data { nullptr };
+    uint32_t _size { 0 };  // power of two
+    uint64_t _head { 0 };  // own copy of the index this side moves
+    uint64_t _tail { 0 };
+};
+
+class ShmChannel;
+typedef std::shared_ptr<ShmChannel> ShmChannelPtr;
+
+// a connection over shared memory between two processes on one host: a memfd holding a ring per direction,
+// and an eventfd per side to wake it up. a side is only woken when it is waiting(found its ring empty to read,
+// or full to write), so a busy stream costs no syscall at all. the memfd and eventfds are handed over a unix
+// socket, which stays open to tell when the peer is gone. Read()/Writev() work like read()/writev() on a non
+// blocking socket, and the owner watches the channel on its loop for the wakeups(a read or write may go on)
+class ShmChannel : public EventHandler, public std::enable_shared_from_this<ShmChannel> {
+public:
+    ShmChannel()                                 = default;
+    ShmChannel(const ShmChannel& other)            = delete;
+    ShmChannel& operator=(const ShmChannel& other) = delete;
+    ~ShmChannel() override {
+        if (_memory) {
+            ::munmap(_memory, _memory_size);
+        }
+        if (_wake_fd >= 0) {
+            ::close(_wake_fd);
+        }
+        if (_peer_fd >= 0) {
+            ::close(_peer_fd);
+        }
+    }
+
+public:
+    // client: create the rings(ring_size rounded up to a power of two) and send them over the connected unix
+    // socket fd, then Finish() takes the answer. nullptr on error
+    static ShmChannelPtr Connect(int32_t fd, uint32_t ring_size) {
+        uint32_t size = kMinShmRingSize;
+        while (size < ring_size && size < kMaxShmRingSize) {
+            size <<= 1;
+        }
+        ShmChannelPtr channel = std::make_shared<ShmChannel>();
+        uint64_t memory_size = 2 * (static_cast<uint64_t>(kShmHeaderSize) + size);
+        int32_t memfd = ::memfd_create("erpc-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memfd < 0 || ::ftruncate(memfd, memory_size) < 0 ||
+            // the server maps it too: it must never shrink under it
+            ::fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0 ||
+            !channel->Map(memfd, size, true)) {
+            ERPC_LOG_ERROR("create shared memory of %u bytes failed! errno=%d", size, errno);
+            if (memfd >= 0) {
+                ::close(memfd);
+            }
+            return nullptr;
+        }
+        ShmHello hello;
+        memcpy(hello.magic, kShmMagic, sizeof(kShmMagic));
+        hello.ring_size = size;
+        int32_t fds[2] = { memfd, channel->_wake_fd };
+        ssize_t ret = SendWithFds(fd, &hello, sizeof(hello), fds, 2);
+        ::close(memfd);
+        if (ret != static_cast<ssize_t>(sizeof(hello))) {
+            ERPC_LOG_WARN("fd: %d send shm hello failed! errno=%d", fd, errno);
+            return nullptr;
+        }
+        return channel;
+    }
+
+    // client: take the answer of the server from fd, return 1 when the channel is ready, 0 if the answer did not
+    // come yet, -1 on error
+    int32_t Finish(int32_t fd) {
+        ShmHello hello;
+        int32_t peer_fd = -1;
+        uint32_t fd_num = 0;
+        ssize_t ret = RecvWithFds(fd, &hello, sizeof(hello), &peer_fd, 1, &fd_num);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (ret != static_cast<ssize_t>(sizeof(hello)) || fd_num != 1 || memcmp(hello.magic, kShmMagic, sizeof(kShmMagic)) != 0 ||
+            hello.ring_size != _ring_size) {
+            ERPC_LOG_WARN("fd: %d bad shm answer, refused or not a shm server!", fd);
+            if (peer_fd >= 0) {
+                ::close(peer_fd);
+            }
+            return -1;
+        }
+        _peer_fd = peer_fd;
+        return 1;
+    }
+
+    // server: take the hello of a client from fd, map its rings and answer. return 1 with channel set when
+    // ready, 0 if the hello did not come yet, -1 on error(channel is nullptr then)
+    static int32_t Accept(int32_t fd, ShmChannelPtr* channel) {
+        channel->reset();
+        ShmHello hello;
+        int32_t fds[2] = { -1, -1 };
+        uint32_t fd_num = 0;
+        ssize_t ret = RecvWithFds(fd, &hello, sizeof(hello), fds, 2, &fd_num);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        ShmChannelPtr accepted = std::make_shared<ShmChannel>();
+        accepted->_peer_fd = fds[1];
+        uint32_t size = hello.ring_size;
+        struct stat st;
+        int seals = fds[0] >= 0 ? ::fcntl(fds[0], F_GET_SEALS) : -1;
+        bool ok = ret == static_cast<ssize_t>(sizeof(hello)) && fd_num == 2 && memcmp(hello.magic, kShmMagic, sizeof(kShmMagic)) == 0 &&
+                  size >= kMinShmRingSize && size <= kMaxShmRingSize && (size & (size - 1)) == 0 &&
+                  // a memory the client could shrink would kill this process with SIGBUS
+                  seals >= 0 && (seals & F_SEAL_SHRINK) && ::fstat(fds[0], &st) == 0 &&
+                  static_cast<uint64_t>(st.st_size) >= 2 * (static_cast<uint64_t>(kShmHeaderSize) + size) &&
+                  accepted->Map(fds[0], size, false);
+        if (fds[0] >= 0) {
+            ::close(fds[0]);
+        }
+        if (!ok) {
+            ERPC_LOG_WARN("fd: %d bad shm hello, close it!", fd);
+            return -1;
+        }
+        hello.reserved = 0;
+        ret = SendWithFds(fd, &hello, sizeof(hello), &accepted->_wake_fd, 1);
+        if (ret != static_cast<ssize_t>(sizeof(hello))) {
+            ERPC_LOG_WARN("fd: %d send shm answer failed! errno=%d", fd, errno);
+            return -1;
+        }
+        *channel = accepted;
+        return 1;
+    }
+
+public:
+    // read up to len bytes like read() on a non blocking socket: -1 with EAGAIN when empty, and the peer wakes
+    // this side up when it wrote more
+    ssize_t Read(char* buf, size_t len) {
+        ssize_t n = _rx.Read(buf, len);
+        if (n == 0) {
+            // about to wait: ask for a wakeup, then look again in case the peer wrote before it saw the flag
+            _rx.Header()->reader_waiting.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            n = _rx.Read(buf, len);
+            if (n == 0) {
+                errno = EAGAIN;
+                return -1;
+            }
+        }
+        if (n < 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        // room again for a peer waiting to write
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_rx.Header()->writer_waiting.load(std::memory_order_relaxed) && _rx.Header()->writer_waiting.exchange(0)) {
+            Notify(_peer_fd);
+        }
+        return n;
+    }
+
+    // write like writev() on a non blocking socket: what fits, -1 with EAGAIN when full. if not all of it fit,
+    // the peer wakes this side up when it made room
+    ssize_t Writev(const struct iovec* iov, int32_t cnt) {
+        size_t total = 0;
+        for (int32_t i = 0; i < cnt; ++i) {
+            total += iov[i].iov_len;
+        }
+        ssize_t n = _tx.Write(iov, cnt);
+        if (n < 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (static_cast<size_t>(n) < total) {
+            // about to wait: ask for a wakeup, then look again in case the peer made room before it saw the flag,
+            // and wake this side itself if so
+            _tx.Header()->writer_waiting.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_tx.Free() > 0 && _tx.Header()->writer_waiting.exchange(0)) {
+                Notify(_wake_fd);
+            }
+        }
+        if (n == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_tx.Header()->reader_waiting.load(std::memory_order_relaxed) && _tx.Header()->reader_waiting.exchange(0)) {
+            Notify(_peer_fd);
+        }
+        return n;
+    }
+
+    // the eventfd to watch for EPOLLIN, calling this channel
+    int32_t WakeFd() const {
+        return _wake_fd;
+    }
+
+    // called on the loop when woken up: read and write may go on
+    void SetWakeCallback(task_t callback) {
+        _wake_callback = std::move(callback);
+    }
+
+    void OnEvents(int32_t /*fd*/, uint32_t /*events*/) override {
+        // the callback may close the connection owning this channel
+        ShmChannelPtr self = shared_from_this();
+        uint64_t value = 0;
+        ssize_t r = ::read(_wake_fd, &value, sizeof(value));
+        (void)r;
+        if (_wake_callback) {
+            _wake_callback();
+        }
+    }
+
+private:
+    // map the rings of memfd and create the wakeup eventfd of this side, client or server
+    bool Map(int32_t memfd, uint32_t size, bool client) {
+        _ring_size = size;
+        _memory_size = 2 * (static_cast<size_t>(kShmHeaderSize) + size);
+        void* memory = ::mmap(nullptr, _memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (memory == MAP_FAILED) {
+            return false;
+        }
+        _memory = static_cast<char*>(memory);
+        char* to_server = _memory;
+        char* to_client = _memory + kShmHeaderSize + size;
+        if (client) {
+            // a new memfd is zeroed, construct the indexes on it. both readers start waiting: the first bytes
+            // written wake them up
+            for (char* ring : { to_server, to_client }) {
+                ShmRingHeader* header = new (ring) ShmRingHeader();
+                header->reader_waiting.store(1, std::memory_order_relaxed);
+            }
+        }
+        _tx.Attach(client ? to_server : to_client, size);
+        _rx.Attach(client ? to_client : to_server, size);
+        _wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return _wake_fd >= 0;
+    }
+
+    // wake the side reading eventfd up
+    void Notify(int32_t eventfd) {
+        uint64_t one = 1;
+        ssize_t r = ::write(eventfd, &one, sizeof(one));
+        (void)r;
+    }
+
+private:
+    char* _memory { nullptr }; // both rings
+    size_t _memory_size { 0 };
+    uint32_t _ring_size { 0 };
+    ShmRing _tx; // written by this side
+    ShmRing _rx; // read by this side
+    int32_t _wake_fd { -1 }; // written by the peer to wake this side
+    int32_t _peer_fd { -1 }; // written by this side to wake the peer
+    task_t _wake_callback { nullptr };
+};
+
+} // namespace erpc
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <time.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace erpc {
+
+static const uint32_t kTimerWheelLevels = 4;     // 4 levels of 64 slots of 1ms ticks cover about 4.6 hours
+static const uint32_t kTimerWheelSlotBits = 6;   // 64 slots per level
+static const uint32_t kTimerWheelSlots = 1 << kTimerWheelSlotBits;
+
+typedef uint64_t TimerId;
+static const TimerId kInvalidTimerId = 0;
+
+// callback when timer expired, runs on the loop owning the timer
+using callback_timer_t = std::function<void()>;
+
+// a timer given before the loops exist, added to every loop when it starts
+typedef struct PendingTimer {
+    uint32_t delay_ms { 0 };
+    uint32_t interval_ms { 0 }; // 0 means one shot
+    callback_timer_t callback { nullptr };
+} PendingTimer;
+
+// hierarchical timing wheel with 1ms ticks, owned and driven by one loop(not thread safe).
+// adding and cancelling a timer are O(1), a timer is moved down one level at most kTimerWheelLevels times
+// before it fires, and the time to the next tick worth waking up for is found by bit scans, so the loop
+// may sleep in epoll_wait exactly until then
+class TimerWheel {
+public:
+    explicit TimerWheel(uint64_t now_ms = NowMs())
+        : _current(now_ms) {
+        for (uint32_t level = 0; level < kTimerWheelLevels; ++level) {
+            _occupied[level] = 0;
+        }
+    }
+    TimerWheel(const TimerWheel& other)            = delete;
+    TimerWheel& operator=(const TimerWheel& other) = delete;
+
+public:
+    // monotonic clock in milliseconds, the time base of all wheels
+    static uint64_t NowMs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    // the clock of the owner moved on to now_ms, before it handles events and tasks which may add timers. the
+    // wheel itself catches up in the next Advance(), the timers added meanwhile count from now_ms
+    void SetNow(uint64_t now_ms) {
+        _now = now_ms;
+    }
+
+    // call callback after delay_ms, then every interval_ms if interval_ms > 0
+    TimerId AddTimer(uint64_t delay_ms, callback_timer_t callback, uint64_t interval_ms = 0) {
+        TimerId id = ++_next_id;
+        Timer& timer = _timers[id];
+        // from the time of the owner, the last tick processed may be long ago after an idle wait. never in the
+        // current slot, which has been fired already
+        timer.expire = std::max(_now, _current) + (delay_ms > 0 ? delay_ms : 1);
+        timer.interval = interval_ms;
+        timer.callback = std::move(callback);
+        Insert(id, timer);
+        return id;
+    }
+
+    // return false if the timer has fired(one shot) or been cancelled already
+    bool CancelTimer(TimerId id) {
+        auto it = _timers.find(id);
+        if (it == _timers.end()) {
+            return false;
+        }
+        if (it->second.linked) {
+            Unlink(it->second);
+        }
+        // a timer cancelled in its own callback is just forgotten
+        _timers.erase(it);
+        return true;
+    }
+
+    // run every timer expired by now_ms, return the number of callbacks called
+    uint32_t Advance(uint64_t now_ms) {
+        uint32_t fired = 0;
+        while (_current < now_ms) {
+            if (_timers.empty()) {
+                // nothing to move down or fire, jump
+                _current = now_ms;
+                break;
+            }
+            ++_current;
+            // move the timers of the slots starting now one level down, highest level first
+            for (uint32_t level = kTimerWheelLevels - 1; level > 0; --level) {
+                if ((_current & ((1ULL << (level * kTimerWheelSlotBits)) - 1)) == 0) {
+                    Cascade(level, SlotIndex(_current, level));
+                }
+            }
+            fired += Fire(SlotIndex(_current, 0));
+        }
+        return fired;
+    }
+
+    // milliseconds until Advance() has something to do, -1 if there is no timer
+    int64_t NextTimeout(uint64_t now_ms) const {
+        if (_timers.empty()) {
+            return -1;
+        }
+        uint64_t next = UINT64_MAX;
+        for (uint32_t level = 0; level < kTimerWheelLevels; ++level) {
+            if (_occupied[level] == 0) {
+                continue;
+            }
+            // first occupied slot after the current one at this level
+            uint32_t shift = level * kTimerWheelSlotBits;
+            uint32_t index = SlotIndex(_current, level);
+            uint64_t rotated = RotateRight(_occupied[level], (index + 1) & (kTimerWheelSlots - 1));
+            uint64_t distance = __builtin_ctzll(rotated) + 1;
+            // the slot starts(is fired, or moved down) at this tick
+            uint64_t start = (((_current >> shift) + distance) << shift);
+            if (start < next) {
+                next = start;
+            }
+        }
+        return next > now_ms ? static_cast<int64_t>(next - now_ms) : 0;
+    }
+
+    // number of pending timers
+    size_t Size() const {
+        return _timers.size();
+    }
+
+private:
+    typedef struct Timer {
+        uint64_t expire { 0 };   // tick to fire at
+        uint64_t interval { 0 }; // period, 0 means one shot
+        callback_timer_t callback { nullptr };
+        bool linked { false };   // in a slot(not firing)
+        uint32_t level { 0 };
+        uint32_t slot { 0 };
+        std::list<TimerId>::iterator pos; // position in its slot, for O(1) cancel
+    } Timer;
+
+    static uint32_t SlotIndex(uint64_t tick, uint32_t level) {
+        return static_cast<uint32_t>(tick >> (level * kTimerWheelSlotBits)) & (kTimerWheelSlots - 1);
+    }
+
+    static uint64_t RotateRight(uint64_t bits, uint32_t n) {
+        return n == 0 ? bits : (bits >> n) | (bits << (64 - n));
+    }
+
+    // the level is the highest slot group in which expire differs from now, so a timer is always in a slot
+    // after the current one of its level, and reaches level 0 exactly when its group comes round
+    void Insert(TimerId id, Timer& timer) {
+        uint32_t level = 0;
+        uint32_t slot = 0;
+        if (timer.expire <= _current) {
+            // moved down to the tick being processed, fired right after
+            slot = SlotIndex(_current, 0);
+        } else {
+            uint64_t diff = timer.expire ^ _current;
+            level = (63 - __builtin_clzll(diff)) / kTimerWheelSlotBits;
+            if (level < kTimerWheelLevels) {
+                slot = SlotIndex(timer.expire, level);
+            } else {
+                level = kTimerWheelLevels - 1;
+                uint32_t shift = level * kTimerWheelSlotBits;
+                if ((timer.expire >> shift) - (_current >> shift) < kTimerWheelSlots) {
+                    // across a carry of the top level, but still within one round of it
+                    slot = SlotIndex(timer.expire, level);
+                } else {
+                    // beyond the wheel: park in the last slot of the top level, it is placed again from there
+                    slot = (SlotIndex(_current, level) + kTimerWheelSlots - 1) & (kTimerWheelSlots - 1);
+                }
+            }
+        }
+        std::list<TimerId>& list = _slots[level][slot];
+        timer.pos = list.insert(list.end(), id);
+        timer.level = level;
+        timer.slot = slot;
+        timer.linked = true;
+        _occupied[level] |= 1ULL << slot;
+    }
+
+    void Unlink(Timer& timer) {
+        std::list<TimerId>& list = _slots[timer.level][timer.slot];
+        list.erase(timer.pos);
+        if (list.empty()) {
+            _occupied[timer.level] &= ~(1ULL << timer.slot);
+        }
+        timer.linked = false;
+    }
+
+    void Cascade(uint32_t level, uint32_t slot) {
+        std::list<TimerId> list;
+        list.swap(_slots[level][slot]);
+        _occupied[level] &= ~(1ULL << slot);
+        for (TimerId id : list) {
+            Insert(id, _timers[id]);
+        }
+    }
+
+    uint32_t Fire(uint32_t slot) {
+        uint32_t fired = 0;
+        std::list<TimerId>& list = _slots[0][slot];
+        // callbacks may add timers(never into this slot) or cancel any timer, so take one at a time
+        while (!list.empty()) {
+            TimerId id = list.front();
+            auto it = _timers.find(id);
+            Unlink(it->second);
+            callback_timer_t callback = std::move(it->second.callback);
+            callback();
+            ++fired;
+
+            it = _timers.find(id);
+            if (it == _timers.end()) {
+                // cancelled in its callback
+                continue;
+            }
+            if (it->second.interval == 0) {
+                _timers.erase(it);
+                continue;
+            }
+            // periodic: next period from the planned time, skip periods missed by a late loop
+            Timer& timer = it->second;
+            timer.expire += timer.interval;
+            if (timer.expire <= _current) {
+                timer.expire = _current + timer.interval;
+            }
+            timer.callback = std::move(callback);
+            Insert(id, timer);
+        }
+        return fired;
+    }
+
+private:
+    uint64_t _current { 0 }; // last tick processed
+    uint64_t _now { 0 };     // time of the owner, ahead of current between its wait and Advance()
+    TimerId _next_id { kInvalidTimerId }; // last timer id handed out
+    std::unordered_map<TimerId, Timer> _timers; // pending timers
+    std::list<TimerId> _slots[kTimerWheelLevels][kTimerWheelSlots]; // timers of every slot
+    uint64_t _occupied[kTimerWheelLevels]; // bit per non empty slot
+};
+
+} // namespace erpc
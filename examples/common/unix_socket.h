@@ -0,0 +1,128 @@
+#pragma once
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace erpc {
+
+// how a server listens or a client connects, told by the address given instead of an ip
+enum class Transport : uint8_t {
+    kTcp  = 0, // "127.0.0.1": tcp to ip:port
+    kUnix = 1, // "unix:/path": a unix domain stream socket, "unix:@name" in the abstract namespace
+    kShm  = 2, // "shm:/path": a unix domain socket hands over shared memory rings, see shm_channel.h
+};
+
+// the transport of address, and the socket path of a local one in path
+inline Transport ParseTransport(const std::string& address, std::string* path = nullptr) {
+    Transport transport = Transport::kTcp;
+    size_t prefix = 0;
+    if (address.compare(0, 5, "unix:") == 0) {
+        transport = Transport::kUnix;
+        prefix = 5;
+    } else if (address.compare(0, 4, "shm:") == 0) {
+        transport = Transport::kShm;
+        prefix = 4;
+    }
+    if (path) {
+        *path = transport == Transport::kTcp ? std::string() : address.substr(prefix);
+    }
+    return transport;
+}
+
+// sockaddr of a unix socket path, '@' at the front for the abstract namespace. return the length to pass to
+// bind()/connect(), 0 if path does not fit
+inline socklen_t MakeUnixAddress(const std::string& path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr->sun_path)) {
+        return 0;
+    }
+    memcpy(addr->sun_path, path.data(), path.size());
+    if (path[0] == '@') {
+        // abstract: no file, the name is the bytes after the leading 0
+        addr->sun_path[0] = '\0';
+    }
+    return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path.size());
+}
+
+// send len bytes with fds attached(SCM_RIGHTS) over a unix socket, return bytes sent or -1
+inline ssize_t SendWithFds(int32_t fd, const void* data, size_t len, const int32_t* fds, uint32_t fd_num) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = len;
+    char control[CMSG_SPACE(sizeof(int32_t) * 4)];
+    if (fd_num > 4) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd_num > 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int32_t) * fd_num);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int32_t) * fd_num);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int32_t) * fd_num);
+    }
+    ssize_t ret = -1;
+    do {
+        ret = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+// receive up to len bytes and at most max_fds fds(close on exec) from a unix socket; fd_num tells how many
+// came, the rest stays -1. return bytes received, 0 at end of stream or -1
+inline ssize_t RecvWithFds(int32_t fd, void* data, size_t len, int32_t* fds, uint32_t max_fds, uint32_t* fd_num) {
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = len;
+    char control[CMSG_SPACE(sizeof(int32_t) * 4)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    *fd_num = 0;
+    for (uint32_t i = 0; i < max_fds; ++i) {
+        fds[i] = -1;
+    }
+    ssize_t ret = -1;
+    do {
+        ret = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        return ret;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        uint32_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int32_t);
+        const int32_t* received = reinterpret_cast<const int32_t*>(CMSG_DATA(cmsg));
+        for (uint32_t i = 0; i < count; ++i) {
+            if (*fd_num < max_fds) {
+                fds[(*fd_num)++] = received[i];
+            } else {
+                // more than asked for, do not leak them
+                ::close(received[i]);
+            }
+        }
+    }
+    return ret;
+}
+
+} // namespace erpc
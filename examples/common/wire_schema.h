@@ -0,0 +1,492 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "output_buffer.h"
+
+namespace erpc {
+
+// a binary message format read in place and built in place, described by a schema in C++ itself:
+//   struct Quote : public WireSchema<uint64_t, WireBytes, double, WireArray<uint32_t>> {
+//       typedef Field<0> Id;
+//       typedef Field<1> Symbol;
+//       typedef Field<2> Price;
+//       typedef Field<3> Sizes;
+//   };
+// layout of a message, all little endian:
+//   field_num(2) flags(2) vtable(2 * field_num) slots tail
+// the vtable holds the offset of the slot of every field from the start of the message, 0 if the field is
+// absent(read as 0 or empty). a slot is a scalar of its own size, or offset(4) size(4) of the bytes of a string,
+// array or nested message in the tail. the slot offsets of a schema are known at compile time, and a field is one
+// vtable load and one unaligned load away, no parsing. add fields only at the end of a schema and never change the
+// type of one: readers skip fields newer than their schema, and see those older writers did not know as absent
+static const uint32_t kWireHeaderSize = 4;       // field_num and flags
+static const uint32_t kWireMaxFixedSize = 65535; // header, vtable and slots, the vtable offsets are 16 bit
+
+template <size_t Size>
+struct WireBits;
+template <>
+struct WireBits<1> { typedef uint8_t Type; };
+template <>
+struct WireBits<2> { typedef uint16_t Type; };
+template <>
+struct WireBits<4> { typedef uint32_t Type; };
+template <>
+struct WireBits<8> { typedef uint64_t Type; };
+
+inline uint8_t WireSwap(uint8_t v) { return v; }
+inline uint16_t WireSwap(uint16_t v) { return __builtin_bswap16(v); }
+inline uint32_t WireSwap(uint32_t v) { return __builtin_bswap32(v); }
+inline uint64_t WireSwap(uint64_t v) { return __builtin_bswap64(v); }
+
+// load a little endian scalar from p, which needs no alignment: a message sits anywhere in a receive buffer
+template <typename T>
+inline T WireLoad(const char* p) {
+    typename WireBits<sizeof(T)>::Type bits;
+    memcpy(&bits, p, sizeof(bits));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bits = WireSwap(bits);
+#endif
+    T value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+template <>
+inline bool WireLoad<bool>(const char* p) {
+    return *p != 0;
+}
+
+// store a scalar at p little endian
+template <typename T>
+inline void WireStore(char* p, T value) {
+    typename WireBits<sizeof(T)>::Type bits;
+    memcpy(&bits, &value, sizeof(bits));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bits = WireSwap(bits);
+#endif
+    memcpy(p, &bits, sizeof(bits));
+}
+
+template <>
+inline void WireStore<bool>(char* p, bool value) {
+    *p = value ? 1 : 0;
+}
+
+// a string or bytes field, in place in the message
+typedef struct WireBytes {
+    WireBytes() = default;
+    WireBytes(const char* data, uint32_t size)
+        : data(data),
+          size(size) {}
+
+    std::string ToString() const {
+        return std::string(data, size);
+    }
+
+    const char* data { nullptr };
+    uint32_t size { 0 };
+} WireBytes;
+
+// an array field of scalars, in place in the message: an element is loaded on access
+template <typename T>
+class WireArray {
+public:
+    static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value, "arrays hold numbers only");
+
+    WireArray() = default;
+    WireArray(const char* data, uint32_t size)
+        : _data(data),
+          _size(size) {}
+
+public:
+    uint32_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    T operator[](uint32_t index) const {
+        return WireLoad<T>(_data + index * sizeof(T));
+    }
+
+private:
+    const char* _data { nullptr };
+    uint32_t _size { 0 }; // number of elements
+};
+
+// base of every schema, a field of a schema type is a nested message
+struct WireSchemaBase {};
+
+template <typename Schema>
+class WireReader;
+
+// how a field of type T is stored and read
+template <typename T, typename Enable = void>
+struct WireTraits;
+
+// numbers and bool, in a slot of their own size
+template <typename T>
+struct WireTraits<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+    typedef T Value;
+    static const uint32_t kSlotSize = sizeof(T);
+    static const uint32_t kElementSize = 0; // nothing in the tail
+
+    static Value Read(const char* /* message */, const char* slot) {
+        return WireLoad<T>(slot);
+    }
+};
+
+template <>
+struct WireTraits<WireBytes> {
+    typedef WireBytes Value;
+    static const uint32_t kSlotSize = 8;
+    static const uint32_t kElementSize = 1;
+
+    static Value Read(const char* message, const char* slot) {
+        return WireBytes(message + WireLoad<uint32_t>(slot), WireLoad<uint32_t>(slot + 4));
+    }
+};
+
+template <typename T>
+struct WireTraits<WireArray<T>> {
+    typedef WireArray<T> Value;
+    static const uint32_t kSlotSize = 8;
+    static const uint32_t kElementSize = sizeof(T);
+
+    static Value Read(const char* message, const char* slot) {
+        return WireArray<T>(message + WireLoad<uint32_t>(slot), WireLoad<uint32_t>(slot + 4) / sizeof(T));
+    }
+};
+
+// a nested message is checked when read: an invalid one reads as empty
+template <typename T>
+struct WireTraits<T, typename std::enable_if<std::is_base_of<WireSchemaBase, T>::value>::type> {
+    typedef WireReader<T> Value;
+    static const uint32_t kSlotSize = 8;
+    static const uint32_t kElementSize = 1;
+
+    static Value Read(const char* message, const char* slot) {
+        WireReader<T> reader;
+        reader.Parse(message + WireLoad<uint32_t>(slot), WireLoad<uint32_t>(slot + 4));
+        return reader;
+    }
+};
+
+template <uint16_t Index, typename... Types>
+struct WireTypeAt;
+
+template <typename T, typename... Rest>
+struct WireTypeAt<0, T, Rest...> {
+    typedef T Type;
+};
+
+template <uint16_t Index, typename T, typename... Rest>
+struct WireTypeAt<Index, T, Rest...> {
+    typedef typename WireTypeAt<Index - 1, Rest...>::Type Type;
+};
+
+// sizes of the slots of a field list
+template <typename... Types>
+struct WireSlots;
+
+template <>
+struct WireSlots<> {
+    static constexpr uint32_t Offset(uint16_t /* index */) {
+        return 0;
+    }
+};
+
+template <typename T, typename... Rest>
+struct WireSlots<T, Rest...> {
+    // bytes of the slots before index
+    static constexpr uint32_t Offset(uint16_t index) {
+        return index == 0 ? 0 : WireTraits<T>::kSlotSize + WireSlots<Rest...>::Offset(index - 1);
+    }
+};
+
+// field Index of schema Owner, the name of a field to read or set
+template <typename Owner, uint16_t Index>
+struct WireField {
+    static_assert(Index < Owner::kFieldNum, "no such field in the schema");
+
+    typedef Owner Schema;
+    typedef typename Owner::template TypeAt<Index>::Type Type;
+    static const uint16_t kIndex = Index;
+};
+
+// a schema: the types of its fields in order, Field<index> names one
+template <typename... FieldTypes>
+struct WireSchema : public WireSchemaBase {
+    static_assert(sizeof...(FieldTypes) > 0, "a schema needs a field");
+
+    template <uint16_t Index>
+    struct TypeAt {
+        typedef typename WireTypeAt<Index, FieldTypes...>::Type Type;
+    };
+    template <uint16_t Index>
+    using Field = WireField<WireSchema, Index>;
+
+    static const uint16_t kFieldNum = sizeof...(FieldTypes);
+
+    // offset of the slot of field index from the start of a message written with this schema
+    static constexpr uint32_t SlotOffset(uint16_t index) {
+        return kWireHeaderSize + 2 * kFieldNum + WireSlots<FieldTypes...>::Offset(index);
+    }
+
+    // header, vtable and slots
+    static constexpr uint32_t FixedSize() {
+        return SlotOffset(kFieldNum);
+    }
+
+    static uint32_t SlotSize(uint16_t index) {
+        static const uint32_t sizes[] = { WireTraits<FieldTypes>::kSlotSize... };
+        return sizes[index];
+    }
+
+    // bytes of one element in the tail, 0 for a scalar
+    static uint32_t ElementSize(uint16_t index) {
+        static const uint32_t sizes[] = { WireTraits<FieldTypes>::kElementSize... };
+        return sizes[index];
+    }
+};
+
+// reads a message of Schema in place, e.g. a request in the receive buffer
+template <typename Schema>
+class WireReader {
+public:
+    WireReader() = default;
+
+public:
+    // check the message of size bytes at data and refer to it: the slots and tail ranges of every field known to
+    // Schema are within size, so the accessors check nothing. the bytes must stay valid while reading(an rpc
+    // request during its handler, a response while its result is kept). false if invalid, then all is absent
+    bool Parse(const char* data, size_t size) {
+        _data = nullptr;
+        _size = 0;
+        _field_num = 0;
+        if (size < kWireHeaderSize || size > UINT32_MAX) {
+            return false;
+        }
+        uint16_t field_num = WireLoad<uint16_t>(data);
+        uint32_t fixed = kWireHeaderSize + 2u * field_num;
+        if (fixed > size) {
+            return false;
+        }
+        uint16_t known = field_num < Schema::kFieldNum ? field_num : Schema::kFieldNum;
+        for (uint16_t i = 0; i < known; ++i) {
+            uint32_t offset = WireLoad<uint16_t>(data + kWireHeaderSize + 2 * i);
+            if (offset == 0) {
+                continue;
+            }
+            if (offset < fixed || offset + Schema::SlotSize(i) > size) {
+                return false;
+            }
+            uint32_t element = Schema::ElementSize(i);
+            if (element > 0) {
+                uint64_t begin = WireLoad<uint32_t>(data + offset);
+                uint32_t len = WireLoad<uint32_t>(data + offset + 4);
+                if (begin + len > size || len % element != 0) {
+                    return false;
+                }
+            }
+        }
+        _data = data;
+        _size = static_cast<uint32_t>(size);
+        _field_num = field_num;
+        return true;
+    }
+
+    // whether the writer set Field
+    template <typename Field>
+    bool Has() const {
+        CheckField<Field>();
+        return SlotOf(Field::kIndex) != 0;
+    }
+
+    // Field in place: a number, WireBytes, WireArray or the WireReader of a nested message; 0 or empty if absent
+    template <typename Field>
+    typename WireTraits<typename Field::Type>::Value Get() const {
+        CheckField<Field>();
+        uint32_t offset = SlotOf(Field::kIndex);
+        if (offset == 0) {
+            return typename WireTraits<typename Field::Type>::Value();
+        }
+        return WireTraits<typename Field::Type>::Read(_data, _data + offset);
+    }
+
+    // Field, or value if absent
+    template <typename Field>
+    typename WireTraits<typename Field::Type>::Value Get(typename WireTraits<typename Field::Type>::Value value) const {
+        return Has<Field>() ? Get<Field>() : value;
+    }
+
+    bool Valid() const {
+        return _data != nullptr;
+    }
+
+    // the whole message
+    const char* Data() const {
+        return _data;
+    }
+
+    uint32_t Size() const {
+        return _size;
+    }
+
+private:
+    template <typename Field>
+    static void CheckField() {
+        static_assert(std::is_base_of<typename Field::Schema, Schema>::value, "field of another schema");
+    }
+
+    uint32_t SlotOf(uint16_t index) const {
+        return index < _field_num ? WireLoad<uint16_t>(_data + kWireHeaderSize + 2 * index) : 0;
+    }
+
+private:
+    const char* _data { nullptr };
+    uint32_t _size { 0 };
+    uint16_t _field_num { 0 }; // fields known to the writer
+};
+
+// builds a message of Schema at the end of an output buffer(or a string), without a copy in between: header,
+// vtable and slots are reserved at once and filled as fields are set, the bytes of strings, arrays and nested
+// messages are appended after them as they are set. nothing else may be appended to the output while building,
+// and there is nothing to finish: the message is complete after every Set()
+template <typename Schema>
+class WireBuilder {
+public:
+    static_assert(Schema::FixedSize() <= kWireMaxFixedSize, "too many fields for 16 bit slot offsets");
+
+    WireBuilder(const WireBuilder& other)            = delete;
+    WireBuilder& operator=(const WireBuilder& other) = delete;
+
+    // e.g. the response of a handler registered with RpcService::RegisterWire()
+    explicit WireBuilder(OutputBuffer* output)
+        : _output(output),
+          _begin(output->Size()) {
+        _mark = output->Reserve(Schema::FixedSize());
+        Init();
+    }
+
+    // e.g. the request of RpcClient::Call()
+    explicit WireBuilder(std::string* output)
+        : _string(output),
+          _begin(output->size()) {
+        output->resize(_begin + Schema::FixedSize());
+        Init();
+    }
+
+public:
+    // a number or bool field
+    template <typename Field>
+    typename std::enable_if<std::is_arithmetic<typename Field::Type>::value>::type
+    Set(typename Field::Type value) {
+        CheckField<Field>();
+        char* fixed = Fixed();
+        WireStore<typename Field::Type>(fixed + Schema::SlotOffset(Field::kIndex), value);
+        WireStore<uint16_t>(fixed + kWireHeaderSize + 2 * Field::kIndex, Schema::SlotOffset(Field::kIndex));
+    }
+
+    // a string or bytes field, or a nested message built before(e.g. into a string), copied into the tail
+    template <typename Field>
+    typename std::enable_if<std::is_same<typename Field::Type, WireBytes>::value ||
+                            std::is_base_of<WireSchemaBase, typename Field::Type>::value>::type
+    Set(const char* data, size_t size) {
+        CheckField<Field>();
+        SetTail(Field::kIndex, Schema::SlotOffset(Field::kIndex), data, size);
+    }
+
+    template <typename Field>
+    typename std::enable_if<std::is_same<typename Field::Type, WireBytes>::value ||
+                            std::is_base_of<WireSchemaBase, typename Field::Type>::value>::type
+    Set(const std::string& data) {
+        Set<Field>(data.data(), data.size());
+    }
+
+    // e.g. a string field of a request passed on without a copy in between
+    template <typename Field>
+    typename std::enable_if<std::is_same<typename Field::Type, WireBytes>::value>::type
+    Set(const WireBytes& data) {
+        Set<Field>(data.data, data.size);
+    }
+
+    // a nested message read from elsewhere
+    template <typename Field>
+    typename std::enable_if<std::is_base_of<WireSchemaBase, typename Field::Type>::value>::type
+    Set(const WireReader<typename Field::Type>& message) {
+        Set<Field>(message.Data(), message.Size());
+    }
+
+    // an array field of count numbers
+    template <typename Field, typename T>
+    typename std::enable_if<std::is_same<typename Field::Type, WireArray<T>>::value>::type
+    Set(const T* values, size_t count) {
+        CheckField<Field>();
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        std::string bytes(count * sizeof(T), '\0');
+        for (size_t i = 0; i < count; ++i) {
+            WireStore<T>(&bytes[i * sizeof(T)], values[i]);
+        }
+        SetTail(Field::kIndex, Schema::SlotOffset(Field::kIndex), bytes.data(), bytes.size());
+#else
+        SetTail(Field::kIndex, Schema::SlotOffset(Field::kIndex), reinterpret_cast<const char*>(values), count * sizeof(T));
+#endif
+    }
+
+    template <typename Field, typename T>
+    typename std::enable_if<std::is_same<typename Field::Type, WireArray<T>>::value>::type
+    Set(const std::vector<T>& values) {
+        Set<Field>(values.data(), values.size());
+    }
+
+    // bytes of the message so far
+    uint32_t Size() const {
+        return static_cast<uint32_t>((_output ? _output->Size() : _string->size()) - _begin);
+    }
+
+private:
+    template <typename Field>
+    static void CheckField() {
+        static_assert(std::is_base_of<typename Field::Schema, Schema>::value, "field of another schema");
+    }
+
+    void Init() {
+        // the reserved bytes are zero: no field set, flags 0
+        WireStore<uint16_t>(Fixed(), Schema::kFieldNum);
+    }
+
+    // header, vtable and slots; appending to the tail may move them
+    char* Fixed() {
+        return _output ? _output->At(_mark) : &(*_string)[_begin];
+    }
+
+    void SetTail(uint16_t index, uint32_t slot, const char* data, size_t size) {
+        uint32_t offset = Size();
+        if (_output) {
+            _output->Append(data, size);
+        } else {
+            _string->append(data, size);
+        }
+        char* fixed = Fixed();
+        WireStore<uint32_t>(fixed + slot, offset);
+        WireStore<uint32_t>(fixed + slot + 4, static_cast<uint32_t>(size));
+        WireStore<uint16_t>(fixed + kWireHeaderSize + 2 * index, slot);
+    }
+
+private:
+    OutputBuffer* _output { nullptr }; // builds into this, or into _string
+    std::string* _string { nullptr };
+    size_t _begin { 0 };  // size of the output before the message
+    OutputMark _mark;     // header, vtable and slots in _output
+};
+
+} // namespace erpc
@@ -0,0 +1,135 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+
+#include "logger.h"
+
+namespace erpc {
+
+// the WorkerTasks a task running on this thread belongs to
+static thread_local const void* t_running_tasks = nullptr;
+
+WorkerPool::WorkerPool(uint32_t thread_num)
+    : _thread_num { thread_num } {
+    if (_thread_num == 0) {
+        _thread_num = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (uint32_t i = 0; i < _thread_num; ++i) {
+        _queues.emplace_back(new WorkerQueue());
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    Stop();
+}
+
+bool WorkerPool::Start() {
+    if (!_threads.empty()) {
+        return false;
+    }
+    for (uint32_t i = 0; i < _thread_num; ++i) {
+        _threads.emplace_back(&WorkerPool::WorkerLoop, this, i);
+    }
+    ERPC_LOG_INFO("WorkerPool started! thread_num=%u", _thread_num);
+    return true;
+}
+
+bool WorkerPool::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+        _stop = true;
+    }
+    _sleep_cond.notify_all();
+    for (auto& thread : _threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    _threads.clear();
+    return true;
+}
+
+void WorkerPool::Submit(task_t task) {
+    WorkerQueue& queue = *_queues[_next.fetch_add(1, std::memory_order_relaxed) % _thread_num];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    _pending.fetch_add(1);
+    // a worker going to sleep counts itself before checking pending, so one of both sides sees the other
+    if (_sleepers.load() > 0) {
+        { std::lock_guard<std::mutex> lock(_sleep_mutex); }
+        _sleep_cond.notify_one();
+    }
+}
+
+bool WorkerPool::Take(uint32_t index, task_t* task) {
+    for (uint32_t i = 0; i < _thread_num; ++i) {
+        WorkerQueue& queue = *_queues[(index + i) % _thread_num];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            *task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        } else {
+            *task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        _pending.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::WorkerLoop(uint32_t index) {
+    task_t task;
+    while (!_stop) {
+        if (Take(index, &task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_sleep_mutex);
+        _sleepers.fetch_add(1);
+        _sleep_cond.wait(lock, [this] { return _stop || _pending.load() > 0; });
+        _sleepers.fetch_sub(1);
+    }
+}
+
+WorkerTasks::WorkerTasks()
+    : _state { std::make_shared<State>() } {}
+
+void WorkerTasks::Submit(const WorkerPoolPtr& pool, task_t task) {
+    std::shared_ptr<State> state = _state;
+    pool->Submit([state, task] {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->closed) {
+                // its owner is gone or going
+                return;
+            }
+            ++state->running;
+        }
+        const void* saved = t_running_tasks;
+        t_running_tasks = state.get();
+        task();
+        t_running_tasks = saved;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            --state->running;
+        }
+        state->cond.notify_all();
+    });
+}
+
+void WorkerTasks::Close() {
+    // a task closing its own owner waits for the others only
+    uint32_t self = t_running_tasks == _state.get() ? 1 : 0;
+    std::unique_lock<std::mutex> lock(_state->mutex);
+    _state->closed = true;
+    _state->cond.wait(lock, [this, self] { return _state->running <= self; });
+}
+
+} // namespace erpc
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "connection_table.h"
+
+namespace erpc {
+
+// a unit of work run on another thread
+using task_t = std::function<void()>;
+
+// work stealing thread pool for handlers too slow to run on a loop: every worker has its own queue, tasks
+// are spread over the queues round robin, and a worker with nothing to do takes from the back of the others
+class WorkerPool {
+public:
+    WorkerPool()                                   = delete;
+    WorkerPool(const WorkerPool& other)            = delete;
+    WorkerPool& operator=(const WorkerPool& other) = delete;
+    ~WorkerPool();
+
+    // thread_num == 0 means one worker per cpu core
+    explicit WorkerPool(uint32_t thread_num);
+
+public:
+    bool Start();
+    // wait for the workers to exit, tasks not started yet are dropped
+    bool Stop();
+    // run task on some worker, callable from any thread
+    void Submit(task_t task);
+
+    uint32_t Size() const {
+        return _thread_num;
+    }
+
+private:
+    typedef struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<task_t> tasks;
+    } WorkerQueue;
+
+    // own queue first(oldest task), then steal from the others(newest task)
+    bool Take(uint32_t index, task_t* task);
+    void WorkerLoop(uint32_t index);
+
+private:
+    uint32_t _thread_num { 0 };
+    std::vector<std::unique_ptr<WorkerQueue>> _queues; // one queue per worker
+    std::vector<std::thread> _threads;
+    std::atomic<uint32_t> _next { 0 };     // round robin of Submit()
+    std::atomic<int64_t> _pending { 0 };   // tasks queued and not taken yet
+    std::atomic<uint32_t> _sleepers { 0 }; // workers waiting on cond
+    std::mutex _sleep_mutex;
+    std::condition_variable _sleep_cond;   // wakes idle workers
+    std::atomic<bool> _stop { false };
+};
+
+typedef std::shared_ptr<WorkerPool> WorkerPoolPtr;
+
+// the tasks one server or client submitted to a pool it does not own: the pool outlives it, so Close() drops the
+// tasks still queued and waits for the running ones, after which none touches the owner any more
+class WorkerTasks {
+public:
+    WorkerTasks();
+
+public:
+    // run task on some worker of pool unless closed by then
+    void Submit(const WorkerPoolPtr& pool, task_t task);
+    // no task runs after this returns, but the one calling it(a callback stopping its owner). callable again
+    void Close();
+
+private:
+    typedef struct State {
+        std::mutex mutex;
+        std::condition_variable cond; // a task finished
+        uint32_t running { 0 };       // tasks running now
+        bool closed { false };
+    } State;
+
+    std::shared_ptr<State> _state; // shared with the tasks queued, which may outlive this
+};
+
+// the message a worker is running a recv callback for, so that SendData() there finds its loop and connection
+typedef struct WorkerContext {
+    const void* owner { nullptr }; // the server which offloaded the callback
+    uint32_t loop_index { 0 };     // loop owning the connection
+    int32_t fd { -1 };
+    ConnectionId conn_id { kInvalidConnectionId }; // tells the connection from a later one reusing fd
+} WorkerContext;
+
+} // namespace erpc
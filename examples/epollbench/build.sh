@@ -0,0 +1,3 @@
+#!/bin/bash
+
+/opt/compiler/gcc-8.2/bin/g++ -std=c++11 -O2 -I../common -I../epollclient main.cpp ../epollclient/epoll_client.cpp ../common/event_loop.cpp ../common/logger.cpp ../common/metrics.cpp ../common/worker_pool.cpp -o main -lpthread
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace erpc {
+
+static const uint32_t kHistogramSubBuckets = 64;  // linear sub buckets per power of 2(about 1.5% precision)
+static const uint32_t kHistogramBuckets = kHistogramSubBuckets + 58 * (kHistogramSubBuckets / 2); // covers all uint64_t
+
+// log-linear histogram of latencies in nanoseconds, in the spirit of HdrHistogram: values below
+// kHistogramSubBuckets are counted exactly, larger ones keep their top 6 significant bits. recording is
+// one index computation and an increment, so each thread records into its own histogram and they are
+// merged for the report
+class LatencyHistogram {
+public:
+    LatencyHistogram()
+        : _counts(kHistogramBuckets, 0) {}
+
+public:
+    void Record(uint64_t value) {
+        ++_counts[Index(value)];
+        ++_total;
+        _sum += value;
+        if (value < _min) {
+            _min = value;
+        }
+        if (value > _max) {
+            _max = value;
+        }
+    }
+
+    // add all values of other into this one
+    void Merge(const LatencyHistogram& other) {
+        for (uint32_t i = 0; i < kHistogramBuckets; ++i) {
+            _counts[i] += other._counts[i];
+        }
+        _total += other._total;
+        _sum += other._sum;
+        if (other._min < _min) {
+            _min = other._min;
+        }
+        if (other._max > _max) {
+            _max = other._max;
+        }
+    }
+
+    // smallest value which percentile(0-100) of recorded values are not above, 0 if empty
+    uint64_t Percentile(double percentile) const {
+        if (_total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * _total + 0.5);
+        if (rank == 0) {
+            rank = 1;
+        }
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < kHistogramBuckets; ++i) {
+            seen += _counts[i];
+            if (seen >= rank) {
+                // never report more than what was really seen
+                uint64_t value = HighestEquivalent(i);
+                return value < _max ? value : _max;
+            }
+        }
+        return _max;
+    }
+
+    uint64_t Count() const {
+        return _total;
+    }
+
+    uint64_t Min() const {
+        return _total == 0 ? 0 : _min;
+    }
+
+    uint64_t Max() const {
+        return _max;
+    }
+
+    double Mean() const {
+        return _total == 0 ? 0 : static_cast<double>(_sum) / _total;
+    }
+
+private:
+    static uint32_t Index(uint64_t value) {
+        if (value < kHistogramSubBuckets) {
+            return static_cast<uint32_t>(value);
+        }
+        // value >= 64: keep the 6 bits from the most significant one
+        uint32_t msb = 63 - __builtin_clzll(value);
+        uint32_t shift = msb - 5;
+        uint32_t sub = static_cast<uint32_t>(value >> shift) - kHistogramSubBuckets / 2;
+        return kHistogramSubBuckets + (shift - 1) * (kHistogramSubBuckets / 2) + sub;
+    }
+
+    // largest value counted in bucket index
+    static uint64_t HighestEquivalent(uint32_t index) {
+        if (index < kHistogramSubBuckets) {
+            return index;
+        }
+        uint32_t shift = (index - kHistogramSubBuckets) / (kHistogramSubBuckets / 2) + 1;
+        uint64_t sub = (index - kHistogramSubBuckets) % (kHistogramSubBuckets / 2) + kHistogramSubBuckets / 2;
+        return ((sub + 1) << shift) - 1;
+    }
+
+private:
+    std::vector<uint64_t> _counts; // number of values per bucket
+    uint64_t _total { 0 }; // number of values
+    uint64_t _sum { 0 };   // sum of values, for mean
+    uint64_t _min { std::numeric_limits<uint64_t>::max() };
+    uint64_t _max { 0 };
+};
+
+} // namespace erpc
@@ -0,0 +1,293 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "epoll_client.h"
+#include "latency_histogram.h"
+
+using namespace erpc;
+
+static const uint32_t kMsgHeaderSize = 16;     // send time(8 bytes) + sequence(8 bytes) at the front of every message
+static const uint64_t kSpinThresholdNs = 200000; // open loop sleeps when the next send is further than this, spins otherwise
+
+// command line options
+typedef struct BenchOptions {
+    std::string host { "127.0.0.1" };
+    uint16_t port { 6666 };
+    uint32_t connections { 1 };   // number of tcp connections
+    uint32_t loops { 0 };         // client loops(threads) the connections share, 0 means one per connection
+    uint32_t depth { 1 };         // closed loop: messages in flight per connection
+    uint32_t min_size { 64 };     // message size range(bytes), uniformly distributed
+    uint32_t max_size { 64 };
+    bool open_loop { false };     // send at a fixed rate instead of waiting for responses
+    uint64_t rate { 10000 };      // open loop: messages per second of all connections
+    uint32_t duration { 10 };     // measured seconds
+    uint32_t warmup { 2 };        // seconds before measuring
+    std::string codec { "varint" }; // message framing, must be the same as server
+    uint32_t busy_poll_us { 0 };  // busy poll window of the client loops, 0 means off
+} BenchOptions;
+
+// state of one connection, only touched by the loop thread of its client(and the pacing thread in open loop)
+typedef struct BenchConnection {
+    std::shared_ptr<EpollTcpClient> client { nullptr };
+    LatencyHistogram histogram; // latencies recorded in the measured window
+    uint64_t recv_msgs { 0 };   // messages echoed back in the measured window
+    uint64_t recv_bytes { 0 };
+    std::atomic<uint64_t> sent { 0 };     // messages sent
+    std::atomic<uint64_t> received { 0 }; // messages echoed back
+    std::mt19937 rng;           // message sizes of closed loop
+} BenchConnection;
+
+typedef std::shared_ptr<BenchConnection> BenchConnectionPtr;
+
+static std::atomic<bool> g_running { true };    // keep sending
+static std::atomic<bool> g_recording { false }; // inside the measured window
+static std::string g_payload;                   // random bytes messages are cut from
+
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -h host      server ip(default 127.0.0.1)\n"
+            "  -p port      server port(default 6666)\n"
+            "  -c conns     number of connections(default 1)\n"
+            "  -l loops     client loops shared by the connections(default 0, one per connection)\n"
+            "  -d depth     closed loop: messages in flight per connection(default 1)\n"
+            "  -s size      min message size in bytes(default 64, at least %u)\n"
+            "  -S size      max message size in bytes(default the min size)\n"
+            "  -m mode      closed or open(default closed)\n"
+            "  -r rate      open loop: messages per second of all connections(default 10000)\n"
+            "  -t seconds   measured duration(default 10)\n"
+            "  -w seconds   warmup before measuring(default 2)\n"
+            "  -k codec     fixed32 or varint, must be the same as server(default varint)\n"
+            "  -b usec      busy poll the client loops for usec after events(needs -l, default 0: off)\n",
+            name, kMsgHeaderSize);
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchOptions* opts) {
+    bool max_given = false;
+    int c;
+    while ((c = getopt(argc, argv, "h:p:c:l:d:s:S:m:r:t:w:k:b:")) != -1) {
+        switch (c) {
+        case 'h': opts->host = optarg; break;
+        case 'p': opts->port = std::atoi(optarg); break;
+        case 'c': opts->connections = std::atoi(optarg); break;
+        case 'l': opts->loops = std::atoi(optarg); break;
+        case 'd': opts->depth = std::atoi(optarg); break;
+        case 's': opts->min_size = std::atoi(optarg); break;
+        case 'S': opts->max_size = std::atoi(optarg); max_given = true; break;
+        case 'm': opts->open_loop = (std::string(optarg) == "open"); break;
+        case 'r': opts->rate = std::strtoull(optarg, nullptr, 10); break;
+        case 't': opts->duration = std::atoi(optarg); break;
+        case 'w': opts->warmup = std::atoi(optarg); break;
+        case 'k': opts->codec = optarg; break;
+        case 'b': opts->busy_poll_us = std::atoi(optarg); break;
+        default: return false;
+        }
+    }
+    if (!max_given) {
+        opts->max_size = opts->min_size;
+    }
+    if (opts->min_size < kMsgHeaderSize || opts->max_size < opts->min_size || opts->max_size > kMaxFrameSize) {
+        fprintf(stderr, "bad message size range [%u, %u]\n", opts->min_size, opts->max_size);
+        return false;
+    }
+    if (opts->connections == 0 || opts->depth == 0 || opts->rate == 0 || opts->duration == 0) {
+        fprintf(stderr, "connections, depth, rate and duration must be positive\n");
+        return false;
+    }
+    if (FrameCodecTypeFromString(opts->codec) == FrameCodecType::kRaw) {
+        // without framing the echoes may merge or split, so they can not be matched with their sends
+        fprintf(stderr, "benchmark needs a length prefix codec(fixed32 or varint)\n");
+        return false;
+    }
+    return true;
+}
+
+// send one message of random size, stamped with time(the intended send time in open loop)
+static void SendMessage(const BenchOptions& opts, BenchConnection* conn, std::mt19937& rng, uint64_t stamp) {
+    uint32_t size = opts.min_size;
+    if (opts.max_size > opts.min_size) {
+        size = std::uniform_int_distribution<uint32_t>(opts.min_size, opts.max_size)(rng);
+    }
+    uint64_t seq = conn->sent.fetch_add(1, std::memory_order_relaxed);
+    Packet packet(std::string(g_payload.data(), size));
+    memcpy(&packet.msg[0], &stamp, sizeof(stamp));
+    memcpy(&packet.msg[8], &seq, sizeof(seq));
+    conn->client->SendData(packet);
+}
+
+// echo received: record latency from the stamp, in closed loop send the next one
+static void OnEcho(const BenchOptions& opts, BenchConnection* conn, const Packet& data) {
+    uint64_t now = NowNs();
+    if (data.size() < kMsgHeaderSize) {
+        ERPC_LOG_WARN("bad echo of size %zu", data.size());
+        return;
+    }
+    uint64_t stamp = 0;
+    memcpy(&stamp, data.data(), sizeof(stamp));
+    conn->received.fetch_add(1, std::memory_order_relaxed);
+    if (g_recording.load(std::memory_order_relaxed)) {
+        conn->histogram.Record(now > stamp ? now - stamp : 0);
+        ++conn->recv_msgs;
+        conn->recv_bytes += data.size();
+    }
+    if (!opts.open_loop && g_running.load(std::memory_order_relaxed)) {
+        SendMessage(opts, conn, conn->rng, NowNs());
+    }
+}
+
+// open loop: one thread sends to all connections round robin at a fixed rate. every message carries the
+// time it should have been sent, so a stalled server is charged for the whole delay instead of hiding
+// it by slowing down the sender(coordinated omission)
+static void PacingLoop(const BenchOptions& opts, const std::vector<BenchConnectionPtr>& conns) {
+    std::mt19937 rng(12345);
+    const double interval = 1e9 / opts.rate;
+    const uint64_t start = NowNs();
+    uint64_t sent = 0;
+    while (g_running.load(std::memory_order_relaxed)) {
+        uint64_t intended = start + static_cast<uint64_t>(sent * interval);
+        uint64_t now = NowNs();
+        if (now < intended) {
+            if (intended - now > kSpinThresholdNs) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(intended - now - kSpinThresholdNs / 2));
+            }
+            continue;
+        }
+        // behind schedule: send right away, still stamped with the intended time
+        SendMessage(opts, conns[sent % conns.size()].get(), rng, intended);
+        ++sent;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions opts;
+    if (!ParseOptions(argc, argv, &opts)) {
+        Usage(argv[0]);
+        exit(1);
+    }
+
+    std::mt19937 rng(42);
+    g_payload.resize(opts.max_size);
+    for (auto& c : g_payload) {
+        c = static_cast<char>(rng());
+    }
+
+    std::vector<EventLoopPtr> loops;
+    for (uint32_t i = 0; i < opts.loops; ++i) {
+        loops.push_back(std::make_shared<EventLoop>(i));
+        loops.back()->SetBusyPoll(opts.busy_poll_us);
+        if (!loops.back()->Start()) {
+            ERPC_LOG_ERROR("loop %u start failed!", i);
+            exit(1);
+        }
+    }
+
+    std::vector<BenchConnectionPtr> conns;
+    for (uint32_t i = 0; i < opts.connections; ++i) {
+        auto conn = std::make_shared<BenchConnection>();
+        conn->rng.seed(i);
+        // round robin over the shared loops
+        conn->client = std::make_shared<EpollTcpClient>(opts.host, opts.port, loops.empty() ? nullptr : loops[i % loops.size()]);
+        conn->client->SetFrameCodec(FrameCodecTypeFromString(opts.codec));
+        BenchConnection* raw = conn.get();
+        conn->client->RegisterOnRecvCallback([&opts, raw](const Packet& data) { OnEcho(opts, raw, data); });
+        if (!conn->client->Start()) {
+            ERPC_LOG_ERROR("connection %u to %s:%u failed!", i, opts.host.c_str(), opts.port);
+            exit(1);
+        }
+        conns.push_back(conn);
+    }
+    printf("%s loop, %u connections, %s, message size [%u, %u], warmup %us, duration %us\n",
+           opts.open_loop ? "open" : "closed", opts.connections,
+           opts.open_loop ? (std::to_string(opts.rate) + " msgs/s").c_str()
+                          : (std::string("depth ") + std::to_string(opts.depth)).c_str(),
+           opts.min_size, opts.max_size, opts.warmup, opts.duration);
+
+    std::thread pacer;
+    if (opts.open_loop) {
+        pacer = std::thread(PacingLoop, std::cref(opts), std::cref(conns));
+    } else {
+        for (auto& conn : conns) {
+            for (uint32_t i = 0; i < opts.depth; ++i) {
+                SendMessage(opts, conn.get(), conn->rng, NowNs());
+            }
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(opts.warmup));
+    g_recording = true;
+    uint64_t begin = NowNs();
+    std::this_thread::sleep_for(std::chrono::seconds(opts.duration));
+    g_recording = false;
+    uint64_t end = NowNs();
+    g_running = false;
+    if (pacer.joinable()) {
+        pacer.join();
+    }
+    // let the loop threads leave their callbacks before reading their histograms
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    LatencyHistogram total;
+    MetricsSnapshot client_metrics;
+    uint64_t msgs = 0;
+    uint64_t bytes = 0;
+    uint64_t outstanding = 0;
+    for (auto& conn : conns) {
+        conn->client->Stop();
+        client_metrics.push_back(conn->client->Metrics()[0]);
+        total.Merge(conn->histogram);
+        msgs += conn->recv_msgs;
+        bytes += conn->recv_bytes;
+        outstanding += conn->sent.load() - conn->received.load();
+    }
+
+    double seconds = (end - begin) / 1e9;
+    printf("throughput: %.0f msgs/s, %.2f MB/s\n", msgs / seconds, bytes / seconds / (1024 * 1024));
+    printf("latency(us): min %.1f, mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p999 %.1f, max %.1f\n",
+           total.Min() / 1e3, total.Mean() / 1e3, total.Percentile(50) / 1e3, total.Percentile(90) / 1e3,
+           total.Percentile(99) / 1e3, total.Percentile(99.9) / 1e3, total.Max() / 1e3);
+    // how busy the client loops were, to tell a saturated client from a slow server
+    MetricValues sum = SumMetrics(client_metrics);
+    if (!loops.empty()) {
+        // every connection reported the loop wide counters of its loop, count each loop once
+        MetricsSnapshot loop_metrics;
+        for (auto& loop : loops) {
+            MetricValues values = MetricValues();
+            loop->MergeMetrics(&values);
+            loop_metrics.push_back(values);
+            loop->Stop();
+        }
+        MetricValues loop_sum = SumMetrics(loop_metrics);
+        sum[kMetricLoopWaits] = loop_sum[kMetricLoopWaits];
+        sum[kMetricLoopEvents] = loop_sum[kMetricLoopEvents];
+        sum[kMetricEmptyWakeups] = loop_sum[kMetricEmptyWakeups];
+        sum[kMetricSpinPolls] = loop_sum[kMetricSpinPolls];
+        sum[kMetricSpinHits] = loop_sum[kMetricSpinHits];
+    }
+    printf("client loops: %.2f events/wakeup, %lu empty wakeups, %lu write EAGAIN, %.1f us/callback\n",
+           sum[kMetricLoopWaits] ? static_cast<double>(sum[kMetricLoopEvents]) / sum[kMetricLoopWaits] : 0,
+           static_cast<unsigned long>(sum[kMetricEmptyWakeups]), static_cast<unsigned long>(sum[kMetricWriteEagain]),
+           sum[kMetricCallbacks] ? sum[kMetricCallbackNs] / 1e3 / sum[kMetricCallbacks] : 0);
+    if (sum[kMetricSpinPolls] > 0) {
+        printf("busy poll: %lu spins, %.2f%% hit, %lu sleeping waits\n", static_cast<unsigned long>(sum[kMetricSpinPolls]),
+               100.0 * sum[kMetricSpinHits] / sum[kMetricSpinPolls], static_cast<unsigned long>(sum[kMetricLoopWaits]));
+    }
+    if (outstanding > 0) {
+        printf("messages without echo at exit: %lu\n", static_cast<unsigned long>(outstanding));
+    }
+    return 0;
+}
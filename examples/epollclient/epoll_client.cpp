@@ -2,9 +2,17 @@
 
 namespace erpc {
 
-EpollTcpClient::EpollTcpClient(const std::string& server_ip, uint16_t server_port)
+EpollTcpClient::EpollTcpClient(const std::string& server_ip, uint16_t server_port, const EventLoopPtr& loop)
     : _server_ip { server_ip },
-      _server_port { server_port } {
+      _server_port { server_port },
+      _transport { ParseTransport(server_ip, &_unix_path) },
+      _loop { loop },
+      _random { static_cast<uint32_t>(TimerWheel::NowMs() ^ reinterpret_cast<uintptr_t>(this)) } {
+    if (!_loop) {
+        _loop = std::make_shared<EventLoop>();
+        _own_loop = true;
+    }
+    _timers.Attach(_loop.get());
 }
 
 EpollTcpClient::~EpollTcpClient() {
@@ -12,80 +20,113 @@ EpollTcpClient::~EpollTcpClient() {
 }
 
 bool EpollTcpClient::Start() {
-    // create epoll instance
-    if (CreateEpoll() < 0) {
-        return false;
-    }
-    // create socket and bind
-    int cli_fd  = CreateSocket();
-    if (cli_fd < 0) {
-        return false;
-    }
-
-    // connect to server
-    int lr = Connect(cli_fd);
-    if (lr < 0) {
+    // create epoll instance, if the loop is not running yet
+    if (!_loop->Init()) {
         return false;
     }
-    std::cout << "EpollTcpClient Init success!" << std::endl;
-    _client_fd = cli_fd;
+    ERPC_LOG_INFO("EpollTcpClient Init success!");
 
-    // after connected successfully, add this socket to epoll instance, and focus on EPOLLIN and EPOLLOUT event
-    int er = UpdateEpollEvents(_epoll_fd, EPOLL_CTL_ADD, _client_fd, EPOLLIN | EPOLLET);
-    if (er < 0) {
-        // if something goes wrong, close listen socket and return false
-        ::close(_client_fd);
-        return false;
-    }
+    assert(!_started);
+    _started = true;
 
-    assert(!_thread_loop);
+    // connect in the background: the socket is added to epoll and connect() completes with EPOLLOUT,
+    // packets sent meanwhile are queued. on a shared loop this runs on its thread
+    _loop->RunSync([this] {
+        for (auto& timer : _pending_timers) {
+            _timers.Add(timer.delay_ms, timer.callback, timer.interval_ms);
+        }
+        _pending_timers.clear();
+        StartConnect();
+    });
 
-    // the implementation of one loop per thread: create a thread to loop epoll
-    _thread_loop = std::make_shared<std::thread>(&EpollTcpClient::EpollLoop, this);
-    if (!_thread_loop) {
+    // a loop of its own runs on a thread of its own
+    if (_own_loop && !_loop->Start()) {
         return false;
     }
-    // detach the thread(using loop_flag_ to control the start/stop of loop)
-    _thread_loop->detach();
-
     return true;
 }
-
 // stop epoll tcp client and release epoll
 bool EpollTcpClient::Stop() {
-    _loop_flag = false;
-    ::close(_client_fd);
-    ::close(_epoll_fd);
-    std::cout << "stop epoll!" << std::endl;
-    UnRegisterOnRecvCallback();
+    if (_stopped.exchange(true)) {
+        // stopped already
+        return true;
+    }
+    if (_own_loop) {
+        // then released on this thread
+        _loop->Stop();
+    }
+    // the close callback runs on the loop too, as it does for a lost connection: what it touches is the loop's
+    _loop->RunSync([this] {
+        Release();
+        if (_close_callback) {
+            _close_callback();
+        }
+    });
+    // the pool outlives the client: no recv callback runs on it from now on
+    _worker_tasks.Close();
+    ERPC_LOG_INFO("stop epoll!");
+    if (_recv_callback || _recv_view_callback) {
+        UnRegisterOnRecvCallback();
+    }
     return true;
 }
-
-int32_t EpollTcpClient::CreateEpoll() {
-    // the basic epoll api of create a epoll instance
-    int epollfd = epoll_create(1);
-    if (epollfd < 0) {
-        // if something goes wrong, return -1
-        std::cout << "epoll_create failed!" << std::endl;
-        return -1;
+void EpollTcpClient::Release() {
+    {
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        if (_client_fd >= 0) {
+            _loop->Remove(_client_fd);
+            ::close(_client_fd);
+            _client_fd = -1;
+            _conn_id = kInvalidConnectionId;
+        }
+        if (_shm) {
+            _loop->Remove(_shm->WakeFd());
+            _shm.reset();
+        }
+        _state = ConnectState::kStopped;
+        _metrics.Sub(kMetricOutputBytes, _output.Size());
+        _output.Consume(_output.Size());
     }
-    _epoll_fd = epollfd;
-    return epollfd;
+    // the loop may go on without this client
+    _timers.CancelAll();
+    _connect_timer = kInvalidTimerId;
+    _reconnect_timer = kInvalidTimerId;
+    _idle_timer = kInvalidTimerId;
+    _alive.reset();
 }
 
 int32_t EpollTcpClient::CreateSocket() {
-    // create tcp socket
-    int cli_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    // create tcp socket, or a unix domain socket for a local transport
+    int cli_fd = ::socket(_transport == Transport::kTcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (cli_fd < 0) {
-        std::cout << "create socket failed!" << std::endl;
+        ERPC_LOG_ERROR("create socket failed! errno=%d", errno);
+        return -1;
+    }
+    // before connect(), which then returns at once
+    if (MakeSocketNonBlocking(cli_fd) < 0) {
+        ::close(cli_fd);
         return -1;
     }
 
     return cli_fd;
 }
-
 // connect to tcp server
 int32_t EpollTcpClient::Connect(int32_t cli_fd) {
+    if (_transport != Transport::kTcp) {
+        struct sockaddr_un local;
+        socklen_t len = MakeUnixAddress(_unix_path, &local);
+        if (len == 0) {
+            ERPC_LOG_ERROR("bad unix socket path %s!", _server_ip.c_str());
+            return -1;
+        }
+        // connects at once or fails, EAGAIN means the listen queue is full: try again later
+        if (::connect(cli_fd, (struct sockaddr*)&local, len) == 0) {
+            return 0;
+        }
+        ERPC_LOG_WARN("connect %s failed! errno:%d", _server_ip.c_str(), errno);
+        return -1;
+    }
+
     struct sockaddr_in addr;  // server info
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
@@ -93,126 +134,590 @@ int32_t EpollTcpClient::Connect(int32_t cli_fd) {
     addr.sin_addr.s_addr  = inet_addr(_server_ip.c_str());
 
     int r = ::connect(cli_fd, (struct sockaddr*)&addr, sizeof(addr));
-    if ( r < 0) {
-        std::cout << "connect failed! r=" << r << " errno:" << errno << std::endl;
+    if (r == 0) {
+        return 0;
+    }
+    if (errno == EINPROGRESS) {
+        return 1;
+    }
+    ERPC_LOG_WARN("connect %s:%u failed! errno:%d", _server_ip.c_str(), _server_port, errno);
+    return -1;
+}
+
+void EpollTcpClient::StartConnect() {
+    int32_t fd = CreateSocket();
+    if (fd < 0) {
+        ScheduleReconnect();
+        return;
+    }
+    int32_t r = Connect(fd);
+    if (r < 0) {
+        ::close(fd);
+        ScheduleReconnect();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        _client_fd = fd;
+        _conn_id = NewConnectionId(fd);
+        _state = ConnectState::kConnecting;
+    }
+    // EPOLLOUT reports the end of connect(), success or not
+    if (_loop->Add(_conn_id, EPOLLIN | EPOLLOUT | EPOLLET, this) < 0) {
+        CloseConnection(true);
+        return;
+    }
+    if (r == 0) {
+        OnConnected();
+    }
+    if (_state != ConnectState::kConnecting) {
+        // connected, or failed already
+        return;
+    }
+    _connect_timer = _timers.Add(_connect_timeout_ms, [this] {
+        _connect_timer = kInvalidTimerId;
+        if (_state == ConnectState::kConnecting) {
+            ERPC_LOG_WARN("connect %s:%u timeout after %u ms!", _server_ip.c_str(), _server_port, _connect_timeout_ms);
+            CloseConnection(true);
+        }
+    });
+}
+
+void EpollTcpClient::OnConnect(int32_t fd) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        ERPC_LOG_WARN("connect %s:%u failed! errno:%d", _server_ip.c_str(), _server_port, err);
+        CloseConnection(true);
+        return;
+    }
+    OnConnected();
+}
+
+void EpollTcpClient::OnConnected() {
+    if (_transport == Transport::kShm && !_shm) {
+        // connected only once the server took the rings, the connect timer still runs
+        if (StartShmHandshake() < 0) {
+            CloseConnection(true);
+        }
+        return;
+    }
+    if (_connect_timer != kInvalidTimerId) {
+        _timers.Cancel(_connect_timer);
+        _connect_timer = kInvalidTimerId;
+    }
+    _reconnect_failures = 0;
+    bool flush = false;
+    {
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        _state = ConnectState::kConnected;
+        // write what was queued while connecting when EPOLLOUT comes
+        _writing = !_output.Empty();
+        // over shm the socket only tells the hangup, and nothing tells the rings are empty: write now
+        _loop->Modify(_conn_id, _writing && !_shm ? EPOLLIN | EPOLLOUT | EPOLLET : EPOLLIN | EPOLLET);
+        flush = _writing && _shm;
+    }
+    if (flush) {
+        OnSocketWrite(_client_fd);
+    }
+    ERPC_LOG_INFO("fd: %d connected to %s:%u", _client_fd, _server_ip.c_str(), _server_port);
+    if (_idle_timeout_ms > 0 && _idle_timer == kInvalidTimerId) {
+        _last_active_ms = _loop->NowMs();
+        _idle_timer = _timers.Add(_idle_timeout_ms, [this] { OnIdleTimer(); });
+    }
+    if (_connect_callback) {
+        _connect_callback();
+    }
+}
+
+int32_t EpollTcpClient::StartShmHandshake() {
+    ShmChannelPtr shm = ShmChannel::Connect(_client_fd, _shm_ring_size);
+    if (!shm) {
         return -1;
     }
+    shm->SetWakeCallback([this] { OnShmWake(); });
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    // not connected yet, so SendData() still queues instead of writing to it
+    _shm = shm;
     return 0;
 }
 
-// add/modify/remove a item(socket/fd) in epoll instance(rbtree), for this example, just add a socket to epoll rbtree
-int32_t EpollTcpClient::UpdateEpollEvents(int efd, int op, int fd, int events) {
-    struct epoll_event ev;
-    memset(&ev, 0, sizeof(ev));
-    ev.events = events;
-    ev.data.fd = fd;
-    fprintf(stdout,"%s fd %d events read %d write %d\n", op == EPOLL_CTL_MOD ? "mod" : "add", fd, ev.events & EPOLLIN, ev.events & EPOLLOUT);
-    int r = epoll_ctl(efd, op, fd, &ev);
-    if (r < 0) {
-        std::cout << "epoll_ctl failed!" << std::endl;
+void EpollTcpClient::OnShmAnswer(int32_t fd) {
+    int32_t ret = _shm->Finish(fd);
+    if (ret == 0) {
+        return;
+    }
+    if (ret < 0 || _loop->Add(NewConnectionId(_shm->WakeFd()), EPOLLIN | EPOLLET, _shm.get()) < 0) {
+        CloseConnection(true);
+        return;
+    }
+    OnConnected();
+}
+
+void EpollTcpClient::OnShmWake() {
+    // one eventfd for both directions: read what came, and write on what waits for room
+    OnSocketRead(_client_fd);
+    if (_shm) {
+        OnSocketWrite(_client_fd);
+    }
+}
+
+void EpollTcpClient::ScheduleReconnect() {
+    if (_state == ConnectState::kStopped || _reconnect_min_ms == 0) {
+        return;
+    }
+    // exponential backoff with jitter, so that clients cut off together do not come back together
+    uint64_t delay = std::min<uint64_t>(_reconnect_max_ms,
+                                        static_cast<uint64_t>(_reconnect_min_ms) << std::min<uint32_t>(_reconnect_failures, 20));
+    delay = delay / 2 + _random() % (delay / 2 + 1);
+    ++_reconnect_failures;
+    ERPC_LOG_INFO("reconnect %s:%u in %lu ms", _server_ip.c_str(), _server_port, static_cast<unsigned long>(delay));
+    _reconnect_timer = _timers.Add(delay, [this] {
+        _reconnect_timer = kInvalidTimerId;
+        StartConnect();
+    });
+}
+void EpollTcpClient::ConnectIfWanted() {
+    if (_want_connect.exchange(false) && _state == ConnectState::kDisconnected
+        && _reconnect_timer == kInvalidTimerId && _reconnect_min_ms > 0) {
+        StartConnect();
+    }
+}
+// set noblock fd
+int32_t EpollTcpClient::MakeSocketNonBlocking(int32_t fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        ERPC_LOG_ERROR("fcntl failed! fd=%d", fd);
+        return -1;
+    }
+
+    int ret = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    if (ret < 0) {
+        ERPC_LOG_ERROR("fcntl failed! fd=%d ret=%d", fd, ret);
         return -1;
     }
+
     return 0;
 }
 
 // register a callback when packet received
 void EpollTcpClient::RegisterOnRecvCallback(callback_recv_t callback) {
-    assert(!_recv_callback);
+    assert(!_recv_callback && !_recv_view_callback);
     _recv_callback = callback;
 }
 
+void EpollTcpClient::RegisterOnRecvCallback(callback_recv_view_t callback) {
+    assert(!_recv_callback && !_recv_view_callback);
+    _recv_view_callback = callback;
+}
+
 void EpollTcpClient::UnRegisterOnRecvCallback() {
-    assert(_recv_callback);
+    assert(_recv_callback || _recv_view_callback);
     _recv_callback = nullptr;
+    _recv_view_callback = nullptr;
+}
+
+void EpollTcpClient::RegisterOnCloseCallback(callback_close_t callback) {
+    assert(!_started);
+    _close_callback = callback;
+}
+
+void EpollTcpClient::RegisterOnConnectCallback(callback_connect_t callback) {
+    assert(!_started);
+    _connect_callback = callback;
 }
 
+void EpollTcpClient::SetConnectTimeout(uint32_t timeout_ms) {
+    assert(!_started);
+    _connect_timeout_ms = timeout_ms;
+}
+
+void EpollTcpClient::SetReconnectBackoff(uint32_t min_ms, uint32_t max_ms) {
+    assert(!_started);
+    _reconnect_min_ms = min_ms;
+    _reconnect_max_ms = std::max(min_ms, max_ms);
+}
+
+void EpollTcpClient::SetMaxQueuedBytes(size_t max_bytes) {
+    assert(!_started);
+    _max_queued_bytes = max_bytes;
+}
+
+void EpollTcpClient::SetShmRingSize(uint32_t bytes) {
+    assert(!_started);
+    _shm_ring_size = bytes;
+}
+
+void EpollTcpClient::CloseConnection(bool reconnect) {
+    bool was_connected = false;
+    {
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        if (_client_fd < 0) {
+            return;
+        }
+        was_connected = _state == ConnectState::kConnected;
+        // closing removes it from epoll
+        _loop->Remove(_client_fd);
+        ::close(_client_fd);
+        _client_fd = -1;
+        _conn_id = kInvalidConnectionId;
+        if (_shm) {
+            _loop->Remove(_shm->WakeFd());
+            _shm.reset();
+        }
+        _state = ConnectState::kDisconnected;
+        _writing = false;
+        if (was_connected) {
+            // the lost connection may have stopped in the middle of a frame, a new one starts clean.
+            // bytes queued while connecting are kept for the next attempt
+            _metrics.Sub(kMetricOutputBytes, _output.Size());
+            _output.Consume(_output.Size());
+        }
+    }
+    _input.Retrieve(_input.Readable());
+    if (_connect_timer != kInvalidTimerId) {
+        _timers.Cancel(_connect_timer);
+        _connect_timer = kInvalidTimerId;
+    }
+    if (was_connected && _close_callback) {
+        _close_callback();
+    }
+    if (reconnect) {
+        ScheduleReconnect();
+    }
+}
+void EpollTcpClient::SetFrameCodec(FrameCodecType type) {
+    assert(!_started);
+    _codec = FrameCodec(type);
+}
+
+MetricsSnapshot EpollTcpClient::Metrics() const {
+    MetricValues values = _metrics.Snapshot();
+    _loop->MergeMetrics(&values);
+    return MetricsSnapshot(1, values);
+}
+
+bool EpollTcpClient::InLoopThread() const {
+    return _loop->InLoopThread();
+}
+
+TimerId EpollTcpClient::RunAfter(uint32_t delay_ms, callback_timer_t callback) {
+    return AddTimer(delay_ms, 0, std::move(callback));
+}
+
+TimerId EpollTcpClient::RunEvery(uint32_t interval_ms, callback_timer_t callback) {
+    return AddTimer(interval_ms, interval_ms, std::move(callback));
+}
+
+TimerId EpollTcpClient::AddTimer(uint32_t delay_ms, uint32_t interval_ms, callback_timer_t callback) {
+    if (_started && InLoopThread()) {
+        return _timers.Add(delay_ms, std::move(callback), interval_ms);
+    }
+    if (!_started) {
+        // added on the loop by Start()
+        PendingTimer timer;
+        timer.delay_ms = delay_ms;
+        timer.interval_ms = interval_ms;
+        timer.callback = std::move(callback);
+        _pending_timers.push_back(std::move(timer));
+        return kInvalidTimerId;
+    }
+    ERPC_LOG_ERROR("timer must be added in loop thread or before Start()!");
+    return kInvalidTimerId;
+}
+
+bool EpollTcpClient::CancelTimer(TimerId id) {
+    if (!InLoopThread()) {
+        ERPC_LOG_ERROR("timer must be cancelled in loop thread!");
+        return false;
+    }
+    return _timers.Cancel(id);
+}
+
+void EpollTcpClient::SetIdleTimeout(uint32_t idle_ms) {
+    assert(!_started);
+    _idle_timeout_ms = idle_ms;
+}
+
+void EpollTcpClient::SetWorkerPool(const WorkerPoolPtr& workers) {
+    assert(!_started);
+    _workers = workers;
+}
+
+bool EpollTcpClient::SetRpcService(const RpcServicePtr& /*service*/) {
+    ERPC_LOG_ERROR("EpollTcpClient does not serve rpc!");
+    return false;
+}
+
+void EpollTcpClient::OnIdleTimer() {
+    _idle_timer = kInvalidTimerId;
+    if (_state != ConnectState::kConnected) {
+        // armed again when connected
+        return;
+    }
+    uint64_t now = _loop->NowMs();
+    uint64_t idle = now - std::min<uint64_t>(now, _last_active_ms.load(std::memory_order_relaxed));
+    if (idle >= _idle_timeout_ms) {
+        ERPC_LOG_INFO("fd: %d idle for %lu ms, close it!", _client_fd, static_cast<unsigned long>(idle));
+        // no reconnect until there is something to send
+        CloseConnection(false);
+        return;
+    }
+    _idle_timer = _timers.Add(_idle_timeout_ms - idle, [this] { OnIdleTimer(); });
+}
 // handle read events on fd
 void EpollTcpClient::OnSocketRead(int32_t fd) {
-    char read_buf[4096];
-    bzero(read_buf, sizeof(read_buf));
     int n = -1;
-    while ( (n = ::read(fd, read_buf, sizeof(read_buf))) > 0) {
-        // callback for recv
-        std::string msg(read_buf, n);
-        PacketPtr data = std::make_shared<Packet>(fd, msg);
-        if (_recv_callback) {
-            // handle recv packet
-            _recv_callback(data);
+    while (true) {
+        // read straight into the input buffer, after the bytes of a partial message
+        _input.EnsureWritable(kMaxBufferSize);
+        n = _shm ? _shm->Read(_input.WritePtr(), _input.Writable()) : ::read(fd, _input.WritePtr(), _input.Writable());
+        _metrics.Add(kMetricReadCalls);
+        if (n <= 0) {
+            break;
+        }
+        _input.HasWritten(n);
+        _metrics.Add(kMetricBytesRead, n);
+        if (_idle_timeout_ms > 0) {
+            _last_active_ms.store(_loop->NowMs(), std::memory_order_relaxed);
+        }
+        if (DispatchMessages(fd) < 0) {
+            ERPC_LOG_WARN("fd: %d bad frame, close it!", fd);
+            CloseConnection(true);
+            return;
         }
     }
     if (n == -1) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            // read finished
+            // read finished, give the receive block back while idle
+            _metrics.Add(kMetricReadEagain);
+            _input.Shrink();
             return;
         }
         // something goes wrong for this fd, should close it
-        ::close(fd);
+        CloseConnection(true);
         return;
     }
     if (n == 0) {
         // this may happen when client close socket. EPOLLRDHUP usually handle this, but just make sure; should close this fd
-        ::close(fd);
+        CloseConnection(true);
         return;
     }
 }
 
+int32_t EpollTcpClient::DispatchMessages(int32_t fd) {
+    uint32_t header_size = 0;
+    uint32_t body_size = 0;
+    int32_t ret = 0;
+    uint32_t count = 0;
+    uint64_t begin = MetricsNowNs();
+    while ((ret = _codec.Decode(_input.Peek(), _input.Readable(), &header_size, &body_size)) > 0) {
+        const char* body = _input.Peek() + header_size;
+        if (_workers) {
+            // SendData() is thread safe, so the callback just runs on a worker with the view keeping the block alive
+            Packet data(fd, _input.View(body, body_size));
+            _input.Retrieve(header_size + body_size);
+            _worker_tasks.Submit(_workers, [this, data] {
+                if (_recv_view_callback) {
+                    _recv_view_callback(data);
+                } else if (_recv_callback) {
+                    _recv_callback(std::make_shared<Packet>(data.fd, data.view.ToString()));
+                }
+            });
+        } else if (_recv_view_callback) {
+            // hand out the message in place, the view keeps the receive block alive
+            Packet data(fd, _input.View(body, body_size));
+            _input.Retrieve(header_size + body_size);
+            _recv_view_callback(data);
+        } else {
+            PacketPtr data = std::make_shared<Packet>(fd, std::string(body, body_size));
+            _input.Retrieve(header_size + body_size);
+            if (_recv_callback) {
+                // handle recv packet
+                _recv_callback(data);
+            }
+        }
+        ++count;
+    }
+    if (count > 0) {
+        _metrics.Add(kMetricCallbacks, count);
+        _metrics.Add(kMetricCallbackNs, MetricsNowNs() - begin);
+    }
+    return ret;
+}
+
 // handle write events on fd (usually happens when sending big files)
 void EpollTcpClient::OnSocketWrite(int32_t fd) {
-    std::cout << "fd: " << fd << " writeable!" << std::endl;
+    ERPC_LOG_DEBUG("fd: %d writeable!", fd);
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    struct iovec iov[kMaxIovecs];
+    while (!_output.Empty()) {
+        int32_t cnt = _output.PeekIovec(iov, kMaxIovecs);
+        ssize_t r = _shm ? _shm->Writev(iov, cnt) : ::writev(fd, iov, cnt);
+        _metrics.Add(kMetricWriteCalls);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // wait for next EPOLLOUT(or the wakeup of the shm channel)
+                _metrics.Add(kMetricWriteEagain);
+                return;
+            }
+            ERPC_LOG_WARN("fd: %d write error, close it! errno=%d", fd, errno);
+            // under send_mutex: shut down only, the loop closes on the hangup event
+            ::shutdown(fd, SHUT_RDWR);
+            return;
+        }
+        _output.Consume(r);
+        _metrics.Add(kMetricBytesWritten, r);
+        if (_idle_timeout_ms > 0) {
+            _last_active_ms.store(_loop->NowMs(), std::memory_order_relaxed);
+        }
+        _metrics.Sub(kMetricOutputBytes, r);
+    }
+    // all data sent, stop watching EPOLLOUT
+    if (_writing && !_shm) {
+        _loop->Modify(_conn_id, EPOLLIN | EPOLLET);
+    }
+    _writing = false;
 }
 
 int32_t EpollTcpClient::SendData(const PacketPtr& data) {
-    int r = ::write(_client_fd, data->msg.data(), data->msg.size());
-    if (r == -1) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    return SendData(*data);
+}
+
+int32_t EpollTcpClient::SendData(const Packet& data) {
+    if (!_codec.Fits(data.size())) {
+        // the server would take it for a bad frame and close the connection
+        ERPC_LOG_ERROR("message of %zu bytes is over the max frame size!", data.size());
+        return -1;
+    }
+    // header and body go out in one write
+    char header[kMaxFrameHeaderSize];
+    uint32_t header_size = _codec.EncodeHeader(data.size(), header);
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = header_size;
+    iov[1].iov_base = const_cast<char*>(data.data());
+    iov[1].iov_len = data.size();
+
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    ConnectState state = _state;
+    if (state == ConnectState::kStopped || (state == ConnectState::kDisconnected && _reconnect_min_ms == 0)) {
+        // closed for good
+        return -1;
+    }
+    if (state != ConnectState::kConnected) {
+        // keep it for when connected, within the budget
+        if (_output.Size() + header_size + data.size() > _max_queued_bytes) {
+            ERPC_LOG_DEBUG("not connected and %zu bytes queued already, drop packet!", _output.Size());
             return -1;
         }
-        // error happend
-        ::close(_client_fd);
-        std::cout << "fd: " << _client_fd << " write error, close it!" << std::endl;
-        return -1;
+        _output.Append(header, header_size);
+        _output.Append(data.data(), data.size());
+        _metrics.Add(kMetricOutputBytes, header_size + data.size());
+        if (state == ConnectState::kDisconnected && !_want_connect.exchange(true)) {
+            // e.g. closed for being idle: connect now, on the loop
+            std::weak_ptr<bool> alive = _alive;
+            _loop->Post([this, alive] {
+                if (alive.lock()) {
+                    ConnectIfWanted();
+                }
+            });
+        }
+        return data.size();
     }
-    return r;
-}
-
-// one loop per thread, call epoll_wait and handle all coming events
-void EpollTcpClient::EpollLoop() {
-    // request some memory, if events ready, socket events will copy to this memory from kernel
-    struct epoll_event* alive_events =  static_cast<epoll_event*>(calloc(kMaxEvents, sizeof(epoll_event)));
-    if (!alive_events) {
-        std::cout << "calloc memory failed for epoll_events!" << std::endl;
-        return;
-    }
-    while (_loop_flag) {
-        int num = epoll_wait(_epoll_fd, alive_events, kMaxEvents, kEpollWaitTime);
-
-        for (int i = 0; i < num; ++i) {
-            int fd = alive_events[i].data.fd;
-            int events = alive_events[i].events;
-
-            if ( (events & EPOLLERR) || (events & EPOLLHUP) ) {
-                std::cout << "epoll_wait error!" << std::endl;
-                // An error has occured on this fd, or the socket is not ready for reading (why were we notified then?).
-                ::close(fd);
-            } else  if (events & EPOLLRDHUP) {
-                // Stream socket peer closed connection, or shut down writing half of connection.
-                // more inportant, We still to handle disconnection when read()/recv() return 0 or -1 just to be sure.
-                std::cout << "fd:" << fd << " closed EPOLLRDHUP!" << std::endl;
-                // close fd and epoll will remove it
-                ::close(fd);
-            } else if ( events & EPOLLIN ) {
-                // other fd read event coming, meaning data coming
-                OnSocketRead(fd);
-            } else if ( events & EPOLLOUT ) {
-                // write event for fd (not including listen-fd), meaning send buffer is available for big files
-                OnSocketWrite(fd);
-            } else {
-                std::cout << "unknow epoll event!" << std::endl;
+
+    size_t written = 0;
+    if (_output.Empty()) {
+        // nothing queued before, try to write directly
+        ssize_t r = _shm ? _shm->Writev(iov, 2) : ::writev(_client_fd, iov, 2);
+        _metrics.Add(kMetricWriteCalls);
+        if (r == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                // error happend: shut down only, the loop closes on the hangup event(and calls back there)
+                ::shutdown(_client_fd, SHUT_RDWR);
+                ERPC_LOG_WARN("fd: %d write error, close it! errno=%d", _client_fd, errno);
+                return -1;
             }
-        } // end for (int i = 0; ...
+            _metrics.Add(kMetricWriteEagain);
+            r = 0;
+        }
+        written = r;
+        _metrics.Add(kMetricBytesWritten, written);
+        if (written > 0 && _idle_timeout_ms > 0) {
+            // may be another thread than the loop, read the clock
+            _last_active_ms.store(TimerWheel::NowMs(), std::memory_order_relaxed);
+        }
+    }
+    if (written == header_size + data.size()) {
+        return data.size();
+    }
+
+    // queue what is left, keep the frame whole
+    size_t queued = _output.Size();
+    if (written < header_size) {
+        _output.Append(header + written, header_size - written);
+        written = 0;
+    } else {
+        written -= header_size;
+    }
+    _output.Append(data.data() + written, data.size() - written);
+    _metrics.Add(kMetricOutputBytes, _output.Size() - queued);
+    if (!_writing) {
+        // a shm channel wakes the loop up when the server made room
+        _writing = true;
+        if (!_shm) {
+            _loop->Modify(_conn_id, EPOLLIN | EPOLLOUT | EPOLLET);
+        }
+    }
+    return data.size();
+}
 
-    } // end while (loop_flag_)
-    free(alive_events);
+void EpollTcpClient::OnEvents(int32_t fd, uint32_t events) {
+    if (fd != _client_fd) {
+        // socket closed earlier in this batch
+        return;
+    }
+    if (_state == ConnectState::kConnecting) {
+        if (_shm) {
+            // the hello went out, this is the answer(or the server closed)
+            OnShmAnswer(fd);
+            return;
+        }
+        // connect() finished, successfully or not
+        OnConnect(fd);
+        return;
+    }
+    if (_shm) {
+        // the server says nothing on the socket after the handshake, an event is its hangup
+        ERPC_LOG_DEBUG("fd: %d shm peer closed!", fd);
+        CloseConnection(true);
+        return;
+    }
+    if ( (events & EPOLLERR) || (events & EPOLLHUP) ) {
+        ERPC_LOG_DEBUG("fd: %d epoll_wait error!", fd);
+        // An error has occured on this fd, or the socket is not ready for reading (why were we notified then?).
+        CloseConnection(true);
+    } else  if (events & EPOLLRDHUP) {
+        // Stream socket peer closed connection, or shut down writing half of connection.
+        // more inportant, We still to handle disconnection when read()/recv() return 0 or -1 just to be sure.
+        ERPC_LOG_DEBUG("fd: %d closed EPOLLRDHUP!", fd);
+        // close fd and epoll will remove it
+        CloseConnection(true);
+    } else if (events & (EPOLLIN | EPOLLOUT)) {
+        if (events & EPOLLIN) {
+            // other fd read event coming, meaning data coming
+            OnSocketRead(fd);
+        }
+        if (events & EPOLLOUT) {
+            // write event for fd, meaning send buffer is available again
+            OnSocketWrite(fd);
+        }
+    } else {
+        ERPC_LOG_WARN("fd: %d unknow epoll event %d!", fd, events);
+    }
 }
 
 } // namespace erpc
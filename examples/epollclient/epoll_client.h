@@ -1,3 +1,5 @@
+#pragma once
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -7,6 +9,7 @@
 #include <stdlib.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <cassert>
 
@@ -15,58 +18,43 @@
 #include <thread>
 #include <memory>
 #include <functional>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "epoll_tcp_base.h"
+#include "event_loop.h"
+#include "frame_codec.h"
+#include "input_buffer.h"
+#include "logger.h"
+#include "output_buffer.h"
+#include "shm_channel.h"
+#include "unix_socket.h"
 
 namespace erpc {
 
-static const uint32_t kMaxBufferSize = 4096; // max buffer size
-static const uint32_t kMaxEpollSize = 100; // max epoll size
-static const uint32_t kEpollWaitTime = 10; // epoll wait timeout 10 ms
-static const uint32_t kMaxEvents = 100;    // epoll wait return max size
-
-// packet of send/recv binary content
-typedef struct Packet {
-public:
-    Packet()
-        : msg { "" } {}
-    Packet(const std::string& msg)
-        : msg { msg } {}
-    Packet(int fd, const std::string& msg)
-        : fd(fd),
-          msg(msg) {}
-
-    int fd { -1 };     // meaning socket
-    std::string msg;   // real binary content
-} Packet;
-
-typedef std::shared_ptr<Packet> PacketPtr;
-
-// callback when packet received
-using callback_recv_t = std::function<void(const PacketPtr& data)>;
-
-// base class of EpollTcpServer, focus on Start(), Stop(), SendData(), RegisterOnRecvCallback()...
-class EpollTcpBase {
-public:
-    EpollTcpBase()                                     = default;
-    EpollTcpBase(const EpollTcpBase& other)            = delete;
-    EpollTcpBase& operator=(const EpollTcpBase& other) = delete;
-    EpollTcpBase(EpollTcpBase&& other)                 = delete;
-    EpollTcpBase& operator=(EpollTcpBase&& other)      = delete;
-    virtual ~EpollTcpBase()                            = default;
-
-public:
-    virtual bool Start() = 0;
-    virtual bool Stop()  = 0;
-    virtual int32_t SendData(const PacketPtr& data) = 0;
-    virtual void RegisterOnRecvCallback(callback_recv_t callback) = 0;
-    virtual void UnRegisterOnRecvCallback() = 0;
+static const uint32_t kDefaultConnectTimeoutMs = 3000; // a connect attempt taking longer fails
+static const uint32_t kDefaultReconnectMinMs = 100;     // delay before the first reconnect, doubled per failure
+static const uint32_t kDefaultReconnectMaxMs = 10000;   // max delay between reconnects
+static const size_t kDefaultMaxQueuedBytes = 4 * 1024 * 1024; // bytes SendData() may queue while not connected
+
+// callback when an established connection of a client closed(by either side), and on Stop(). runs on the
+// loop thread(on the thread calling Stop() only once a loop of its own stopped)
+using callback_close_t = std::function<void()>;
+// callback when the client connected(again), runs on the loop thread
+using callback_connect_t = std::function<void()>;
+
+enum class ConnectState : uint8_t {
+    kDisconnected = 0, // no socket, a reconnect may be scheduled
+    kConnecting   = 1, // non blocking connect in progress, waiting for EPOLLOUT
+    kConnected    = 2,
+    kStopped      = 3, // Stop() called
 };
 
-using ETBase = EpollTcpBase;
-
-typedef std::shared_ptr<ETBase> ETBasePtr;
-
 // the implementation of Epoll Tcp Client
-class EpollTcpClient : public ETBase {
+class EpollTcpClient : public ETBase, public EventHandler {
 public:
     EpollTcpClient()                                       = default;
     EpollTcpClient(const EpollTcpClient& other)            = delete;
@@ -75,45 +63,159 @@ public:
     EpollTcpClient& operator=(EpollTcpClient&& other)      = delete;
     ~EpollTcpClient() override;
 
-    // the local ip and port of tcp server
-    EpollTcpClient(const std::string& server_ip, uint16_t server_port);
+    // the local ip and port of tcp server. the connection lives on loop, shared with other clients(or a server)
+    // and started and stopped by its owner; nullptr means a loop and thread of its own. server_ip "unix:/path" or
+    // "shm:/path" connects to a server listening on the same address(port ignored), see EpollTcpServer
+    EpollTcpClient(const std::string& server_ip, uint16_t server_port, const EventLoopPtr& loop = nullptr);
 
 public:
     // start tcp client
     bool Start() override;
     // stop tcp client
     bool Stop() override;
-    // send packet
+    // send packet, thread safe. what the socket does not take at once is queued and written on EPOLLOUT.
+    // while (re)connecting, packets are queued up to the max queued bytes and go out once connected;
+    // return the size queued or -1
     int32_t SendData(const PacketPtr& data) override;
+    int32_t SendData(const Packet& data) override;
     // register a callback when packet received
     void RegisterOnRecvCallback(callback_recv_t callback) override;
+    // zero copy version: the packet refers to the pooled receive buffer instead of a copy in a new PacketPtr
+    void RegisterOnRecvCallback(callback_recv_view_t callback) override;
     void UnRegisterOnRecvCallback() override;
+    // register a callback when the connection closed, must be called before Start()
+    void RegisterOnCloseCallback(callback_close_t callback);
+    // register a callback when connected, must be called before Start()
+    void RegisterOnConnectCallback(callback_connect_t callback);
+    // fail a connect attempt after timeout_ms(default kDefaultConnectTimeoutMs), must be called before Start()
+    void SetConnectTimeout(uint32_t timeout_ms);
+    // reconnect after a failed connect or a lost connection, waiting a random time between half and all of
+    // min_ms * 2^failures(at most max_ms). min_ms == 0 turns reconnecting off: the first close is final.
+    // a connection closed for being idle is reconnected by the next SendData(). must be called before Start()
+    void SetReconnectBackoff(uint32_t min_ms, uint32_t max_ms);
+    // bytes SendData() may queue while not connected(default kDefaultMaxQueuedBytes), must be called before Start()
+    void SetMaxQueuedBytes(size_t max_bytes);
+    // bytes of each ring of a shm connection(default kDefaultShmRingSize, rounded up to a power of two), must be
+    // called before Start()
+    void SetShmRingSize(uint32_t bytes);
+    // whether the connection is established now
+    bool Connected() const {
+        return _state == ConnectState::kConnected;
+    }
+    // set how the tcp stream is cut into messages(raw by default), must be called before Start() and match the server.
+    // with a length prefix codec, the recv callback gets exactly one complete message per packet,
+    // and SendData() adds the header to every packet
+    void SetFrameCodec(FrameCodecType type) override;
+    // counters and gauges of the loop of this client(one entry)
+    MetricsSnapshot Metrics() const override;
+    // timers on the loop of this client, to be called on the loop thread(in a callback or timer) or before Start();
+    // a timer added before Start() can not be cancelled(kInvalidTimerId is returned). all are cancelled by Stop()
+    TimerId RunAfter(uint32_t delay_ms, callback_timer_t callback) override;
+    TimerId RunEvery(uint32_t interval_ms, callback_timer_t callback) override;
+    bool CancelTimer(TimerId id) override;
+    // close the connection when idle for idle_ms, must be called before Start()
+    void SetIdleTimeout(uint32_t idle_ms) override;
+    // run recv callbacks on workers(in no particular order), must be called before Start(). Stop() drops the ones
+    // not started and waits for the others
+    void SetWorkerPool(const WorkerPoolPtr& workers) override;
+    // a client serves no rpc(see RpcClient for calls), return false
+    bool SetRpcService(const RpcServicePtr& service) override;
+
+    // the loop the connection lives on
+    const EventLoopPtr& Loop() const {
+        return _loop;
+    }
+
+    // the pool running the recv callbacks, nullptr if they run on the loop
+    const WorkerPoolPtr& Workers() const {
+        return _workers;
+    }
 
 protected:
-    // create epoll instance using epoll_create and return a fd of epoll
-    int32_t CreateEpoll();
-    // create a socket fd using api socket()
+    // events of the socket are ready, on the loop thread
+    void OnEvents(int32_t fd, uint32_t events) override;
+    // create a non blocking socket fd using api socket()
     int32_t CreateSocket();
-    // Connect()
-    int32_t Connect(int32_t listenfd);
-    // add/modify/remove a item(socket/fd) in epoll instance(rbtree), for this example, just add a socket to epoll rbtree
-    int32_t UpdateEpollEvents(int efd, int op, int fd, int events);
+    // non blocking connect(), return 0 if connected at once, 1 if in progress(EPOLLOUT tells), -1 on error
+    int32_t Connect(int32_t cli_fd);
+    // set socket noblock, so that neither connect() nor read() blocks the loop
+    int32_t MakeSocketNonBlocking(int32_t fd);
+    // create a socket and start connecting, on the loop thread(or in Start())
+    void StartConnect();
+    // the socket being connected is writable or failed: see if connect() succeeded
+    void OnConnect(int32_t fd);
+    // connect() succeeded: flush what was queued meanwhile
+    void OnConnected();
+    // the socket of a shm connection is connected: hand the rings over to the server, return -1 on error
+    int32_t StartShmHandshake();
+    // the answer of the server to the shm hello may have come
+    void OnShmAnswer(int32_t fd);
+    // the server wrote to or made room in the rings of the shm connection
+    void OnShmWake();
+    // try StartConnect() again after the backoff delay
+    void ScheduleReconnect();
+    // something was sent while disconnected(e.g. after an idle close), connect unless a reconnect is due anyway
+    void ConnectIfWanted();
+    // close the socket and cancel the timers of this client, on the loop thread(or after the loop stopped)
+    void Release();
 
     // handle tcp socket readable event(read())
     void OnSocketRead(int32_t fd);
+    // cut the input buffer into messages and call back for each one, return -1 on a bad frame
+    int32_t DispatchMessages(int32_t fd);
     // handle tcp socket writeable event(write())
     void OnSocketWrite(int32_t fd);
-    // one loop per thread, call epoll_wait and return ready socket(accept,readable,writeable,error...)
-    void EpollLoop();
+    // close the socket on the loop thread, and reconnect later if reconnect is true
+    void CloseConnection(bool reconnect);
+    // whether called on the loop thread of this client
+    bool InLoopThread() const;
+    // add a timer on the loop, or keep it for Start() when not started yet
+    TimerId AddTimer(uint32_t delay_ms, uint32_t interval_ms, callback_timer_t callback);
+    // idle timer fired: close the connection if nothing happened since, otherwise check again later
+    void OnIdleTimer();
 
 private:
     std::string _server_ip; // tcp server ip
     uint16_t _server_port { 0 }; // tcp server port
-    int32_t _client_fd { -1 }; // client fd
-    int32_t _epoll_fd { -1 }; // epoll fd
-    std::shared_ptr<std::thread> _thread_loop { nullptr }; // one loop per thread(call epoll_wait in loop)
-    bool _loop_flag { true }; // if loop_flag_ is false, then exit the epoll loop
+    std::string _unix_path; // unix socket path of a local transport
+    Transport _transport { Transport::kTcp }; // tcp, or a local transport told by _server_ip(sets _unix_path)
+    uint32_t _shm_ring_size { kDefaultShmRingSize }; // bytes of each ring of a shm connection
+    ShmChannelPtr _shm { nullptr }; // rings of the shm connection, set by the loop under send_mutex
+    int32_t _client_fd { -1 }; // client fd, -1 while disconnected. changed by the loop under send_mutex
+    ConnectionId _conn_id { kInvalidConnectionId }; // client fd and its generation, the id watched on the loop
+    EventLoopPtr _loop { nullptr }; // the reactor of the connection
+    bool _own_loop { false }; // the loop was created for this client, and started and stopped with it
+    bool _started { false }; // Start() called
+    std::atomic<bool> _stopped { false }; // Stop() called
+    std::shared_ptr<bool> _alive { std::make_shared<bool>(true) }; // reset by Release(), tasks posted to the loop check it
     callback_recv_t _recv_callback { nullptr }; // callback when received
+    callback_recv_view_t _recv_view_callback { nullptr }; // zero copy callback when received
+    callback_close_t _close_callback { nullptr }; // callback when the connection closed
+    callback_connect_t _connect_callback { nullptr }; // callback when connected
+    std::atomic<ConnectState> _state { ConnectState::kDisconnected }; // changed by the loop under send_mutex
+    std::atomic<bool> _want_connect { false }; // SendData() queued while disconnected, a connect is posted to the loop
+    uint32_t _connect_timeout_ms { kDefaultConnectTimeoutMs };
+    uint32_t _reconnect_min_ms { kDefaultReconnectMinMs };
+    uint32_t _reconnect_max_ms { kDefaultReconnectMaxMs };
+    size_t _max_queued_bytes { kDefaultMaxQueuedBytes };
+    uint32_t _reconnect_failures { 0 }; // failed attempts since last connected
+    TimerId _connect_timer { kInvalidTimerId }; // fails the connect attempt in progress
+    TimerId _reconnect_timer { kInvalidTimerId }; // next connect attempt
+    TimerId _idle_timer { kInvalidTimerId }; // checks last_active_ms when idle timeout is set
+    std::minstd_rand _random; // jitter of reconnect delays
+    FrameCodec _codec; // message framing of tcp stream
+    BufferPoolPtr _pool { BufferPool::Create() }; // receive buffers
+    InputBuffer _input { _pool }; // received bytes not forming a complete message yet
+    std::mutex _send_mutex; // guards output and writing, SendData() may be called from any thread
+    OutputBuffer _output; // unsent bytes
+    bool _writing { false }; // EPOLLOUT is armed, waiting for the socket to be writable again
+    LoopMetrics _metrics; // read side written by the loop, write side under send_mutex; loop wide ones are in loop
+    LoopTimers _timers; // timers of this client on the loop
+    std::vector<PendingTimer> _pending_timers; // timers given before Start(), added on the loop when it starts
+    uint32_t _idle_timeout_ms { 0 }; // close the connection idle that long, 0 means never
+    std::atomic<uint64_t> _last_active_ms { 0 }; // last time bytes were read or written, when idle timeout set
+    WorkerPoolPtr _workers { nullptr }; // runs recv callbacks off the loop if set
+    WorkerTasks _worker_tasks;           // the callbacks given to _workers, closed by Stop()
 };
 
 } // namespace erpc
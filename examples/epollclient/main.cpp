@@ -1,21 +1,152 @@
+#include <sstream>
+
 #include "epoll_client.h"
+#include "rpc_client.h"
+#include "rpc_client_pool.h"
+#include "wire_schema.h"
 
 using namespace erpc;
 
+// request and response of the method "sum" of the example server
+struct SumRequest : public WireSchema<WireArray<int64_t>> {
+    typedef Field<0> Values;
+};
+
+struct SumResponse : public WireSchema<int64_t, uint32_t> {
+    typedef Field<0> Sum;
+    typedef Field<1> Count;
+};
+
 int main(int argc, char* argv[]) {
     std::string server_ip {"127.0.0.1"};
     uint16_t server_port { 6666 };
+    std::string codec { "raw" };
+    std::string mode { "echo" };
     if (argc >= 2) {
         server_ip = std::string(argv[1]);
     }
     if (argc >= 3) {
         server_port = std::atoi(argv[2]);
     }
+    if (argc >= 4) {
+        // message framing: raw, fixed32 or varint, must be the same as server
+        codec = std::string(argv[3]);
+    }
+    if (argc >= 5) {
+        // echo: send raw messages, rpc: call the method "echo" of a rpc server, sum: call its method "sum" with
+        // the numbers of every line, count: open its stream "count" for the number of records of every line,
+        // pool: same as rpc over a pool, server_ip is a list "ip:port,ip:port,..."
+        mode = std::string(argv[4]);
+    }
+
+    if (mode == "pool") {
+        RpcClientPool pool(ParseEndpoints(server_ip, server_port), kDefaultPoolConnections,
+                           BalancePolicy::kPowerOfTwoChoices, FrameCodecTypeFromString(codec));
+        if (!pool.Start()) {
+            ERPC_LOG_ERROR("rpc_client_pool start failed!");
+            exit(1);
+        }
+        uint32_t echo = RpcMethodId("echo");
+        std::string msg;
+        std::cout << std::endl << "input:";
+        while (std::getline(std::cin, msg)) {
+            RpcResult result = pool.Call(echo, msg, 1000).get();
+            std::cout << RpcStatusString(result.status) << ": " << result.body.ToString() << std::endl;
+            std::cout << std::endl << "input:";
+        }
+        pool.Stop();
+        return 0;
+    }
+
+    if (mode == "rpc") {
+        RpcClient rpc_client(server_ip, server_port, FrameCodecTypeFromString(codec));
+        if (!rpc_client.Start()) {
+            ERPC_LOG_ERROR("rpc_client start failed!");
+            exit(1);
+        }
+        uint32_t echo = RpcMethodId("echo");
+        std::string msg;
+        std::cout << std::endl << "input:";
+        while (std::getline(std::cin, msg)) {
+            RpcResult result = rpc_client.Call(echo, msg, 1000).get();
+            std::cout << RpcStatusString(result.status) << ": " << result.body.ToString() << std::endl;
+            std::cout << std::endl << "input:";
+        }
+        rpc_client.Stop();
+        return 0;
+    }
+
+    if (mode == "count") {
+        RpcClient rpc_client(server_ip, server_port, FrameCodecTypeFromString(codec));
+        if (!rpc_client.Start()) {
+            ERPC_LOG_ERROR("rpc_client start failed!");
+            exit(1);
+        }
+        uint32_t count = RpcMethodId("count");
+        std::string line;
+        std::cout << std::endl << "input:";
+        while (std::getline(std::cin, line)) {
+            // the callbacks run on the loop, the records are counted there
+            auto records = std::make_shared<uint64_t>(0);
+            auto last = std::make_shared<std::string>();
+            auto done = std::make_shared<std::promise<uint16_t>>();
+            RpcStreamCallbacks callbacks;
+            callbacks.on_message = [records, last](const char* data, size_t size) {
+                ++*records;
+                last->assign(data, size);
+            };
+            callbacks.on_close = [done](uint16_t status) { done->set_value(status); };
+            RpcStreamPtr stream = rpc_client.OpenStream(count, callbacks);
+            if (!stream) {
+                break;
+            }
+            stream->Write(line);
+            stream->Close();
+            uint16_t status = done->get_future().get();
+            std::cout << RpcStatusString(status) << ": " << *records << " records, last " << *last << std::endl;
+            std::cout << std::endl << "input:";
+        }
+        rpc_client.Stop();
+        return 0;
+    }
+
+    if (mode == "sum") {
+        RpcClient rpc_client(server_ip, server_port, FrameCodecTypeFromString(codec));
+        if (!rpc_client.Start()) {
+            ERPC_LOG_ERROR("rpc_client start failed!");
+            exit(1);
+        }
+        uint32_t sum = RpcMethodId("sum");
+        std::string line;
+        std::cout << std::endl << "input:";
+        while (std::getline(std::cin, line)) {
+            std::vector<int64_t> values;
+            std::istringstream numbers(line);
+            int64_t value = 0;
+            while (numbers >> value) {
+                values.push_back(value);
+            }
+            std::string request;
+            WireBuilder<SumRequest> builder(&request);
+            builder.Set<SumRequest::Values>(values);
+            RpcResult result = rpc_client.Call(sum, request, 1000).get();
+            WireReader<SumResponse> response;
+            if (result.status == kRpcOk && response.Parse(result.body.data(), result.body.size())) {
+                std::cout << "sum of " << response.Get<SumResponse::Count>() << ": "
+                          << response.Get<SumResponse::Sum>() << std::endl;
+            } else {
+                std::cout << RpcStatusString(result.status) << std::endl;
+            }
+            std::cout << std::endl << "input:";
+        }
+        rpc_client.Stop();
+        return 0;
+    }
 
     // create a tcp client
     auto tcp_client = std::make_shared<EpollTcpClient>(server_ip, server_port);
     if (!tcp_client) {
-        std::cout << "tcp_client create faield!" << std::endl;
+        ERPC_LOG_ERROR("tcp_client create faield!");
         exit(-1);
     }
 
@@ -27,15 +158,18 @@ int main(int argc, char* argv[]) {
         return;
     };
 
+    // cut tcp stream into messages
+    tcp_client->SetFrameCodec(FrameCodecTypeFromString(codec));
+
     // register recv callback to epoll tcp client
     tcp_client->RegisterOnRecvCallback(recv_call);
 
     // start the epoll tcp client
     if (!tcp_client->Start()) {
-        std::cout << "tcp_client start failed!" << std::endl;
+        ERPC_LOG_ERROR("tcp_client start failed!");
         exit(1);
     }
-    std::cout << "############tcp_client started!################" << std::endl;
+    ERPC_LOG_INFO("############tcp_client started!################");
 
     std::string msg;
     while (true) {
@@ -0,0 +1,286 @@
+#include "rpc_client.h"
+
+namespace erpc {
+
+// how the streams of a RpcClient reach its connection. client is reset on the loop when it stops, streams may be
+// held by the application longer
+class RpcClientStreamTransport : public RpcStreamTransport {
+public:
+    RpcClientStreamTransport(RpcClient* client, const EventLoopPtr& loop)
+        : client(client),
+          loop(loop) {}
+
+    bool Send(const RpcHeader& header, const char* body, size_t size) override {
+        return client && client->SendStreamMessage(header, body, size);
+    }
+
+    void RunInLoop(task_t task) override {
+        loop->RunInLoop(std::move(task));
+    }
+
+    bool InLoopThread() const override {
+        return loop->InLoopThread();
+    }
+
+    void Forget(uint64_t id) override {
+        if (client) {
+            client->_streams.Erase(id);
+        }
+    }
+
+    RpcClient* client;
+    EventLoopPtr loop;
+};
+
+RpcClient::RpcClient(const std::string& server_ip, uint16_t server_port, FrameCodecType codec, const EventLoopPtr& loop)
+    : _client { server_ip, server_port, loop },
+      _codec { codec } {
+    _stream_transport = std::make_shared<RpcClientStreamTransport>(this, _client.Loop());
+    _client.SetFrameCodec(codec);
+    _client.RegisterOnRecvCallback([this](const Packet& data) { OnMessage(data); });
+    _client.RegisterOnCloseCallback([this] { OnClose(); });
+}
+
+RpcClient::~RpcClient() {
+    Stop();
+}
+
+bool RpcClient::Start() {
+    if (_codec == FrameCodecType::kRaw) {
+        ERPC_LOG_ERROR("rpc needs a length prefix codec(fixed32 or varint)!");
+        return false;
+    }
+    if (!_client.Start()) {
+        return false;
+    }
+    // calls made before have no timer yet
+    _started = true;
+    std::shared_ptr<bool> alive = _alive;
+    _client.Loop()->RunInLoop([this, alive] {
+        if (*alive) {
+            ArmDeadlineTimer();
+        }
+    });
+    return true;
+}
+
+bool RpcClient::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+    }
+    // calls OnClose() for the calls and streams still pending
+    bool ret = _client.Stop();
+    std::shared_ptr<RpcClientStreamTransport> transport = _stream_transport;
+    std::shared_ptr<bool> alive = _alive;
+    _client.Loop()->RunSync([transport, alive] {
+        transport->client = nullptr;
+        *alive = false;
+    });
+    return ret;
+}
+
+bool RpcClient::Call(uint32_t method_id, const std::string& request, callback_rpc_t done, uint32_t timeout_ms) {
+    RpcHeader header;
+    header.type = kRpcRequest;
+    header.method_id = method_id;
+    header.request_id = ++_next_id;
+
+    bool closed = false;
+    bool arm = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        closed = _closed;
+        if (!closed) {
+            // in the table before sending, the response may come before SendData() returns
+            PendingCall& call = _calls[header.request_id];
+            call.done = std::move(done);
+            if (timeout_ms > 0) {
+                call.deadline_ms = TimerWheel::NowMs() + timeout_ms;
+                _deadlines.emplace(call.deadline_ms, header.request_id);
+                // the timer is set for a later deadline(or none): it must fire earlier
+                if (_armed_ms == 0 || call.deadline_ms < _armed_ms) {
+                    _armed_ms = call.deadline_ms;
+                    arm = true;
+                }
+            }
+        }
+    }
+    if (arm && _started) {
+        std::shared_ptr<bool> alive = _alive;
+        _client.Loop()->RunInLoop([this, alive] {
+            if (*alive) {
+                ArmDeadlineTimer();
+            }
+        });
+    }
+    if (closed) {
+        RpcResult result;
+        result.status = kRpcConnectionClosed;
+        done(result);
+        return false;
+    }
+
+    Packet packet;
+    packet.msg.resize(kRpcHeaderSize);
+    EncodeRpcHeader(header, &packet.msg[0]);
+    packet.msg.append(request);
+    if (_client.SendData(packet) >= 0) {
+        return true;
+    }
+    // completed by OnClose() meanwhile if the connection is gone
+    callback_rpc_t failed;
+    if (TakeCall(header.request_id, &failed)) {
+        RpcResult result;
+        result.status = kRpcSendFailed;
+        failed(result);
+    }
+    return false;
+}
+
+std::future<RpcResult> RpcClient::Call(uint32_t method_id, const std::string& request, uint32_t timeout_ms) {
+    auto promise = std::make_shared<std::promise<RpcResult>>();
+    std::future<RpcResult> future = promise->get_future();
+    Call(method_id, request, [promise](const RpcResult& result) { promise->set_value(result); }, timeout_ms);
+    return future;
+}
+
+RpcStreamPtr RpcClient::OpenStream(uint32_t method_id, const RpcStreamCallbacks& callbacks) {
+    if (_client.Workers()) {
+        ERPC_LOG_ERROR("rpc streams need the callbacks on the loop, not on a worker pool!");
+        return nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_closed) {
+            return nullptr;
+        }
+    }
+    auto stream = std::make_shared<RpcStream>(++_next_id, method_id, true, _stream_transport);
+    // set before the loop knows the stream, so no message can come before
+    stream->SetCallbacks(callbacks);
+    std::shared_ptr<RpcClientStreamTransport> transport = _stream_transport;
+    _client.Loop()->RunInLoop([transport, stream] {
+        if (!transport->client) {
+            // stopped meanwhile
+            stream->Abort(kRpcConnectionClosed);
+        } else if (!transport->client->_streams.Add(stream)) {
+            stream->Abort(kRpcStreamRefused);
+        } else {
+            stream->Open();
+        }
+    });
+    return stream;
+}
+
+bool RpcClient::SendStreamMessage(const RpcHeader& header, const char* body, size_t size) {
+    Packet packet;
+    packet.msg.resize(kRpcHeaderSize);
+    EncodeRpcHeader(header, &packet.msg[0]);
+    packet.msg.append(body, size);
+    return _client.SendData(packet) >= 0;
+}
+
+size_t RpcClient::Pending() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _calls.size();
+}
+
+bool RpcClient::TakeCall(uint64_t id, callback_rpc_t* done) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _calls.find(id);
+    if (it == _calls.end()) {
+        return false;
+    }
+    if (it->second.deadline_ms > 0) {
+        _deadlines.erase(std::make_pair(it->second.deadline_ms, id));
+    }
+    *done = std::move(it->second.done);
+    _calls.erase(it);
+    return true;
+}
+
+void RpcClient::OnMessage(const Packet& data) {
+    RpcHeader header;
+    if (DecodeRpcHeader(data.data(), data.size(), &header) && IsRpcStreamMessage(header.type)) {
+        _streams.Dispatch(header, data.data() + kRpcHeaderSize, data.size() - kRpcHeaderSize);
+        return;
+    }
+    if (header.type != kRpcResponse || data.size() < kRpcHeaderSize) {
+        ERPC_LOG_WARN("fd: %d bad rpc response of %zu bytes, dropped!", data.fd, data.size());
+        return;
+    }
+    callback_rpc_t done;
+    if (!TakeCall(header.request_id, &done)) {
+        // timed out already
+        ERPC_LOG_DEBUG("fd: %d response of request %lu too late", data.fd, static_cast<unsigned long>(header.request_id));
+        return;
+    }
+    RpcResult result;
+    result.status = header.status;
+    result.body = data.view.Sub(kRpcHeaderSize, data.size() - kRpcHeaderSize);
+    done(result);
+}
+
+void RpcClient::OnClose() {
+    std::unordered_map<uint64_t, PendingCall> calls;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        calls.swap(_calls);
+        _deadlines.clear();
+    }
+    // the streams can not go on over a new connection
+    _streams.AbortAll(kRpcConnectionClosed);
+    // outside the lock, a callback may call again: queued until reconnected(or failed at once after Stop())
+    for (auto& it : calls) {
+        RpcResult result;
+        result.status = kRpcConnectionClosed;
+        it.second.done(result);
+    }
+}
+
+void RpcClient::CheckDeadlines() {
+    uint64_t now = TimerWheel::NowMs();
+    while (true) {
+        callback_rpc_t done;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_deadlines.empty() || _deadlines.begin()->first > now) {
+                break;
+            }
+            auto it = _calls.find(_deadlines.begin()->second);
+            _deadlines.erase(_deadlines.begin());
+            done = std::move(it->second.done);
+            _calls.erase(it);
+        }
+        RpcResult result;
+        result.status = kRpcTimeout;
+        done(result);
+    }
+    // calls answered meanwhile left their deadlines behind, the timer only fires again for a pending one
+    ArmDeadlineTimer();
+}
+
+void RpcClient::ArmDeadlineTimer() {
+    uint64_t deadline = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        deadline = _deadlines.empty() ? 0 : _deadlines.begin()->first;
+        _armed_ms = deadline;
+    }
+    if (_deadline_timer != kInvalidTimerId) {
+        _client.CancelTimer(_deadline_timer);
+        _deadline_timer = kInvalidTimerId;
+    }
+    if (deadline == 0) {
+        // no wakeup at all while no call has a deadline
+        return;
+    }
+    uint64_t now = _client.Loop()->NowMs();
+    _deadline_timer = _client.RunAfter(deadline > now ? deadline - now : 0, [this] {
+        _deadline_timer = kInvalidTimerId;
+        CheckDeadlines();
+    });
+}
+
+} // namespace erpc
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "epoll_client.h"
+#include "rpc_protocol.h"
+#include "rpc_stream.h"
+
+namespace erpc {
+
+// outcome of a call: the status, and the response body, which refers to the receive buffer(zero copy) and
+// keeps its block alive, so copy it out with ToString() before keeping it long
+typedef struct RpcResult {
+    uint16_t status { kRpcOk };
+    BufferView body;
+} RpcResult;
+
+// callback when a call completed(response, timeout, or connection closed), exactly once per call
+using callback_rpc_t = std::function<void(const RpcResult& result)>;
+
+class RpcClientStreamTransport;
+
+// multiplexed rpc over one EpollTcpClient connection: every request carries a request id, the response
+// echoes it, and the pending call is found in a table, so many calls are in flight at once and complete
+// in whatever order the server answers them
+class RpcClient {
+public:
+    RpcClient()                                  = delete;
+    RpcClient(const RpcClient& other)            = delete;
+    RpcClient& operator=(const RpcClient& other) = delete;
+    ~RpcClient();
+
+    // codec must be fixed32 or varint(a message per frame), and the same as the server. loop is shared with
+    // other connections, see EpollTcpClient; nullptr means a loop of its own
+    RpcClient(const std::string& server_ip, uint16_t server_port, FrameCodecType codec = FrameCodecType::kVarint,
+              const EventLoopPtr& loop = nullptr);
+
+public:
+    bool Start();
+    // stop the connection, pending calls complete with kRpcConnectionClosed
+    bool Stop();
+    // send a request, thread safe. done runs on the loop thread(or a worker, see SetWorkerPool()) when the
+    // response comes, or with kRpcTimeout after timeout_ms(0 means no deadline), or kRpcConnectionClosed
+    // when the connection is lost with the call in flight. while reconnecting, requests are queued.
+    // if the request can not be sent, done runs before Call() returns and false is returned
+    bool Call(uint32_t method_id, const std::string& request, callback_rpc_t done, uint32_t timeout_ms = 0);
+    // same as above, the result is delivered through a future
+    std::future<RpcResult> Call(uint32_t method_id, const std::string& request, uint32_t timeout_ms = 0);
+    // open a stream to the stream method method_id of the server, thread safe. callbacks run on the loop thread;
+    // on_close comes exactly once: with the status of the server when it closed the stream, when either side
+    // cancelled it, or with kRpcConnectionClosed when the connection is lost. nullptr if the client is stopped,
+    // or runs its callbacks on a worker pool(the messages of a stream must be handled in order)
+    RpcStreamPtr OpenStream(uint32_t method_id, const RpcStreamCallbacks& callbacks);
+    // number of calls waiting for a response
+    size_t Pending() const;
+    // the connection underneath, e.g. for Metrics() or SetWorkerPool() before Start()
+    EpollTcpClient& Client() {
+        return _client;
+    }
+
+protected:
+    friend class RpcClientStreamTransport;
+
+    // a response arrived
+    void OnMessage(const Packet& data);
+    // the connection closed(it reconnects unless stopped), fail every pending call: its request or response may be lost
+    void OnClose();
+    // the deadline timer fired, on the loop: fail calls past their deadline and arm it for the next one
+    void CheckDeadlines();
+    // set the deadline timer to the nearest deadline of the pending calls, none if no call has one. loop thread
+    void ArmDeadlineTimer();
+    // remove call id from the table, return false if it completed already
+    bool TakeCall(uint64_t id, callback_rpc_t* done);
+    // queue a message of a stream on the connection, on the loop thread
+    bool SendStreamMessage(const RpcHeader& header, const char* body, size_t size);
+
+private:
+    typedef struct PendingCall {
+        callback_rpc_t done { nullptr };
+        uint64_t deadline_ms { 0 }; // 0 means none
+    } PendingCall;
+
+    EpollTcpClient _client; // the connection
+    FrameCodecType _codec; // framing of the connection
+    std::atomic<uint64_t> _next_id { 0 }; // last request id handed out
+    mutable std::mutex _mutex; // guards the tables below and closed, Call() may come from any thread
+    std::unordered_map<uint64_t, PendingCall> _calls; // pending calls by request id
+    std::set<std::pair<uint64_t, uint64_t>> _deadlines; // (deadline_ms, request id) of calls with a deadline
+    uint64_t _armed_ms { 0 }; // deadline the timer is set(or about to be set) for, 0 if none
+    bool _closed { false }; // no more calls, stopped
+    std::atomic<bool> _started { false }; // the loop takes posts, the deadline timer is armed on it from now on
+    TimerId _deadline_timer { kInvalidTimerId }; // one timer at the nearest deadline, loop thread only
+    std::shared_ptr<bool> _alive { std::make_shared<bool>(true) }; // reset on the loop by Stop(), posts check it
+    RpcStreamTable _streams; // open streams, on the loop thread
+    std::shared_ptr<RpcClientStreamTransport> _stream_transport; // how they reach the connection
+};
+
+typedef std::shared_ptr<RpcClient> RpcClientPtr;
+
+} // namespace erpc
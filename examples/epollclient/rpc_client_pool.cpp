@@ -0,0 +1,185 @@
+#include "rpc_client_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <thread>
+
+namespace erpc {
+
+std::vector<Endpoint> ParseEndpoints(const std::string& list, uint16_t default_port) {
+    std::vector<Endpoint> endpoints;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string item = list.substr(begin, end - begin);
+        if (!item.empty()) {
+            Endpoint endpoint;
+            size_t colon = item.find(':');
+            endpoint.ip = item.substr(0, colon);
+            endpoint.port = colon == std::string::npos ? default_port : std::atoi(item.c_str() + colon + 1);
+            endpoints.push_back(endpoint);
+        }
+        begin = end + 1;
+    }
+    return endpoints;
+}
+
+RpcClientPool::RpcClientPool(const std::vector<Endpoint>& endpoints, uint32_t conns_per_endpoint,
+                             BalancePolicy policy, FrameCodecType codec, const std::vector<EventLoopPtr>& loops)
+    : _policy { policy } {
+    std::vector<EventLoopPtr> conn_loops = loops;
+    if (conn_loops.empty()) {
+        for (uint32_t i = 0; i < kDefaultPoolLoops; ++i) {
+            _own_loops.push_back(std::make_shared<EventLoop>(i));
+        }
+        conn_loops = _own_loops;
+    }
+    for (uint32_t i = 0; i < endpoints.size(); ++i) {
+        _endpoints.emplace_back(new PoolEndpoint());
+        _endpoints.back()->endpoint = endpoints[i];
+        for (uint32_t j = 0; j < std::max(1u, conns_per_endpoint); ++j) {
+            // round robin over the loops
+            const EventLoopPtr& loop = conn_loops[_conns.size() % conn_loops.size()];
+            _conns.emplace_back(new PoolConnection());
+            _conns.back()->client = std::make_shared<RpcClient>(endpoints[i].ip, endpoints[i].port, codec, loop);
+            _conns.back()->endpoint = i;
+        }
+    }
+}
+
+RpcClientPool::~RpcClientPool() {
+    Stop();
+}
+
+bool RpcClientPool::Start() {
+    if (_conns.empty()) {
+        ERPC_LOG_ERROR("RpcClientPool has no endpoint!");
+        return false;
+    }
+    for (auto& conn : _conns) {
+        // connects in the background
+        if (!conn->client->Start()) {
+            return false;
+        }
+    }
+    for (auto& loop : _own_loops) {
+        if (!loop->Start()) {
+            return false;
+        }
+    }
+    ERPC_LOG_INFO("RpcClientPool started! endpoints=%zu connections=%zu", _endpoints.size(), _conns.size());
+    return true;
+}
+
+bool RpcClientPool::Stop() {
+    for (auto& conn : _conns) {
+        conn->client->Stop();
+    }
+    for (auto& loop : _own_loops) {
+        loop->Stop();
+    }
+    return true;
+}
+
+bool RpcClientPool::Usable(const PoolConnection& conn, uint64_t now_ms) const {
+    return conn.client->Client().Connected() && _endpoints[conn.endpoint]->ejected_until_ms.load(std::memory_order_relaxed) <= now_ms;
+}
+
+RpcClientPool::PoolConnection* RpcClientPool::Pick() {
+    static thread_local std::minstd_rand random(static_cast<uint32_t>(TimerWheel::NowMs() ^ std::hash<std::thread::id>()(std::this_thread::get_id())));
+    uint64_t now = TimerWheel::NowMs();
+    size_t size = _conns.size();
+    uint32_t start = _next.fetch_add(1, std::memory_order_relaxed);
+
+    if (_policy == BalancePolicy::kPowerOfTwoChoices) {
+        // two random usable connections, a few tries to find them among unusable ones
+        PoolConnection* chosen[2] = { nullptr, nullptr };
+        for (uint32_t i = 0, found = 0; i < 8 && found < 2; ++i) {
+            PoolConnection* conn = _conns[random() % size].get();
+            if (Usable(*conn, now) && conn != chosen[0]) {
+                chosen[found++] = conn;
+            }
+        }
+        if (chosen[0] && chosen[1]) {
+            return chosen[0]->outstanding.load(std::memory_order_relaxed) <= chosen[1]->outstanding.load(std::memory_order_relaxed)
+                ? chosen[0] : chosen[1];
+        }
+        if (chosen[0]) {
+            return chosen[0];
+        }
+        // no usable connection among the tries, look at all of them
+    }
+
+    PoolConnection* best = nullptr;
+    for (size_t i = 0; i < size; ++i) {
+        PoolConnection* conn = _conns[(start + i) % size].get();
+        if (Usable(*conn, now) && (!best || conn->outstanding.load(std::memory_order_relaxed) < best->outstanding.load(std::memory_order_relaxed))) {
+            best = conn;
+        }
+    }
+    if (best) {
+        return best;
+    }
+    // nothing usable: every endpoint is down or ejected, spread the calls anyway(they queue while reconnecting)
+    return _conns[start % size].get();
+}
+
+void RpcClientPool::OnCallDone(PoolEndpoint* endpoint, uint16_t status) {
+    if (status != kRpcTimeout && status != kRpcConnectionClosed && status != kRpcSendFailed) {
+        // the server answered, whatever it said
+        endpoint->failures.store(0, std::memory_order_relaxed);
+        endpoint->ejections.store(0, std::memory_order_relaxed);
+        return;
+    }
+    uint64_t now = TimerWheel::NowMs();
+    if (endpoint->ejected_until_ms.load(std::memory_order_relaxed) > now) {
+        // the rest of the calls in flight when ejected, not a new failure
+        return;
+    }
+    if (endpoint->failures.fetch_add(1, std::memory_order_relaxed) + 1 < kPoolEjectFailures) {
+        return;
+    }
+    endpoint->failures.store(0, std::memory_order_relaxed);
+    uint32_t ejections = endpoint->ejections.fetch_add(1, std::memory_order_relaxed);
+    uint64_t eject_ms = std::min<uint64_t>(kPoolEjectMaxMs, static_cast<uint64_t>(kPoolEjectBaseMs) << std::min<uint32_t>(ejections, 16));
+    endpoint->ejected_until_ms.store(now + eject_ms, std::memory_order_relaxed);
+    ERPC_LOG_WARN("endpoint %s:%u ejected for %lu ms!", endpoint->endpoint.ip.c_str(), endpoint->endpoint.port,
+                  static_cast<unsigned long>(eject_ms));
+}
+
+bool RpcClientPool::Call(uint32_t method_id, const std::string& request, callback_rpc_t done, uint32_t timeout_ms) {
+    PoolConnection* conn = Pick();
+    PoolEndpoint* endpoint = _endpoints[conn->endpoint].get();
+    conn->outstanding.fetch_add(1, std::memory_order_relaxed);
+    return conn->client->Call(method_id, request, [this, conn, endpoint, done](const RpcResult& result) {
+        conn->outstanding.fetch_sub(1, std::memory_order_relaxed);
+        OnCallDone(endpoint, result.status);
+        done(result);
+    }, timeout_ms);
+}
+
+std::future<RpcResult> RpcClientPool::Call(uint32_t method_id, const std::string& request, uint32_t timeout_ms) {
+    auto promise = std::make_shared<std::promise<RpcResult>>();
+    std::future<RpcResult> future = promise->get_future();
+    Call(method_id, request, [promise](const RpcResult& result) { promise->set_value(result); }, timeout_ms);
+    return future;
+}
+
+uint32_t RpcClientPool::Outstanding() const {
+    uint32_t outstanding = 0;
+    for (auto& conn : _conns) {
+        outstanding += conn->outstanding.load(std::memory_order_relaxed);
+    }
+    return outstanding;
+}
+
+bool RpcClientPool::Ejected(uint32_t index) const {
+    return _endpoints[index]->ejected_until_ms.load(std::memory_order_relaxed) > TimerWheel::NowMs();
+}
+
+} // namespace erpc
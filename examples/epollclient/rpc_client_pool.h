@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rpc_client.h"
+
+namespace erpc {
+
+static const uint32_t kDefaultPoolConnections = 2;  // connections per endpoint
+static const uint32_t kDefaultPoolLoops = 1;        // loops(threads) the connections share, unless loops are given
+static const uint32_t kPoolEjectFailures = 5;       // consecutive failed calls ejecting an endpoint
+static const uint32_t kPoolEjectBaseMs = 1000;      // first ejection time, doubled every ejection in a row
+static const uint32_t kPoolEjectMaxMs = 30000;      // max ejection time
+
+// how a call picks its connection
+enum class BalancePolicy : uint8_t {
+    kLeastOutstanding  = 0, // the connection with fewest calls in flight(scans all)
+    kPowerOfTwoChoices = 1, // the less loaded of two random connections
+};
+
+typedef struct Endpoint {
+    std::string ip;
+    uint16_t port { 0 };
+} Endpoint;
+
+// parse "ip:port,ip:port,...", entries without a port get default_port
+std::vector<Endpoint> ParseEndpoints(const std::string& list, uint16_t default_port);
+
+// rpc over several connections to each of several servers, spread over loops(kDefaultPoolLoops of its own, or
+// the loops given, which are started and stopped by their owner). every call goes to the healthy connection chosen
+// by the balance policy; an endpoint failing kPoolEjectFailures calls in a row(timeout, connection lost) is
+// left out for a while, and if every endpoint is ejected, all of them are used anyway
+class RpcClientPool {
+public:
+    RpcClientPool()                                      = delete;
+    RpcClientPool(const RpcClientPool& other)            = delete;
+    RpcClientPool& operator=(const RpcClientPool& other) = delete;
+    ~RpcClientPool();
+
+    RpcClientPool(const std::vector<Endpoint>& endpoints, uint32_t conns_per_endpoint = kDefaultPoolConnections,
+                  BalancePolicy policy = BalancePolicy::kPowerOfTwoChoices,
+                  FrameCodecType codec = FrameCodecType::kVarint,
+                  const std::vector<EventLoopPtr>& loops = std::vector<EventLoopPtr>());
+
+public:
+    bool Start();
+    bool Stop();
+    // same as RpcClient::Call(), on the connection chosen by the policy
+    bool Call(uint32_t method_id, const std::string& request, callback_rpc_t done, uint32_t timeout_ms = 0);
+    std::future<RpcResult> Call(uint32_t method_id, const std::string& request, uint32_t timeout_ms = 0);
+    // calls in flight over all connections
+    uint32_t Outstanding() const;
+    // whether endpoint index is ejected now
+    bool Ejected(uint32_t index) const;
+    // number of connections
+    size_t Size() const {
+        return _conns.size();
+    }
+
+private:
+    typedef struct PoolEndpoint {
+        Endpoint endpoint;
+        std::atomic<uint32_t> failures { 0 };         // failed calls in a row
+        std::atomic<uint32_t> ejections { 0 };        // ejections in a row, without a success between
+        std::atomic<uint64_t> ejected_until_ms { 0 }; // left out until then
+    } PoolEndpoint;
+
+    typedef struct PoolConnection {
+        RpcClientPtr client;
+        uint32_t endpoint { 0 };                 // index in endpoints
+        std::atomic<uint32_t> outstanding { 0 }; // calls in flight
+    } PoolConnection;
+
+    // whether conn may take calls now
+    bool Usable(const PoolConnection& conn, uint64_t now_ms) const;
+    // the connection for the next call
+    PoolConnection* Pick();
+    // count a finished call of endpoint, eject it after too many failures
+    void OnCallDone(PoolEndpoint* endpoint, uint16_t status);
+
+private:
+    std::vector<std::unique_ptr<PoolEndpoint>> _endpoints;
+    std::vector<std::unique_ptr<PoolConnection>> _conns;
+    std::vector<EventLoopPtr> _own_loops; // created, started and stopped by the pool
+    BalancePolicy _policy;
+    std::atomic<uint32_t> _next { 0 }; // rotates the start of scans, so ties do not always pick the first
+};
+
+typedef std::shared_ptr<RpcClientPool> RpcClientPoolPtr;
+
+} // namespace erpc
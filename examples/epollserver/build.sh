@@ -1,3 +1,3 @@
 #!/bin/bash
 
-/opt/compiler/gcc-8.2/bin/g++ -std=c++11 main.cpp epoll_server.cpp -o main -lpthread
+/opt/compiler/gcc-8.2/bin/g++ -std=c++11 -I../common main.cpp epoll_server.cpp uring_server.cpp ../common/event_loop.cpp ../common/logger.cpp ../common/metrics.cpp ../common/worker_pool.cpp -o main -lpthread
@@ -1,10 +1,76 @@
 #include "epoll_server.h"
 
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69 // linux 5.11, missing in older headers
+#endif
+
 namespace erpc {
 
-EpollTcpServer::EpollTcpServer(const std::string& local_ip, uint16_t local_port)
+// the message the worker on current thread is running a recv callback for
+static thread_local WorkerContext t_worker_context;
+
+// connections accepted for a loop by the acceptor thread. the task handing them over may be destroyed without
+// running when the loop stops, the fds not taken by then are closed with it
+typedef struct HandedFds {
+    ~HandedFds() {
+        for (int32_t fd : fds) {
+            ::close(fd);
+        }
+    }
+
+    std::vector<int32_t> fds;
+} HandedFds;
+
+EpollTcpServer::EpollTcpServer(const std::string& local_ip, uint16_t local_port, uint32_t loop_num)
     : _local_ip(local_ip),
-      _local_port(local_port) {
+      _local_port(local_port),
+      _transport(ParseTransport(local_ip, &_unix_path)),
+      _loop_num(loop_num) {
+    if (_loop_num == 0) {
+        // one loop per cpu core
+        _loop_num = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+EpollTcpServer::EpollTcpServer(const std::string& local_ip, uint16_t local_port, const std::vector<EventLoopPtr>& loops)
+    : _local_ip(local_ip),
+      _local_port(local_port),
+      _transport(ParseTransport(local_ip, &_unix_path)),
+      _loop_num(loops.size()),
+      _shared_loops(loops) {
+}
+
+void EpollLoopContext::OnEvents(int32_t fd, uint32_t events) {
+    server->OnLoopEvents(server->_loops[index], fd, events);
+}
+
+void EpollAcceptor::OnEvents(int32_t /*fd*/, uint32_t /*events*/) {
+    server->OnAcceptorAccept();
+}
+
+bool EpollStreamTransport::Send(const RpcHeader& header, const char* body, size_t size) {
+    EpollLoopContextPtr context = loop.lock();
+    return context && context->server && context->server->SendStreamInLoop(context.get(), conn_id, header, body, size) >= 0;
+}
+
+void EpollStreamTransport::RunInLoop(task_t task) {
+    EpollLoopContextPtr context = loop.lock();
+    if (context) {
+        context->event_loop->RunInLoop(std::move(task));
+    }
+}
+
+bool EpollStreamTransport::InLoopThread() const {
+    EpollLoopContextPtr context = loop.lock();
+    return context && context->event_loop->InLoopThread();
+}
+
+void EpollStreamTransport::Forget(uint64_t id) {
+    EpollLoopContextPtr context = loop.lock();
+    ConnectionPtr conn = context ? context->connections.Find(conn_id) : nullptr;
+    if (conn) {
+        conn->streams.Erase(id);
+    }
 }
 
 EpollTcpServer::~EpollTcpServer() {
@@ -12,83 +78,225 @@ EpollTcpServer::~EpollTcpServer() {
 }
 
 bool EpollTcpServer::Start() {
-    // create epoll instance
-    if (CreateEpoll() < 0) {
+    assert(_loops.empty());
+    if (_service) {
+        if (_codec.Type() == FrameCodecType::kRaw) {
+            ERPC_LOG_ERROR("rpc needs a length prefix codec(fixed32 or varint)!");
+            return false;
+        }
+        _service->Seal();
+    }
+
+    if (_loop_num == 0) {
+        ERPC_LOG_ERROR("EpollTcpServer has no loop!");
         return false;
     }
+    if (_transport != Transport::kTcp && _loop_num > 1 && _accept_balance == AcceptBalance::kReusePort) {
+        // a unix socket path binds once, one listen socket hands the connections to the loops
+        ERPC_LOG_INFO("%s has no SO_REUSEPORT, accept round robin!", _local_ip.c_str());
+        _accept_balance = AcceptBalance::kRoundRobin;
+    }
 
-    // create socket and bind
+    // all contexts exist before any fd is added: a running shared loop may look at the others(OutputBytes())
+    for (uint32_t i = 0; i < _loop_num; ++i) {
+        auto loop = std::make_shared<EpollLoopContext>();
+        loop->index = i;
+        loop->server = this;
+        if (_shared_loops.empty()) {
+            loop->event_loop = std::make_shared<EventLoop>(i);
+            loop->event_loop->SetBusyPoll(_busy_poll_us);
+        } else {
+            loop->event_loop = _shared_loops[i];
+        }
+        loop->timers.Attach(loop->event_loop.get());
+        // keep it before init, so that Stop() can release the fds of a half initialized loop
+        _loops.push_back(loop);
+    }
+    for (auto& loop : _loops) {
+        if (!loop->event_loop->Init()) {
+            return false;
+        }
+        // fds and timers of a shared loop are only touched by its thread
+        bool ok = false;
+        loop->event_loop->RunSync([this, loop, &ok] {
+            ok = InitLoop(loop);
+            for (auto& timer : _pending_timers) {
+                loop->timers.Add(timer.delay_ms, timer.callback, timer.interval_ms);
+            }
+        });
+        if (!ok) {
+            return false;
+        }
+    }
+    if (_accept_balance != AcceptBalance::kReusePort && !InitAcceptor()) {
+        return false;
+    }
+    ERPC_LOG_INFO("EpollTcpServer Init success! loop_num=%u", _loop_num);
+
+    if (_shared_loops.empty()) {
+        for (auto& loop : _loops) {
+            // the implementation of one loop per thread: every loop runs on a thread of its own
+            if (!loop->event_loop->Start()) {
+                return false;
+            }
+        }
+    }
+    // accept only once the loops run
+    if (_acceptor && !_acceptor->event_loop->Start()) {
+        return false;
+    }
+
+    return true;
+}
+
+bool EpollTcpServer::InitAcceptor() {
+    _acceptor = std::make_shared<EpollAcceptor>();
+    _acceptor->server = this;
+    _acceptor->event_loop = std::make_shared<EventLoop>(_loop_num);
+    if (!_acceptor->event_loop->Init()) {
+        return false;
+    }
     int listenfd = CreateSocket();
     if (listenfd < 0) {
         return false;
     }
+    if (Listen(listenfd) < 0) {
+        ::close(listenfd);
+        return false;
+    }
+    _acceptor->listen_fd = listenfd;
+    // not running yet, so this thread may add
+    if (_acceptor->event_loop->Add(NewConnectionId(listenfd), EPOLLIN | EPOLLET, _acceptor.get()) < 0) {
+        ::close(listenfd);
+        _acceptor->listen_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool EpollTcpServer::InitLoop(const EpollLoopContextPtr& loop) {
+    if (_accept_balance != AcceptBalance::kReusePort) {
+        // the acceptor listens, this loop only gets connections from it
+        return true;
+    }
 
-    // set listen socket noblock
-    int mr = MakeSocketNonBlocking(listenfd);
-    if (mr < 0) {
+    // create socket and bind
+    int listenfd = CreateSocket();
+    if (listenfd < 0) {
         return false;
     }
 
     // call listen()
     int lr = Listen(listenfd);
     if (lr < 0) {
+        ::close(listenfd);
         return false;
     }
-    std::cout << "EpollTcpServer Init success!" << std::endl;
-    _listen_fd = listenfd;
+    loop->listen_fd = listenfd;
 
     // add listen socket to epoll instance, and focus on event EPOLLIN and EPOLLOUT, actually EPOLLIN is enough
-    int er = UpdateEpollEvents(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, EPOLLIN | EPOLLET);
+    int er = loop->event_loop->Add(NewConnectionId(loop->listen_fd), EPOLLIN | EPOLLET, loop.get());
     if (er < 0) {
         // if something goes wrong, close listen socket and return false
-        ::close(_listen_fd);
+        ::close(loop->listen_fd);
+        loop->listen_fd = -1;
         return false;
     }
+    return true;
+}
 
-    assert(!_thread_loop);
-
-    // the implementation of one loop per thread: create a thread to loop epoll
-    _thread_loop = std::make_shared<std::thread>(&EpollTcpServer::EpollLoop, this);
-    if (!_thread_loop) {
-        return false;
+void EpollTcpServer::ReleaseLoop(const EpollLoopContextPtr& loop) {
+    if (loop->listen_fd >= 0) {
+        loop->event_loop->Remove(loop->listen_fd);
+        ::close(loop->listen_fd);
+        loop->listen_fd = -1;
     }
-    // detach the thread(using loop_flag_ to control the start/stop of loop)
-    _thread_loop->detach();
-
-    return true;
+    for (int32_t fd : loop->connections.Fds()) {
+        CloseConnection(loop, fd);
+    }
+    loop->pending_conns.clear();
+    loop->held_conns.clear();
+    loop->ready_conns.clear();
+    loop->timers.CancelAll();
+    loop->watermark_timer = kInvalidTimerId;
+    // a flush or send still queued on a shared loop finds no server
+    loop->server = nullptr;
 }
 
 bool EpollTcpServer::Stop() {
-    // set loop_flag_ false to stop epoll loop
-    _loop_flag = false;
-    ::close(_listen_fd);
-    ::close(_epoll_fd);
-    std::cout << "stop epoll!" << std::endl;
-    UnRegisterOnRecvCallback();
+    if (!_loop_flag.exchange(false)) {
+        // stopped already(or by another thread right now)
+        return true;
+    }
+    if (_acceptor) {
+        // no new connection is handed to the loops from now on
+        _acceptor->event_loop->Stop();
+        if (_acceptor->listen_fd >= 0) {
+            _acceptor->event_loop->Remove(_acceptor->listen_fd);
+            ::close(_acceptor->listen_fd);
+            _acceptor->listen_fd = -1;
+        }
+    }
+    for (auto& loop : _loops) {
+        if (_shared_loops.empty()) {
+            // own loop: stop it first, then release on this thread
+            loop->event_loop->Stop();
+        }
+        loop->event_loop->RunSync([this, loop] { ReleaseLoop(loop); });
+    }
+    if (_transport != Transport::kTcp && !_loops.empty() && !_unix_path.empty() && _unix_path[0] != '@') {
+        // the socket file outlives the socket
+        ::unlink(_unix_path.c_str());
+    }
+    // the pool outlives the server: no recv callback runs on it from now on
+    _worker_tasks.Close();
+    ERPC_LOG_INFO("stop epoll!");
+    if (_recv_callback || _recv_view_callback) {
+        UnRegisterOnRecvCallback();
+    }
     return true;
 }
 
-int32_t EpollTcpServer::CreateEpoll() {
-    // the basic epoll api of create a epoll instance
-    int epollfd = epoll_create(kMaxEpollSize);
-    if (epollfd < 0) {
-        // if something goes wrong, return -1
-        std::cout << "epoll_create failed!" << std::endl;
-        return -1;
+int32_t EpollTcpServer::CreateSocket() {
+    if (_transport != Transport::kTcp) {
+        // same host only: a unix domain socket, none of the tcp options below apply
+        int listenfd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenfd < 0) {
+            ERPC_LOG_ERROR("create socket %s failed! errno=%d", _local_ip.c_str(), errno);
+            return -1;
+        }
+        if (BindUnix(listenfd) < 0) {
+            ::close(listenfd);
+            return -1;
+        }
+        ERPC_LOG_INFO("create and bind socket %s success!", _local_ip.c_str());
+        return listenfd;
     }
-    _epoll_fd = epollfd;
-    return epollfd;
-}
 
-int32_t EpollTcpServer::CreateSocket() {
-    // create tcp socket
-    int listenfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    // create non blocking tcp socket
+    int listenfd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (listenfd < 0) {
-        std::cout << "create socket "
-                  << _local_ip << ":" << _local_port << " failed!" << std::endl;
+        ERPC_LOG_ERROR("create socket %s:%u failed!", _local_ip.c_str(), _local_port);
         return -1;
     }
 
+    // a restarted server binds again while connections of the previous one are still in TIME_WAIT
+    int reuse = 1;
+    if (::setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+        ERPC_LOG_ERROR("setsockopt SO_REUSEADDR failed! errno=%d", errno);
+        ::close(listenfd);
+        return -1;
+    }
+
+    if (_loop_num > 1 && _accept_balance == AcceptBalance::kReusePort) {
+        // every loop binds the same ip:port, and the kernel balances new connections over these listen sockets
+        if (::setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+            ERPC_LOG_ERROR("setsockopt SO_REUSEPORT failed! errno=%d", errno);
+            ::close(listenfd);
+            return -1;
+        }
+    }
+
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
@@ -98,29 +306,55 @@ int32_t EpollTcpServer::CreateSocket() {
     // bind to local ip and local port
     int ret = ::bind(listenfd, (struct sockaddr*)&addr, sizeof(struct sockaddr));
     if (ret != 0) {
-        std::cout << "bind socket " << _local_ip << ":" << _local_port << " failed!" << std::endl;
+        ERPC_LOG_ERROR("bind socket %s:%u failed! errno=%d", _local_ip.c_str(), _local_port, errno);
         ::close(listenfd);
         return -1;
     }
 
-    std::cout << "create and bind socket " << _local_ip << ":" << _local_port << " success!" << std::endl;
+    if (_socket_busy_poll && SetSocketBusyPoll(listenfd) < 0) {
+        // e.g. EPERM without CAP_NET_ADMIN: do not try again for every connection
+        ERPC_LOG_WARN("setsockopt SO_BUSY_POLL failed, busy poll on the loops only! errno=%d", errno);
+        _socket_busy_poll = false;
+    }
+
+    if (_defer_accept_s > 0) {
+        // no wakeup for a connection which has not sent anything yet
+        int defer = static_cast<int>(_defer_accept_s);
+        if (::setsockopt(listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer)) < 0) {
+            ERPC_LOG_WARN("setsockopt TCP_DEFER_ACCEPT failed! errno=%d", errno);
+        }
+    }
+
+    ERPC_LOG_INFO("create and bind socket %s:%u success!", _local_ip.c_str(), _local_port);
     return listenfd;
 }
 
-// set noblock fd
-int32_t EpollTcpServer::MakeSocketNonBlocking(int32_t fd) {
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags < 0) {
-        std::cout << "fcntl failed!" << std::endl;
+int32_t EpollTcpServer::BindUnix(int32_t listenfd) {
+    struct sockaddr_un addr;
+    socklen_t len = MakeUnixAddress(_unix_path, &addr);
+    if (len == 0) {
+        ERPC_LOG_ERROR("bad unix socket path %s!", _local_ip.c_str());
         return -1;
     }
-
-    int ret = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-    if (ret < 0) {
-        std::cout << "fcntl failed!, ret=" << ret << std::endl;
+    if (_unix_path[0] != '@') {
+        // left behind by a server which did not stop cleanly, bind fails while it exists
+        ::unlink(_unix_path.c_str());
+    }
+    if (::bind(listenfd, (struct sockaddr*)&addr, len) != 0) {
+        ERPC_LOG_ERROR("bind socket %s failed! errno=%d", _local_ip.c_str(), errno);
         return -1;
     }
+    return 0;
+}
 
+int32_t EpollTcpServer::SetSocketBusyPoll(int32_t fd) {
+    int usec = static_cast<int>(_busy_poll_us);
+    if (::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) {
+        return -1;
+    }
+    // keep the device interrupts off while the loop polls(linux 5.11), older kernels just busy poll
+    int prefer = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
     return 0;
 }
 
@@ -128,204 +362,1097 @@ int32_t EpollTcpServer::MakeSocketNonBlocking(int32_t fd) {
 int32_t EpollTcpServer::Listen(int32_t listenfd) {
     int ret = ::listen(listenfd, SOMAXCONN);
     if ( ret < 0) {
-        std::cout << "listen failed!" << std::endl;
+        ERPC_LOG_ERROR("listen failed! errno=%d", errno);
         return -1;
     }
     return 0;
 }
 
-// add/modify/remove a item(socket/fd) in epoll instance(rbtree), for this example, just add a socket to epoll rbtree
-int32_t EpollTcpServer::UpdateEpollEvents(int epoll_fd, int op, int fd, int events) {
-    struct epoll_event ev;
-    memset(&ev, 0, sizeof(ev));
-    ev.events = events;
-    ev.data.fd = fd; // ev.data is a enum
-    fprintf(stdout,
-            "%s fd %d events read %d write %d\n",
-            op == EPOLL_CTL_MOD ? "mod" : "add",
-            fd,
-            ev.events & EPOLLIN,
-            ev.events & EPOLLOUT);
-    int ret = epoll_ctl(epoll_fd, op, fd, &ev);
-    if (ret < 0) {
-        std::cout << "epoll_ctl failed!" << std::endl;
-        return -1;
+// handle accept event
+void EpollTcpServer::OnSocketAccept(const EpollLoopContextPtr& loop) {
+    std::vector<int32_t> fds;
+    bool drained = AcceptConnections(loop->listen_fd, &fds);
+    for (int32_t fd : fds) {
+        AddConnection(loop, fd);
+    }
+    if (!drained) {
+        // epoll et mode does not tell again, go on after the events of the next iteration
+        EpollLoopContextPtr context = loop;
+        loop->event_loop->Yield([context] {
+            if (context->server && context->listen_fd >= 0) {
+                context->server->OnSocketAccept(context);
+            }
+        });
     }
-    return 0;
 }
 
-// handle accept event
-void EpollTcpServer::OnSocketAccept() {
-    // epoll working on et mode, must read all coming data, so use a while loop here
-    while (true) {
-        struct sockaddr_in in_addr;
+bool EpollTcpServer::AcceptConnections(int32_t listen_fd, std::vector<int32_t>* fds) {
+    // epoll working on et mode, must accept all coming connections, the batch only spreads them over iterations
+    while (_accept_batch == 0 || fds->size() < _accept_batch) {
+        struct sockaddr_storage in_addr;
         socklen_t in_len = sizeof(in_addr);
 
-        // accept a new connection and get a new socket
-        int client_fd = accept(_listen_fd, (struct sockaddr*)&in_addr, &in_len);
+        // accept a new connection and get a new non blocking socket, in one syscall
+        int client_fd = ::accept4(listen_fd, (struct sockaddr*)&in_addr, &in_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (client_fd == -1) {
             if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
                 // read all accept finished(epoll et mode only trigger one time,so must read all data in listen socket)
-                std::cout << "accept all coming connections!" << std::endl;
-                break;
-            } else {
-                std::cout << "accept error!" << std::endl;
+                ERPC_LOG_DEBUG("accept all coming connections!");
+                return true;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                // this one is gone, the next may be fine
                 continue;
             }
+            // e.g. EMFILE: retrying now would spin, wait for the next connection
+            ERPC_LOG_WARN("accept error! errno=%d", errno);
+            return true;
         }
+        ERPC_LOG_DEBUG("accept connection %d from %s", client_fd, in_addr.ss_family == AF_INET ?
+                       inet_ntoa(reinterpret_cast<struct sockaddr_in*>(&in_addr)->sin_addr) : _local_ip.c_str());
+        fds->push_back(client_fd);
+    }
+    return false;
+}
 
-        sockaddr_in peer;
-        socklen_t p_len = sizeof(peer);
-        // get client ip and port
-        int ret = getpeername(client_fd, (struct sockaddr*)&peer, &p_len);
-        if (ret < 0) {
-            std::cout << "getpeername error!" << std::endl;
-            continue;
-        }
-        std::cout << "accept connection from " << inet_ntoa(in_addr.sin_addr) << std::endl;
+void EpollTcpServer::AddConnection(const EpollLoopContextPtr& loop, int32_t fd) {
+    //  add this new socket to epoll instance, and focus on EPOLLIN and EPOLLRDHUP event
+    // the new socket belongs to this loop for its whole life
+    // epoll hands back fd and generation with every event, so a stale one never reaches a later connection
+    ConnectionId id = NewConnectionId(fd);
+    uint32_t events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    int er = loop->event_loop->Add(id, events, loop.get());
+    if (er < 0 ) {
+        // if something goes wrong, close this new socket
+        ::close(fd);
+        return;
+    }
 
-        int mr = MakeSocketNonBlocking(client_fd);
-        if (mr < 0) {
-            ::close(client_fd);
-            continue;
-        }
+    if (_socket_busy_poll) {
+        SetSocketBusyPoll(fd);
+    }
+
+    auto conn = std::make_shared<Connection>(loop->pool);
+    conn->fd = fd;
+    conn->id = id;
+    conn->events = events;
+    conn->last_active_ms = loop->event_loop->NowMs();
+    _owners.Set(fd, loop->index);
+    loop->connections.Insert(id, conn);
+    if (_idle_timeout_ms > 0) {
+        ArmIdleTimer(loop, conn, _idle_timeout_ms);
+    }
+    loop->metrics.Add(kMetricAccepted);
+    loop->metrics.Add(kMetricConnections);
+}
+
+void EpollTcpServer::OnAcceptorAccept() {
+    std::vector<int32_t> fds;
+    bool drained = AcceptConnections(_acceptor->listen_fd, &fds);
+    if (!fds.empty()) {
+        HandOff(fds);
+    }
+    if (!drained) {
+        // the acceptor loop stops before the server goes away
+        _acceptor->event_loop->Yield([this] {
+            if (_acceptor->listen_fd >= 0) {
+                OnAcceptorAccept();
+            }
+        });
+    }
+}
 
-        //  add this new socket to epoll instance, and focus on EPOLLIN and EPOLLOUT and EPOLLRDHUP event
-        int er = UpdateEpollEvents(_epoll_fd, EPOLL_CTL_ADD, client_fd, EPOLLIN | EPOLLRDHUP | EPOLLET);
-        if (er < 0 ) {
-            // if something goes wrong, close this new socket
-            ::close(client_fd);
+void EpollTcpServer::HandOff(const std::vector<int32_t>& fds) {
+    // one task per loop for the whole batch, so a storm costs a wakeup per loop instead of per connection
+    std::vector<std::vector<int32_t>> loop_fds(_loops.size());
+    std::vector<uint64_t> load;
+    if (_accept_balance == AcceptBalance::kLeastConnections) {
+        // the gauges lag behind the tasks still queued, count what this batch adds
+        load.resize(_loops.size());
+        for (size_t i = 0; i < _loops.size(); ++i) {
+            load[i] = _loops[i]->metrics.Get(kMetricConnections);
+        }
+    }
+    for (int32_t fd : fds) {
+        size_t index = 0;
+        if (_accept_balance == AcceptBalance::kLeastConnections) {
+            index = std::min_element(load.begin(), load.end()) - load.begin();
+            ++load[index];
+        } else {
+            index = _acceptor->next++ % _loops.size();
+        }
+        loop_fds[index].push_back(fd);
+    }
+    for (size_t i = 0; i < _loops.size(); ++i) {
+        if (loop_fds[i].empty()) {
             continue;
         }
+        EpollLoopContextPtr loop = _loops[i];
+        auto handed = std::make_shared<HandedFds>();
+        handed->fds.swap(loop_fds[i]);
+        loop->event_loop->Post([loop, handed] {
+            std::vector<int32_t> batch;
+            batch.swap(handed->fds);
+            for (int32_t fd : batch) {
+                if (loop->server) {
+                    loop->server->AddConnection(loop, fd);
+                } else {
+                    // the server stopped on a shared loop
+                    ::close(fd);
+                }
+            }
+        });
     }
 }
 
 // register a callback when packet received
 void EpollTcpServer::RegisterOnRecvCallback(callback_recv_t callback) {
-    assert(!_recv_callback);
+    assert(!_recv_callback && !_recv_view_callback);
     _recv_callback = callback;
 }
 
+void EpollTcpServer::RegisterOnRecvCallback(callback_recv_view_t callback) {
+    assert(!_recv_callback && !_recv_view_callback);
+    _recv_view_callback = callback;
+}
+
 void EpollTcpServer::UnRegisterOnRecvCallback() {
-    assert(_recv_callback);
+    assert(_recv_callback || _recv_view_callback);
     _recv_callback = nullptr;
+    _recv_view_callback = nullptr;
+}
+
+void EpollTcpServer::SetFrameCodec(FrameCodecType type) {
+    assert(_loops.empty());
+    _codec = FrameCodec(type);
+}
+
+MetricsSnapshot EpollTcpServer::Metrics() const {
+    MetricsSnapshot snapshot;
+    for (auto& loop : _loops) {
+        MetricValues values = loop->metrics.Snapshot();
+        loop->event_loop->MergeMetrics(&values);
+        snapshot.push_back(values);
+    }
+    return snapshot;
+}
+
+TimerId EpollTcpServer::RunAfter(uint32_t delay_ms, callback_timer_t callback) {
+    return AddTimer(delay_ms, 0, std::move(callback));
+}
+
+TimerId EpollTcpServer::RunEvery(uint32_t interval_ms, callback_timer_t callback) {
+    return AddTimer(interval_ms, interval_ms, std::move(callback));
+}
+
+TimerId EpollTcpServer::AddTimer(uint32_t delay_ms, uint32_t interval_ms, callback_timer_t callback) {
+    EpollLoopContext* loop = CurrentLoop();
+    if (loop) {
+        return loop->timers.Add(delay_ms, std::move(callback), interval_ms);
+    }
+    if (_loops.empty()) {
+        // not started yet, every loop gets one when it starts
+        PendingTimer timer;
+        timer.delay_ms = delay_ms;
+        timer.interval_ms = interval_ms;
+        timer.callback = std::move(callback);
+        _pending_timers.push_back(std::move(timer));
+        return kInvalidTimerId;
+    }
+    ERPC_LOG_ERROR("timer must be added in loop thread or before Start()!");
+    return kInvalidTimerId;
+}
+
+bool EpollTcpServer::CancelTimer(TimerId id) {
+    EpollLoopContext* loop = CurrentLoop();
+    if (!loop) {
+        ERPC_LOG_ERROR("timer must be cancelled in loop thread!");
+        return false;
+    }
+    return loop->timers.Cancel(id);
+}
+
+void EpollTcpServer::SetIdleTimeout(uint32_t idle_ms) {
+    assert(_loops.empty());
+    _idle_timeout_ms = idle_ms;
+}
+
+void EpollTcpServer::SetWorkerPool(const WorkerPoolPtr& workers) {
+    assert(_loops.empty());
+    _workers = workers;
+}
+
+bool EpollTcpServer::SetRpcService(const RpcServicePtr& service) {
+    assert(_loops.empty());
+    _service = service;
+    return true;
+}
+
+void EpollTcpServer::SetReadBudget(uint32_t bytes, uint32_t messages) {
+    assert(_loops.empty());
+    _read_budget_bytes = bytes;
+    _read_budget_messages = messages;
+}
+
+void EpollTcpServer::SetWatermarks(uint64_t high, uint64_t low) {
+    assert(_loops.empty());
+    _high_watermark = high;
+    _low_watermark = std::min(low, high);
+}
+
+void EpollTcpServer::SetGlobalWatermarks(uint64_t high, uint64_t low) {
+    assert(_loops.empty());
+    _global_high_watermark = high;
+    _global_low_watermark = std::min(low, high);
+}
+
+void EpollTcpServer::RegisterWatermarkCallback(callback_watermark_t callback) {
+    assert(_loops.empty());
+    _watermark_callback = callback;
+}
+
+void EpollTcpServer::SetAcceptBatch(uint32_t batch) {
+    assert(_loops.empty());
+    _accept_batch = batch;
+}
+
+void EpollTcpServer::SetDeferAccept(uint32_t seconds) {
+    assert(_loops.empty());
+    _defer_accept_s = seconds;
+}
+
+void EpollTcpServer::SetAcceptor(AcceptBalance balance) {
+    assert(_loops.empty());
+    _accept_balance = balance;
+}
+
+void EpollTcpServer::SetBusyPoll(uint32_t spin_us, bool sockets) {
+    assert(_loops.empty());
+    _busy_poll_us = spin_us;
+    _socket_busy_poll = sockets && spin_us > 0;
+}
+
+uint64_t EpollTcpServer::OutputBytes() const {
+    // the gauges of the loops, a few relaxed loads
+    uint64_t bytes = 0;
+    for (auto& loop : _loops) {
+        bytes += loop->metrics.Get(kMetricOutputBytes);
+    }
+    return bytes;
+}
+
+void EpollTcpServer::ArmIdleTimer(const EpollLoopContextPtr& loop, const ConnectionPtr& conn, uint64_t delay_ms) {
+    // the timer holds the connection id and loop index only, and is cancelled when the connection closes,
+    // so a later connection reusing the fd never sees it
+    uint32_t index = loop->index;
+    ConnectionId id = conn->id;
+    conn->idle_timer = loop->timers.Add(delay_ms, [this, index, id] { OnIdleTimer(_loops[index], id); });
+}
+
+void EpollTcpServer::OnIdleTimer(const EpollLoopContextPtr& loop, ConnectionId id) {
+    ConnectionPtr conn = loop->connections.Find(id);
+    if (!conn) {
+        return;
+    }
+    int32_t fd = conn->fd;
+    conn->idle_timer = kInvalidTimerId;
+    // activity only stamps the connection, the timer is moved here instead of on every read
+    uint64_t idle = loop->event_loop->NowMs() - conn->last_active_ms;
+    if (idle >= _idle_timeout_ms) {
+        ERPC_LOG_INFO("fd: %d idle for %lu ms, close it!", fd, static_cast<unsigned long>(idle));
+        CloseConnection(loop, fd);
+        return;
+    }
+    ArmIdleTimer(loop, conn, _idle_timeout_ms - idle);
 }
 
 // handle read events on fd
-void EpollTcpServer::OnSocketRead(int32_t fd) {
-    char read_buf[kMaxBufferSize];
-    bzero(read_buf, sizeof(read_buf));
+void EpollTcpServer::OnSocketRead(const EpollLoopContextPtr& loop, int32_t fd) {
+    ConnectionPtr conn = loop->connections.Get(fd);
+    if (!conn || conn->paused || conn->ready) {
+        // paused earlier in this batch, or read in its turn from the ready list after the other connections
+        return;
+    }
+    if (_transport == Transport::kShm && !conn->shm) {
+        // the first bytes of a shm connection are its hello, then it is read from the rings
+        int32_t ret = AcceptShm(loop, conn);
+        if (ret <= 0) {
+            if (ret < 0) {
+                CloseConnection(loop, fd);
+            }
+            return;
+        }
+    }
+    if (_global_paused.load(std::memory_order_relaxed)) {
+        // the server holds too many bytes already, what the peer sends stays in the socket for now
+        HoldRead(loop, conn);
+        return;
+    }
     int n = -1;
+    uint64_t bytes = 0;
+    uint64_t messages = 0;
 
-    // epoll working on et mode, must read all data
-    while ( (n = ::read(fd, read_buf, sizeof(read_buf))) > 0) {
-        // callback for recv
-        std::cout << "fd: " << fd <<  " recv: " << read_buf << std::endl;
-        std::string msg(read_buf, n);
-
-        // create a recv packet
-        PacketPtr data = std::make_shared<Packet>(fd, msg);
+    // epoll working on et mode, must read all data, but not all at once
+    while (true) {
+        if ((_read_budget_bytes > 0 && bytes >= _read_budget_bytes) ||
+            (_read_budget_messages > 0 && messages >= _read_budget_messages)) {
+            // used up its turn: the rest is read in the next iteration, after the other ready connections
+            QueueReady(loop, conn);
+            return;
+        }
+        // read straight into the input buffer of connection, after the bytes of a partial message
+        conn->input.EnsureWritable(kMaxBufferSize);
+        if (conn->shm) {
+            n = conn->shm->Read(conn->input.WritePtr(), conn->input.Writable());
+        } else {
+            n = ::read(fd, conn->input.WritePtr(), conn->input.Writable());
+        }
+        loop->metrics.Add(kMetricReadCalls);
+        if (n <= 0) {
+            break;
+        }
+        conn->input.HasWritten(n);
+        conn->last_active_ms = loop->event_loop->NowMs();
+        loop->metrics.Add(kMetricBytesRead, n);
+        bytes += n;
 
-        if (_recv_callback) {
-            // handle recv packet
-            _recv_callback(data);
+        // one read may carry many messages(pipelining), all of them are called back in place
+        int32_t count = DispatchMessages(loop, conn);
+        if (count < 0) {
+            ERPC_LOG_WARN("fd: %d bad frame, close it!", fd);
+            CloseConnection(loop, fd);
+            return;
+        }
+        messages += count;
+        if (conn->paused) {
+            // the replies went above the high watermark, the rest is read once they drained(EPOLLIN again)
+            return;
+        }
+        if (_global_high_watermark > 0 && OutputBytes() > _global_high_watermark) {
+            // the same for the whole server, a few relaxed loads per read()
+            CheckGlobalWatermark(loop);
+            HoldRead(loop, conn);
+            return;
         }
     }
 
     if (n == -1) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            // read all data finished
+            // read all data finished, an idle connection holds no receive block
+            loop->metrics.Add(kMetricReadEagain);
+            conn->input.Shrink();
             return;
         }
         // something goes wrong for this fd, should close it
-        ::close(fd);
+        CloseConnection(loop, fd);
         return;
     }
 
     if (n == 0) {
         // this may happen when client close socket. EPOLLRDHUP usually handle this, but just make sure; should close this fd
-        ::close(fd);
+        CloseConnection(loop, fd);
+        return;
+    }
+}
+
+int32_t EpollTcpServer::AcceptShm(const EpollLoopContextPtr& loop, const ConnectionPtr& conn) {
+    ShmChannelPtr shm;
+    int32_t ret = ShmChannel::Accept(conn->fd, &shm);
+    if (ret <= 0) {
+        return ret;
+    }
+    // the socket only tells when the peer is gone from now on, its wakeups come through the eventfd
+    uint32_t index = loop->index;
+    ConnectionId id = conn->id;
+    shm->SetWakeCallback([this, index, id] { OnShmWake(_loops[index], id); });
+    if (loop->event_loop->Add(NewConnectionId(shm->WakeFd()), EPOLLIN | EPOLLET, shm.get()) < 0) {
+        return -1;
+    }
+    conn->shm = shm;
+    return 1;
+}
+
+void EpollTcpServer::OnShmWake(const EpollLoopContextPtr& loop, ConnectionId id) {
+    ConnectionPtr conn = loop->connections.Find(id);
+    if (!conn) {
+        return;
+    }
+    // one eventfd for both directions: read what came, and write on if the peer made room
+    OnSocketRead(loop, conn->fd);
+    if (conn->fd >= 0 && conn->writing) {
+        OnSocketWrite(loop, conn->fd);
+    }
+}
+
+int32_t EpollTcpServer::DispatchMessages(const EpollLoopContextPtr& loop, const ConnectionPtr& conn) {
+    uint32_t header_size = 0;
+    uint32_t body_size = 0;
+    int32_t ret = 0;
+    uint32_t count = 0;
+    uint64_t begin = MetricsNowNs();
+    while ((ret = _codec.Decode(conn->input.Peek(), conn->input.Readable(), &header_size, &body_size)) > 0) {
+        const char* body = conn->input.Peek() + header_size;
+        ERPC_LOG_DEBUG("fd: %d recv: %.*s", conn->fd, static_cast<int>(body_size), body);
+
+        if (_service) {
+            // the response is written into the output buffer by the handler
+            RpcContext ctx;
+            ctx.fd = conn->fd;
+            ctx.conn_id = conn->id;
+            ctx.loop_index = loop->index;
+            if (body_size > 0 && IsRpcStreamMessage(static_cast<uint8_t>(body[0]))) {
+                // the streams queue what they send on their own
+                if (!conn->stream_transport) {
+                    auto transport = std::make_shared<EpollStreamTransport>();
+                    transport->loop = loop;
+                    transport->conn_id = conn->id;
+                    conn->stream_transport = transport;
+                }
+                _service->ServeStream(body, body_size, &ctx, &conn->streams, conn->stream_transport);
+                conn->input.Retrieve(header_size + body_size);
+            } else {
+                size_t queued = conn->output.Size();
+                bool served = _service->Serve(_codec, body, body_size, &ctx, &conn->output);
+                conn->input.Retrieve(header_size + body_size);
+                if (!served) {
+                    ERPC_LOG_WARN("fd: %d not a rpc request, close it!", conn->fd);
+                    return -1;
+                }
+                loop->metrics.Add(kMetricOutputBytes, conn->output.Size() - queued);
+                QueueFlush(loop.get(), conn);
+            }
+        } else if (_workers) {
+            // the view keeps the receive block alive until the worker is done with it
+            Packet data(conn->fd, conn->input.View(body, body_size));
+            data.conn_id = conn->id;
+            conn->input.Retrieve(header_size + body_size);
+            OffloadMessage(loop, data);
+        } else if (_recv_view_callback) {
+            // hand out the message in place, the view keeps the receive block alive
+            Packet data(conn->fd, conn->input.View(body, body_size));
+            data.conn_id = conn->id;
+            conn->input.Retrieve(header_size + body_size);
+            _recv_view_callback(data);
+        } else {
+            // create a recv packet
+            PacketPtr data = std::make_shared<Packet>(conn->fd, std::string(body, body_size));
+            data->conn_id = conn->id;
+            conn->input.Retrieve(header_size + body_size);
+            if (_recv_callback) {
+                // handle recv packet
+                _recv_callback(data);
+            }
+        }
+        ++count;
+    }
+    if (count > 0) {
+        loop->metrics.Add(kMetricCallbacks, count);
+        loop->metrics.Add(kMetricCallbackNs, MetricsNowNs() - begin);
+    }
+    return ret < 0 ? ret : count;
+}
+
+void EpollTcpServer::QueueReady(const EpollLoopContextPtr& loop, const ConnectionPtr& conn) {
+    conn->ready = true;
+    if (loop->ready_conns.empty()) {
+        // first one in this iteration, the loop looks for new events before coming back to them
+        EpollLoopContextPtr context = loop;
+        loop->event_loop->Yield([context] {
+            if (context->server) {
+                context->server->ReadReady(context);
+            }
+        });
+    }
+    loop->ready_conns.push_back(conn->id);
+}
+
+void EpollTcpServer::ReadReady(const EpollLoopContextPtr& loop) {
+    // every one gets another turn, those using it up again are queued for the next iteration
+    std::vector<ConnectionId> ready;
+    ready.swap(loop->ready_conns);
+    for (ConnectionId id : ready) {
+        ConnectionPtr conn = loop->connections.Find(id);
+        if (conn) {
+            conn->ready = false;
+            OnSocketRead(loop, conn->fd);
+        }
+    }
+}
+
+void EpollTcpServer::OffloadMessage(const EpollLoopContextPtr& loop, const Packet& data) {
+    uint32_t index = loop->index;
+    _worker_tasks.Submit(_workers, [this, index, data] {
+        // SendData() on this worker finds its way back to the loop and connection through this
+        WorkerContext saved = t_worker_context;
+        t_worker_context.owner = this;
+        t_worker_context.loop_index = index;
+        t_worker_context.fd = data.fd;
+        t_worker_context.conn_id = data.conn_id;
+        if (_recv_view_callback) {
+            _recv_view_callback(data);
+        } else if (_recv_callback) {
+            PacketPtr packet = std::make_shared<Packet>(data.fd, data.view.ToString());
+            packet->conn_id = data.conn_id;
+            _recv_callback(packet);
+        }
+        t_worker_context = saved;
+    });
+}
+
+// handle write events on fd: the socket accepts data again, go on writing the output buffer
+void EpollTcpServer::OnSocketWrite(const EpollLoopContextPtr& loop, int32_t fd) {
+    ConnectionPtr conn = loop->connections.Get(fd);
+    if (!conn) {
+        return;
+    }
+    ERPC_LOG_DEBUG("fd: %d writeable!", fd);
+    if (FlushConnection(loop, conn) < 0) {
+        CloseConnection(loop, fd);
+    }
+    CheckGlobalWatermark(loop);
+}
+
+int32_t EpollTcpServer::FlushConnection(const EpollLoopContextPtr& loop, const ConnectionPtr& conn) {
+    int32_t ret = WriteConnection(loop, conn);
+    if (ret < 0 || conn->fd < 0) {
+        // error, or closed by a SendFile() callback
+        return ret;
+    }
+    // resume reading if the output drained, and arm or disarm EPOLLOUT
+    CheckWatermarks(loop.get(), conn);
+    if (conn->fd >= 0) {
+        UpdateEvents(loop.get(), conn);
+    }
+    return 0;
+}
+
+int32_t EpollTcpServer::WriteConnection(const EpollLoopContextPtr& loop, const ConnectionPtr& conn) {
+    struct iovec iov[kMaxIovecs];
+    while (!conn->output.Empty() || !conn->files.empty()) {
+        size_t limit = conn->output.Size();
+        if (!conn->files.empty()) {
+            // bytes queued before the first file go out first, then the file itself
+            limit = conn->files.front().position - conn->output.Consumed();
+            if (limit == 0) {
+                int32_t ret = FlushFile(loop, conn);
+                if (ret <= 0) {
+                    return ret;
+                }
+                continue;
+            }
+        }
+        int32_t cnt = conn->output.PeekIovec(iov, kMaxIovecs, limit);
+        ssize_t ret = conn->shm ? conn->shm->Writev(iov, cnt) : ::writev(conn->fd, iov, cnt);
+        loop->metrics.Add(kMetricWriteCalls);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // socket send buffer is full, wait for EPOLLOUT to write the rest
+                WaitWritable(loop, conn);
+                return 0;
+            }
+            // error happend
+            ERPC_LOG_WARN("fd: %d write error, close it! errno=%d", conn->fd, errno);
+            return -1;
+        }
+        ERPC_LOG_DEBUG("fd: %d write size: %zd ok!", conn->fd, ret);
+        conn->output.Consume(ret);
+        conn->last_active_ms = loop->event_loop->NowMs();
+        loop->metrics.Add(kMetricBytesWritten, ret);
+        loop->metrics.Sub(kMetricOutputBytes, ret);
+    }
+
+    // all data sent, stop watching EPOLLOUT
+    conn->writing = false;
+    return 0;
+}
+
+int32_t EpollTcpServer::FlushFile(const EpollLoopContextPtr& loop, const ConnectionPtr& conn) {
+    FileSegment& file = conn->files.front();
+    while (file.left > 0) {
+        off_t offset = static_cast<off_t>(file.offset);
+        ssize_t ret = ::sendfile(conn->fd, file.file_fd, &offset, std::min<uint64_t>(file.left, kMaxSendFileSize));
+        loop->metrics.Add(kMetricWriteCalls);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                WaitWritable(loop, conn);
+                return 0;
+            }
+            ERPC_LOG_WARN("fd: %d sendfile error, close it! errno=%d", conn->fd, errno);
+            return -1;
+        }
+        if (ret == 0) {
+            // the file got shorter since queued, the message can not be completed
+            ERPC_LOG_WARN("fd: %d sendfile hit end of file %d, close it!", conn->fd, file.file_fd);
+            return -1;
+        }
+        file.offset += ret;
+        file.left -= ret;
+        file.sent += ret;
+        conn->file_bytes -= ret;
+        conn->last_active_ms = loop->event_loop->NowMs();
+        loop->metrics.Add(kMetricBytesWritten, ret);
+        loop->metrics.Sub(kMetricOutputBytes, ret);
+    }
+    FileSegment done = std::move(conn->files.front());
+    conn->files.pop_front();
+    if (done.done) {
+        done.done(done.sent, 0);
+        if (conn->fd < 0) {
+            // closed by the callback
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void EpollTcpServer::WaitWritable(const EpollLoopContextPtr& loop, const ConnectionPtr& conn) {
+    loop->metrics.Add(kMetricWriteEagain);
+    // EPOLLOUT is armed by UpdateEvents()
+    conn->writing = true;
+}
+
+void EpollTcpServer::UpdateEvents(EpollLoopContext* loop, const ConnectionPtr& conn) {
+    uint32_t events = EPOLLRDHUP | EPOLLET | (conn->paused ? 0u : static_cast<uint32_t>(EPOLLIN)) |
+                      (conn->writing ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    if (conn->shm) {
+        // the socket of a shm connection keeps watching EPOLLIN for the hangup, and the channel wakes it up for
+        // room to write. a read stopped at the watermark goes on in the next iteration: no wakeup comes for
+        // what is waiting in the ring already
+        if ((events & EPOLLIN) && !(conn->events & EPOLLIN) && !conn->ready) {
+            QueueReady(_loops[loop->index], conn);
+        }
+        conn->events = events;
+        return;
+    }
+    if (events != conn->events) {
+        // adding EPOLLIN back reports data already waiting in the socket
+        conn->events = events;
+        loop->event_loop->Modify(conn->id, events);
+    }
+}
+
+bool EpollTcpServer::CheckWatermarks(EpollLoopContext* loop, const ConnectionPtr& conn) {
+    if (_high_watermark == 0) {
+        return false;
+    }
+    uint64_t queued = conn->output.Size() + conn->file_bytes;
+    if (!conn->paused && queued > _high_watermark) {
+        // the peer sends faster than it takes the replies, stop reading it: its socket fills up and tcp flow
+        // control slows it down
+        conn->paused = true;
+        loop->metrics.Add(kMetricReadPauses);
+        ERPC_LOG_DEBUG("fd: %d %lu bytes queued, pause reading", conn->fd, static_cast<unsigned long>(queued));
+    } else if (conn->paused && queued <= _low_watermark) {
+        conn->paused = false;
+        ERPC_LOG_DEBUG("fd: %d %lu bytes queued, resume reading", conn->fd, static_cast<unsigned long>(queued));
+    } else {
+        return false;
+    }
+    if (_watermark_callback) {
+        _watermark_callback(conn->id, conn->paused);
+    }
+    return true;
+}
+
+void EpollTcpServer::CheckGlobalWatermark(const EpollLoopContextPtr& loop) {
+    if (_global_high_watermark == 0) {
+        return;
+    }
+    uint64_t queued = OutputBytes();
+    if (queued > _global_high_watermark) {
+        // whichever loop sees it first flips the flag, all loops see it on their next read
+        if (!_global_paused.exchange(true)) {
+            ERPC_LOG_INFO("%lu bytes queued in all connections, pause reading!", static_cast<unsigned long>(queued));
+            if (_watermark_callback) {
+                _watermark_callback(kInvalidConnectionId, true);
+            }
+        }
+        return;
+    }
+    if (queued <= _global_low_watermark && _global_paused.load(std::memory_order_relaxed) && _global_paused.exchange(false)) {
+        ERPC_LOG_INFO("%lu bytes queued in all connections, resume reading!", static_cast<unsigned long>(queued));
+        if (_watermark_callback) {
+            _watermark_callback(kInvalidConnectionId, false);
+        }
+    }
+    if (_global_paused.load(std::memory_order_relaxed) || loop->held_conns.empty()) {
+        return;
+    }
+    // read what came in while held, edge triggered epoll will not tell again
+    if (loop->watermark_timer != kInvalidTimerId) {
+        loop->timers.Cancel(loop->watermark_timer);
+        loop->watermark_timer = kInvalidTimerId;
+    }
+    std::vector<ConnectionId> held;
+    held.swap(loop->held_conns);
+    for (ConnectionId id : held) {
+        ConnectionPtr conn = loop->connections.Find(id);
+        if (conn) {
+            conn->held = false;
+            OnSocketRead(loop, conn->fd);
+        }
+    }
+}
+
+void EpollTcpServer::HoldRead(const EpollLoopContextPtr& loop, const ConnectionPtr& conn) {
+    if (!conn->held) {
+        conn->held = true;
+        loop->held_conns.push_back(conn->id);
+        loop->metrics.Add(kMetricReadPauses);
+    }
+    if (loop->watermark_timer == kInvalidTimerId) {
+        // other loops may be the ones draining, look again now and then
+        uint32_t index = loop->index;
+        loop->watermark_timer = loop->timers.Add(kWatermarkCheckMs, [this, index] {
+            CheckGlobalWatermark(_loops[index]);
+        }, kWatermarkCheckMs);
+    }
+}
+
+void EpollTcpServer::FlushPendingConnections(const EpollLoopContextPtr& loop) {
+    // swap out the list, nothing is queued while flushing but keep it safe against reentry
+    std::vector<ConnectionPtr> pending_conns;
+    pending_conns.swap(loop->pending_conns);
+    for (auto& conn : pending_conns) {
+        conn->pending = false;
+        if (conn->fd < 0) {
+            // closed after data queued
+            continue;
+        }
+        if (FlushConnection(loop, conn) < 0) {
+            CloseConnection(loop, conn->fd);
+        }
+    }
+    CheckGlobalWatermark(loop);
+}
+
+void EpollTcpServer::QueueFlush(EpollLoopContext* loop, const ConnectionPtr& conn) {
+    // more output: stop reading above the high watermark
+    if (CheckWatermarks(loop, conn) && conn->fd >= 0) {
+        UpdateEvents(loop, conn);
+    }
+    // if EPOLLOUT is armed, the data will be written when the socket is writable again
+    if (conn->writing || conn->pending) {
         return;
     }
+    conn->pending = true;
+    if (loop->pending_conns.empty()) {
+        // first one in this iteration
+        EpollLoopContextPtr context = _loops[loop->index];
+        loop->event_loop->Defer([context] {
+            if (context->server) {
+                context->server->FlushPendingConnections(context);
+            }
+        });
+    }
+    loop->pending_conns.push_back(conn);
+}
+
+void EpollTcpServer::CloseConnection(const EpollLoopContextPtr& loop, int32_t fd) {
+    ConnectionPtr conn = loop->connections.Get(fd);
+    if (conn) {
+        // unsent data is dropped, and a queued flush of this connection will be skipped
+        conn->fd = -1;
+        if (conn->idle_timer != kInvalidTimerId) {
+            loop->timers.Cancel(conn->idle_timer);
+        }
+        loop->metrics.Sub(kMetricOutputBytes, conn->output.Size());
+        loop->metrics.Add(kMetricClosed);
+        loop->metrics.Sub(kMetricConnections);
+        loop->connections.Erase(fd);
+        if (conn->shm) {
+            loop->event_loop->Remove(conn->shm->WakeFd());
+            conn->shm.reset();
+        }
+    }
+    // close fd and epoll will remove it
+    loop->event_loop->Remove(fd);
+    ::close(fd);
+
+    if (conn && !conn->files.empty()) {
+        // report the files not sent, after the connection is gone so that the callbacks see it closed
+        std::deque<FileSegment> files;
+        files.swap(conn->files);
+        for (auto& file : files) {
+            loop->metrics.Sub(kMetricOutputBytes, file.left);
+            if (file.done) {
+                file.done(file.sent, ECONNRESET);
+            }
+        }
+    }
+    if (conn) {
+        // the streams of the connection end, and writes to them fail from now on
+        conn->streams.AbortAll(kRpcConnectionClosed);
+    }
 }
 
-// handle write events on fd (usually happens when sending big files)
-void EpollTcpServer::OnSocketWrite(int32_t fd) {
-    // TODO(smaugx) not care for now
-    std::cout << "fd: " << fd << " writeable!" << std::endl;
+EpollLoopContextPtr EpollTcpServer::OwnerLoop(int32_t fd) const {
+    int32_t index = _owners.Get(fd);
+    if (index < 0 || static_cast<size_t>(index) >= _loops.size()) {
+        return nullptr;
+    }
+    return _loops[index];
+}
+
+EpollLoopContext* EpollTcpServer::CurrentLoop() const {
+    EventLoop* current = EventLoop::Current();
+    if (!current) {
+        return nullptr;
+    }
+    // own loops are indexed like the loops of this server, shared ones may not be
+    uint32_t index = current->Index();
+    if (index < _loops.size() && _loops[index]->event_loop.get() == current) {
+        return _loops[index].get();
+    }
+    for (auto& loop : _loops) {
+        if (loop->event_loop.get() == current) {
+            return loop.get();
+        }
+    }
+    // not a loop thread, or a loop thread of another server
+    return nullptr;
 }
 
 // send packet
 int32_t EpollTcpServer::SendData(const PacketPtr& data) {
-    if (data->fd == -1) {
+    return SendData(*data);
+}
+
+int32_t EpollTcpServer::SendData(const Packet& data) {
+    if (data.fd == -1 && data.conn_id == kInvalidConnectionId) {
         return -1;
     }
 
-    // send packet on fd
-    int ret = ::write(data->fd, data->msg.data(), data->msg.size());
-    if (ret == -1) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return -1;
+    EpollLoopContext* loop = CurrentLoop();
+    if (loop) {
+        return SendInLoop(loop, data, data.conn_id);
+    }
+
+    if (t_worker_context.owner == this) {
+        // in a callback running on a worker: hand the packet(and the receive block it may refer to) to the loop
+        uint32_t index = t_worker_context.loop_index;
+        ConnectionId id = data.conn_id;
+        if (id == kInvalidConnectionId && data.fd == t_worker_context.fd) {
+            // a packet made up by the callback, for the connection it was called for
+            id = t_worker_context.conn_id;
         }
-        // error happend
-        ::close(data->fd);
-        std::cout << "fd: " << data->fd << " write error, close it!" << std::endl;
+        Packet packet(data);
+        EpollLoopContextPtr context = _loops[index];
+        context->event_loop->Post([context, id, packet] {
+            if (context->server) {
+                context->server->SendInLoop(context.get(), packet, id);
+            }
+        });
+        return data.size();
+    }
+
+    // any other thread: the same through the loop owning the connection
+    EpollLoopContextPtr context = OwnerLoop(data.conn_id != kInvalidConnectionId ? ConnectionFd(data.conn_id) : data.fd);
+    if (!context) {
+        ERPC_LOG_ERROR("fd: %d SendData to no connection of this server!", data.fd);
         return -1;
     }
-    std::cout << "fd: " << data->fd << " write size: " << ret << " ok!" << std::endl;
-    return ret;
+    ConnectionId id = data.conn_id;
+    Packet packet(data);
+    context->event_loop->Post([context, id, packet] {
+        if (context->server) {
+            context->server->SendInLoop(context.get(), packet, id);
+        }
+    });
+    return data.size();
 }
 
-// one loop per thread, call epoll_wait and handle all coming events
-void EpollTcpServer::EpollLoop() {
-    // request some memory, if events ready, socket events will copy to this memory from kernel
-    struct epoll_event* alive_events = static_cast<epoll_event*>(calloc(kMaxEvents, sizeof(epoll_event)));
-    if (!alive_events) {
-        std::cout << "calloc memory failed for epoll_events!" << std::endl;
-        return;
+int32_t EpollTcpServer::SendInLoop(EpollLoopContext* loop, const Packet& data, ConnectionId id) {
+    ConnectionPtr conn = id != kInvalidConnectionId ? loop->connections.Find(id) : loop->connections.Get(data.fd);
+    if (!conn) {
+        // connection closed(maybe fd reused since), or not owned by this loop
+        return -1;
+    }
+    if (!_codec.Fits(data.size())) {
+        // the peer would take it for a bad frame and close the connection
+        ERPC_LOG_ERROR("fd: %d message of %zu bytes is over the max frame size!", conn->fd, data.size());
+        return -1;
     }
 
-    // if loop_flag_ is false, will exit this loop
-    while (_loop_flag) {
-        // call epoll_wait and return ready socket
-        int num = epoll_wait(_epoll_fd, alive_events, kMaxEvents, kEpollWaitTime);
-
-        for (int i = 0; i < num; ++i) {
-            // get fd
-            int fd = alive_events[i].data.fd;
-            // get events(readable/writeable/error)
-            int events = alive_events[i].events;
-
-            if ( (events & EPOLLERR) || (events & EPOLLHUP) ) {
-                std::cout << "epoll_wait error!" << std::endl;
-                // An error has occured on this fd, or the socket is not ready for reading (why were we notified then?).
-                ::close(fd);
-            } else  if (events & EPOLLRDHUP) {
-                // Stream socket peer closed connection, or shut down writing half of connection.
-                // more inportant, We still to handle disconnection when read()/recv() return 0 or -1 just to be sure.
-                std::cout << "fd: " << fd << " closed EPOLLRDHUP!" << std::endl;
-                // close fd and epoll will remove it
-                ::close(fd);
-            } else if ( events & EPOLLIN ) {
-                std::cout << "epollin" << std::endl;
-                if (fd == _listen_fd) {
-                    // listen fd coming connections
-                    OnSocketAccept();
-                } else {
-                    // other fd read event coming, meaning data coming
-                    OnSocketRead(fd);
-                }
-            } else if ( events & EPOLLOUT ) {
-                std::cout << "epollout" << std::endl;
-                // write event for fd (not including listen-fd), meaning send buffer is available for big files
-                OnSocketWrite(fd);
+    char header[kMaxFrameHeaderSize];
+    uint32_t header_size = _codec.EncodeHeader(data.size(), header);
+    conn->output.Append(header, header_size);
+    conn->output.Append(data.data(), data.size());
+    loop->metrics.Add(kMetricOutputBytes, header_size + data.size());
+    QueueFlush(loop, conn);
+    return data.size();
+}
+
+int32_t EpollTcpServer::SendInPlace(ConnectionId conn, callback_fill_t fill) {
+    EpollLoopContext* loop = CurrentLoop();
+    if (loop) {
+        return SendInPlaceInLoop(loop, conn, fill);
+    }
+
+    // fill runs on the loop, the output buffer is not to be touched by a worker(or any other thread)
+    EpollLoopContextPtr context =
+        t_worker_context.owner == this ? _loops[t_worker_context.loop_index] : OwnerLoop(ConnectionFd(conn));
+    if (!context) {
+        ERPC_LOG_ERROR("fd: %d SendInPlace to no connection of this server!", ConnectionFd(conn));
+        return -1;
+    }
+    context->event_loop->Post([context, conn, fill] {
+        if (context->server) {
+            context->server->SendInPlaceInLoop(context.get(), conn, fill);
+        }
+    });
+    return 0;
+}
+
+int32_t EpollTcpServer::SendInPlaceInLoop(EpollLoopContext* loop, ConnectionId id, const callback_fill_t& fill) {
+    ConnectionPtr conn = loop->connections.Find(id);
+    if (!conn) {
+        return -1;
+    }
+
+    // the length is known only once filled: reserve the longest frame header, put the real one at its end and
+    // drop the unused front, like RpcService::Serve()
+    OutputMark mark = conn->output.Reserve(kMaxFrameHeaderSize);
+    size_t begin = conn->output.Size();
+    fill(&conn->output);
+    size_t size = conn->output.Size() - begin;
+    if (!_codec.Fits(size)) {
+        // the peer would take it for a bad frame and close the connection
+        conn->output.Truncate(begin - kMaxFrameHeaderSize);
+        ERPC_LOG_ERROR("fd: %d message of %zu bytes is over the max frame size!", conn->fd, size);
+        return -1;
+    }
+
+    char header[kMaxFrameHeaderSize];
+    uint32_t header_size = _codec.EncodeHeader(size, header);
+    uint32_t unused = kMaxFrameHeaderSize - header_size;
+    memcpy(conn->output.At(mark) + unused, header, header_size);
+    if (unused > 0) {
+        conn->output.Erase(mark, unused);
+    }
+    loop->metrics.Add(kMetricOutputBytes, header_size + size);
+    QueueFlush(loop, conn);
+    return 0;
+}
+
+int32_t EpollTcpServer::SendStreamInLoop(EpollLoopContext* loop, ConnectionId id, const RpcHeader& header,
+                                         const char* body, size_t size) {
+    ConnectionPtr conn = loop->connections.Find(id);
+    if (!conn || !_codec.Fits(kRpcHeaderSize + size)) {
+        return -1;
+    }
+    char headers[kMaxFrameHeaderSize + kRpcHeaderSize];
+    uint32_t header_size = _codec.EncodeHeader(kRpcHeaderSize + size, headers);
+    EncodeRpcHeader(header, headers + header_size);
+    conn->output.Append(headers, header_size + kRpcHeaderSize);
+    conn->output.Append(body, size);
+    loop->metrics.Add(kMetricOutputBytes, header_size + kRpcHeaderSize + size);
+    QueueFlush(loop, conn);
+    return 0;
+}
+
+int32_t EpollTcpServer::SendFile(ConnectionId conn, int32_t file_fd, uint64_t offset, uint64_t len,
+                                 callback_sendfile_t done) {
+    // sendfile() needs a file it can map from the page cache
+    struct stat st;
+    if (::fstat(file_fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        ERPC_LOG_ERROR("fd: %d SendFile needs a regular file! errno=%d", file_fd, errno);
+        return -1;
+    }
+    if (offset + len > static_cast<uint64_t>(st.st_size) || offset + len < offset) {
+        ERPC_LOG_ERROR("fd: %d SendFile range %lu+%lu beyond file size %ld!", file_fd,
+                       static_cast<unsigned long>(offset), static_cast<unsigned long>(len), static_cast<long>(st.st_size));
+        return -1;
+    }
+    if (!_codec.Fits(len)) {
+        // the peer would take it for a bad frame
+        ERPC_LOG_ERROR("fd: %d SendFile of %lu bytes exceeds the max frame size!", file_fd, static_cast<unsigned long>(len));
+        return -1;
+    }
+
+    EpollLoopContext* loop = CurrentLoop();
+    if (loop) {
+        return SendFileInLoop(loop, conn, file_fd, offset, len, done);
+    }
+
+    // on a worker or any other thread, same as SendData(). a connection closed meanwhile is reported to done
+    EpollLoopContextPtr context =
+        t_worker_context.owner == this ? _loops[t_worker_context.loop_index] : OwnerLoop(ConnectionFd(conn));
+    if (!context) {
+        ERPC_LOG_ERROR("fd: %d SendFile to no connection of this server!", ConnectionFd(conn));
+        return -1;
+    }
+    context->event_loop->Post([context, conn, file_fd, offset, len, done] {
+        if ((!context->server || context->server->SendFileInLoop(context.get(), conn, file_fd, offset, len, done) < 0) && done) {
+            done(0, ENOTCONN);
+        }
+    });
+    return 0;
+}
+
+int32_t EpollTcpServer::SendFileInLoop(EpollLoopContext* loop, ConnectionId id, int32_t file_fd, uint64_t offset,
+                                       uint64_t len, const callback_sendfile_t& done) {
+    ConnectionPtr conn = loop->connections.Find(id);
+    if (!conn) {
+        return -1;
+    }
+    if (conn->shm) {
+        // no socket to sendfile() to, the bytes would have to be copied into the rings anyway
+        ERPC_LOG_ERROR("fd: %d SendFile is not supported over shm!", conn->fd);
+        return -1;
+    }
+    char header[kMaxFrameHeaderSize];
+    uint32_t header_size = _codec.EncodeHeader(len, header);
+    conn->output.Append(header, header_size);
+
+    FileSegment file;
+    file.file_fd = file_fd;
+    file.offset = offset;
+    file.left = len;
+    file.position = conn->output.Consumed() + conn->output.Size();
+    file.done = done;
+    conn->files.push_back(std::move(file));
+    conn->file_bytes += len;
+    loop->metrics.Add(kMetricOutputBytes, header_size + len);
+    QueueFlush(loop, conn);
+    return 0;
+}
+
+void EpollTcpServer::OnLoopEvents(const EpollLoopContextPtr& loop, int32_t fd, uint32_t events) {
+    if ( (events & EPOLLERR) || (events & EPOLLHUP) ) {
+        ERPC_LOG_DEBUG("fd: %d epoll_wait error!", fd);
+        // An error has occured on this fd, or the socket is not ready for reading (why were we notified then?).
+        CloseConnection(loop, fd);
+    } else  if (events & EPOLLRDHUP) {
+        // Stream socket peer closed connection, or shut down writing half of connection.
+        // more inportant, We still to handle disconnection when read()/recv() return 0 or -1 just to be sure.
+        ERPC_LOG_DEBUG("fd: %d closed EPOLLRDHUP!", fd);
+        CloseConnection(loop, fd);
+    } else if (events & (EPOLLIN | EPOLLOUT)) {
+        if (events & EPOLLIN) {
+            ERPC_LOG_DEBUG("fd: %d epollin", fd);
+            if (fd == loop->listen_fd) {
+                // listen fd coming connections
+                OnSocketAccept(loop);
             } else {
-                std::cout << "unknow epoll event!" << std::endl;
+                // other fd read event coming, meaning data coming
+                OnSocketRead(loop, fd);
             }
-        } // end for (int i = 0; ...
-    } // end while (loop_flag_)
-
-    free(alive_events);
+        }
+        if (events & EPOLLOUT) {
+            ERPC_LOG_DEBUG("fd: %d epollout", fd);
+            // write event for fd (not including listen-fd), meaning send buffer is available again
+            OnSocketWrite(loop, fd);
+        }
+    } else {
+        ERPC_LOG_WARN("fd: %d unknow epoll event %d!", fd, events);
+    }
 }
 
 } // namespace erpc
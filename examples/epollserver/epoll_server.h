@@ -1,69 +1,156 @@
+#pragma once
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <cstring>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <cassert>
 
+#include <atomic>
 #include <iostream>
 #include <string>
 #include <thread>
 #include <memory>
 #include <functional>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+
+#include "epoll_tcp_base.h"
+#include "event_loop.h"
+#include "frame_codec.h"
+#include "input_buffer.h"
+#include "logger.h"
+#include "output_buffer.h"
+#include "shm_channel.h"
+#include "unix_socket.h"
 
 namespace erpc {
 
-static const uint32_t kMaxBufferSize = 4096; // max buffer size
-static const uint32_t kMaxEpollSize = 100; // max epoll size
-static const uint32_t kEpollWaitTime = 10; // epoll wait timeout 10 ms
-static const uint32_t kMaxEvents = 100;    // epoll wait return max size
+static const uint32_t kDefaultLoopNum = 1; // default number of epoll loops(0 means one loop per cpu core)
+static const uint32_t kMaxSendFileSize = 1 << 20; // max bytes of one sendfile(), so one big file does not hog the loop
 
-// packet of send/recv binary content
-typedef struct Packet {
-public:
-    Packet()
-        : msg { "" } {}
-    Packet(const std::string& msg)
-        : msg { msg } {}
-    Packet(int fd, const std::string& msg)
-        : fd(fd),
-          msg(msg) {}
+static const uint64_t kDefaultHighWatermark = 4 * 1024 * 1024; // output bytes of a connection which stop its reading
+static const uint64_t kDefaultLowWatermark = 1024 * 1024;      // output bytes of a paused connection resuming it
+static const uint32_t kDefaultReadBudgetBytes = 64 * 1024; // bytes read from a connection per turn
+static const uint32_t kDefaultReadBudgetMessages = 256;     // messages dispatched from a connection per turn
+static const uint32_t kWatermarkCheckMs = 10; // a loop holding back reads checks the global watermark this often
+static const uint32_t kDefaultAcceptBatch = 64; // connections accepted per wakeup before serving the others
 
-    int fd { -1 };     // meaning socket
-    std::string msg;   // real binary content
-} Packet;
+// how the acceptor thread(SetAcceptor()) picks the loop of a new connection
+enum class AcceptBalance : uint8_t {
+    kReusePort        = 0, // no acceptor: every loop listens with SO_REUSEPORT and the kernel picks(default)
+    kRoundRobin       = 1, // the loops in turn
+    kLeastConnections = 2, // the loop with fewest connections
+};
 
-typedef std::shared_ptr<Packet> PacketPtr;
+// a connection crossed its output watermark(conn is kInvalidConnectionId for the global one), on a loop thread:
+// high is true when reading stopped, false when it resumed
+using callback_watermark_t = std::function<void(ConnectionId conn, bool high)>;
 
-// callback when packet received
-using callback_recv_t = std::function<void(const PacketPtr& data)>;
+// completion of SendFile(), on the loop thread: error is 0 when all bytes went out, otherwise an errno(e.g.
+// ECONNRESET if the connection closed first) and sent tells how far it got
+using callback_sendfile_t = std::function<void(uint64_t sent, int32_t error)>;
 
-// base class of EpollTcpServer, focus on Start(), Stop(), SendData(), RegisterOnRecvCallback()...
-class EpollTcpBase {
-public:
-    EpollTcpBase()                                     = default;
-    EpollTcpBase(const EpollTcpBase& other)            = delete;
-    EpollTcpBase& operator=(const EpollTcpBase& other) = delete;
-    EpollTcpBase(EpollTcpBase&& other)                 = delete;
-    EpollTcpBase& operator=(EpollTcpBase&& other)      = delete;
-    virtual ~EpollTcpBase()                            = default;
+// writes one message straight into the output buffer of a connection, e.g. with a WireBuilder(wire_schema.h)
+using callback_fill_t = std::function<void(OutputBuffer* output)>;
 
-public:
-    virtual bool Start() = 0;
-    virtual bool Stop()  = 0;
-    virtual int32_t SendData(const PacketPtr& data) = 0;
-    virtual void RegisterOnRecvCallback(callback_recv_t callback) = 0;
-    virtual void UnRegisterOnRecvCallback() = 0;
-};
+// a file range queued on a connection, written with sendfile() straight from the page cache
+typedef struct FileSegment {
+    int32_t file_fd { -1 };   // owned by the caller, open until done is called
+    uint64_t offset { 0 };    // next byte of the file to send
+    uint64_t left { 0 };      // bytes not sent yet
+    uint64_t sent { 0 };      // bytes sent
+    uint64_t position { 0 };  // output stream position it starts at: everything queued before goes out first
+    callback_sendfile_t done { nullptr };
+} FileSegment;
+
+// state of one accepted connection, only touched by the loop which accepted it
+typedef struct Connection {
+    explicit Connection(const BufferPoolPtr& pool)
+        : input(pool) {}
+
+    int32_t fd { -1 };       // socket, -1 after closed
+    ConnectionId id { kInvalidConnectionId }; // fd and generation, tells it from a later connection on fd
+    bool writing { false };  // EPOLLOUT is armed, waiting for the socket to be writable again
+    bool pending { false };  // in the flush list of its loop
+    bool paused { false };   // not read, its output is above the high watermark
+    bool held { false };     // in the held list of its loop, a read waits for the global watermark
+    bool ready { false };    // in the ready list of its loop, used up its read budget before EAGAIN
+    uint32_t events { 0 };   // events watched on epoll now
+    InputBuffer input;       // received bytes not forming a complete message yet
+    OutputBuffer output;     // unsent bytes
+    std::deque<FileSegment> files; // file ranges queued between the bytes of output, in order
+    uint64_t file_bytes { 0 };     // bytes of files not sent yet
+    uint64_t last_active_ms { 0 };           // last time bytes were read or written
+    TimerId idle_timer { kInvalidTimerId };  // checks last_active_ms when idle timeout is set
+    ShmChannelPtr shm { nullptr };           // shm transport: the bytes go through its rings, not the socket
+    RpcStreamTable streams;                  // rpc streams multiplexed on the connection
+    RpcStreamTransportPtr stream_transport { nullptr }; // how they reach it, made for the first stream
+} Connection;
 
-using ETBase = EpollTcpBase;
+typedef std::shared_ptr<Connection> ConnectionPtr;
 
-typedef std::shared_ptr<ETBase> ETBasePtr;
+class EpollTcpServer;
+
+// one reactor of EpollTcpServer: a listen socket and the connections accepted from it, on an EventLoop.
+// every loop binds the same ip:port with SO_REUSEPORT, so the kernel spreads new connections over the loops,
+// and a connection is handled end to end(accept, read, callback, write) by the loop which accepted it
+typedef struct EpollLoopContext : public EventHandler {
+    // hand the events of the listen socket and connections to the server
+    void OnEvents(int32_t fd, uint32_t events) override;
+
+    uint32_t index { 0 };     // index of this loop
+    int32_t listen_fd { -1 }; // listen fd of this loop
+    EpollTcpServer* server { nullptr }; // nullptr after the server stopped, for tasks still queued on a shared loop
+    EventLoopPtr event_loop { nullptr }; // the reactor, owned by the server or shared with others
+    BufferPoolPtr pool { BufferPool::Create() }; // receive buffers of connections of this loop
+    ConnectionTable<Connection> connections; // connections accepted by this loop, indexed by fd
+    std::vector<ConnectionPtr> pending_conns; // connections with data queued in this iteration, flushed at its end
+    std::vector<ConnectionId> ready_conns; // connections to read again in the next iteration, in order
+    std::vector<ConnectionId> held_conns; // connections not read while the server is above its global watermark
+    TimerId watermark_timer { kInvalidTimerId }; // checks the global watermark while held_conns is not empty
+    LoopMetrics metrics; // written by this loop only, loop wide counters are in event_loop
+    LoopTimers timers; // timers of the server on this loop
+} EpollLoopContext;
+
+typedef std::shared_ptr<EpollLoopContext> EpollLoopContextPtr;
+
+// how the rpc streams of one connection reach it: their messages are queued in its output buffer like SendData()
+typedef struct EpollStreamTransport : public RpcStreamTransport {
+    bool Send(const RpcHeader& header, const char* body, size_t size) override;
+    void RunInLoop(task_t task) override;
+    bool InLoopThread() const override;
+    void Forget(uint64_t id) override;
+
+    std::weak_ptr<EpollLoopContext> loop; // loop of the connection, not kept alive by streams held by the application
+    ConnectionId conn_id { kInvalidConnectionId };
+} EpollStreamTransport;
+
+// the dedicated accept thread of SetAcceptor(): one listen socket on a loop of its own, which hands the
+// connections it accepts to the loops of the server
+typedef struct EpollAcceptor : public EventHandler {
+    // hand the events of the listen socket to the server
+    void OnEvents(int32_t fd, uint32_t events) override;
+
+    int32_t listen_fd { -1 };
+    EpollTcpServer* server { nullptr };
+    EventLoopPtr event_loop { nullptr }; // always owned by the server
+    uint32_t next { 0 }; // next loop for kRoundRobin
+} EpollAcceptor;
+
+typedef std::shared_ptr<EpollAcceptor> EpollAcceptorPtr;
 
 // the implementation of Epoll Tcp Server
 class EpollTcpServer : public ETBase {
@@ -75,49 +162,216 @@ public:
     EpollTcpServer& operator=(EpollTcpServer&& other)      = delete;
     ~EpollTcpServer() override;
 
-    // the local ip and port of tcp server
-    EpollTcpServer(const std::string& local_ip, uint16_t local_port);
+    // the local ip and port of tcp server, and the number of epoll loops(threads) serving it.
+    // loop_num == 0 means one loop per cpu core. local_ip "unix:/path" listens on a unix domain socket instead,
+    // and "shm:/path" too, but every client hands over shared memory rings there to talk through(see
+    // shm_channel.h); the port is ignored then, and the clients must use the same address
+    EpollTcpServer(const std::string& local_ip, uint16_t local_port, uint32_t loop_num = kDefaultLoopNum);
+    // serve on loops shared with others(e.g. clients), one listen socket per loop. the loops are started and
+    // stopped by their owner, the server only adds and removes its fds and timers
+    EpollTcpServer(const std::string& local_ip, uint16_t local_port, const std::vector<EventLoopPtr>& loops);
 
 public:
     // start tcp server
     bool Start() override;
     // stop tcp server
     bool Stop() override;
-    // send packet
+    // send packet: queue it in the output buffer of the connection, all data queued during one loop iteration
+    // is written with one writev(), the rest waits for EPOLLOUT. any thread: on the loop owning the connection
+    // (i.e. inside the recv callback) it is queued at once, from a worker or any other thread it is posted to that
+    // loop, and dropped there if the connection closed meanwhile; return the size queued(or posted) or -1
     int32_t SendData(const PacketPtr& data) override;
-    // register a callback when packet received
+    int32_t SendData(const Packet& data) override;
+    // send len bytes of file_fd from offset(a regular file, its own offset is not moved) on connection conn
+    // as one message, without copying them to user space: sendfile() as the socket takes them, driven by EPOLLOUT.
+    // the file goes out after everything queued on conn before, and what is queued after waits for it; with a
+    // length prefix codec it gets the frame header of a len(up to kMaxFrameSize) bytes message. done reports completion on the loop,
+    // keep file_fd open until then. same threads as SendData(); return 0 if queued, -1 otherwise(done not called)
+    int32_t SendFile(ConnectionId conn, int32_t file_fd, uint64_t offset, uint64_t len, callback_sendfile_t done = nullptr);
+    // send one message built in place: fill appends it to the output buffer of conn(on the loop owning conn), and
+    // the frame header is put in front of it afterwards, so it is never built elsewhere and copied. fill must only
+    // append, and is not called if conn is closed. same threads as SendData(); return 0 if queued(or handed to
+    // the loop from another thread), -1 otherwise
+    int32_t SendInPlace(ConnectionId conn, callback_fill_t fill);
+    // register a callback when packet received.
+    // the callback always runs on the loop thread owning the connection, so with more than one loop
+    // it may be called from several threads at the same time(but never concurrently for one fd)
     void RegisterOnRecvCallback(callback_recv_t callback) override;
+    // zero copy version: the packet refers to the pooled receive buffer instead of a copy in a new PacketPtr
+    void RegisterOnRecvCallback(callback_recv_view_t callback) override;
     void UnRegisterOnRecvCallback() override;
+    // set how the tcp stream is cut into messages(raw by default), must be called before Start().
+    // with a length prefix codec, the recv callback gets exactly one complete message per packet,
+    // and SendData() adds the header to every packet
+    void SetFrameCodec(FrameCodecType type) override;
+    // counters and gauges of every loop, index is the loop index
+    MetricsSnapshot Metrics() const override;
+    // timers on the current loop, see EpollTcpBase
+    TimerId RunAfter(uint32_t delay_ms, callback_timer_t callback) override;
+    TimerId RunEvery(uint32_t interval_ms, callback_timer_t callback) override;
+    bool CancelTimer(TimerId id) override;
+    // close connections idle for idle_ms, must be called before Start()
+    void SetIdleTimeout(uint32_t idle_ms) override;
+    // run recv callbacks on workers, must be called before Start(). Stop() drops the ones not started and waits for
+    // the others
+    void SetWorkerPool(const WorkerPoolPtr& workers) override;
+    // dispatch every message to a method of service, must be called before Start()
+    bool SetRpcService(const RpcServicePtr& service) override;
+    // read at most bytes or messages(checked between reads, 0 means no limit) from a connection before going on
+    // with the other ready ones; the rest is read in the next iteration, which does not wait in epoll_wait. keeps
+    // one bulk sender from starving the small requests of others. 64KB/256 by default, call before Start()
+    void SetReadBudget(uint32_t bytes, uint32_t messages);
+    // stop reading a connection once more than high bytes(replies and files) wait to be written to it, and go on
+    // when they are down to low. 0 means no limit. 4MB/1MB by default, must be called before Start()
+    void SetWatermarks(uint64_t high, uint64_t low);
+    // the same for the bytes waiting in all connections of the server, e.g. to bound its memory: above high no
+    // connection is read until the total is down to low. 0(default) means no limit, must be called before Start()
+    void SetGlobalWatermarks(uint64_t high, uint64_t low);
+    // called when reading stops or resumes for a watermark, must be called before Start()
+    void RegisterWatermarkCallback(callback_watermark_t callback);
+    // bytes waiting to be written in all connections, any thread
+    uint64_t OutputBytes() const;
+    // accept at most batch connections per wakeup(0 means no limit), the rest in the next iteration, so a
+    // connection storm does not starve the connections already served. 64 by default, call before Start()
+    void SetAcceptBatch(uint32_t batch);
+    // TCP_DEFER_ACCEPT: wake up for a connection only when its first bytes came, or after about seconds.
+    // 0(default) means off, must be called before Start()
+    void SetDeferAccept(uint32_t seconds);
+    // accept on a thread of its own instead of every loop, and hand the connections to the loops by balance:
+    // one listen socket, and the loops only serve. kReusePort(default) turns it off, call before Start()
+    void SetAcceptor(AcceptBalance balance);
+    // busy poll the loops of the server for spin_us after events(EventLoop::SetBusyPoll(), shared loops are set
+    // by their owner), and with sockets true also set SO_BUSY_POLL(spin_us) and SO_PREFER_BUSY_POLL on the
+    // sockets, which may need CAP_NET_ADMIN. 0(default) means off, call before Start()
+    void SetBusyPoll(uint32_t spin_us, bool sockets = false);
 
 protected:
-    // create epoll instance using epoll_create and return a fd of epoll
-    int32_t CreateEpoll();
-    // create a socket fd using api socket()
+    friend struct EpollLoopContext;
+    friend struct EpollAcceptor;
+    friend struct EpollStreamTransport;
+
+    // create a non blocking socket fd using api socket(), with SO_REUSEPORT when more than one loop listens
     int32_t CreateSocket();
-    // set socket noblock
-    int32_t MakeSocketNonBlocking(int32_t fd);
+    // bind a unix domain socket to the path of a local transport, return -1 on error
+    int32_t BindUnix(int32_t listenfd);
     // listen()
     int32_t Listen(int32_t listenfd);
-    // add/modify/remove a item(socket/fd) in epoll instance(rbtree), for this example, just add a socket to epoll rbtree
-    int32_t UpdateEpollEvents(int efd, int op, int fd, int events);
+    // SO_BUSY_POLL and SO_PREFER_BUSY_POLL on a socket, return -1 if refused
+    int32_t SetSocketBusyPoll(int32_t fd);
+    // create the listen socket of one loop and watch it, on the loop thread
+    bool InitLoop(const EpollLoopContextPtr& loop);
+    // close the listen socket and connections of one loop and cancel its timers, on the loop thread
+    void ReleaseLoop(const EpollLoopContextPtr& loop);
+    // events of the listen socket or a connection of loop are ready
+    void OnLoopEvents(const EpollLoopContextPtr& loop, int32_t fd, uint32_t events);
 
     // handle tcp accept event
-    void OnSocketAccept();
+    void OnSocketAccept(const EpollLoopContextPtr& loop);
+    // accept4() from listen_fd into fds up to the accept batch, return false if more may be waiting
+    bool AcceptConnections(int32_t listen_fd, std::vector<int32_t>* fds);
+    // watch a new connection fd on loop, closing it on failure
+    void AddConnection(const EpollLoopContextPtr& loop, int32_t fd);
+    // create the listen socket of the acceptor and watch it
+    bool InitAcceptor();
+    // handle tcp accept event of the acceptor, on its thread
+    void OnAcceptorAccept();
+    // hand fds accepted by the acceptor to the loops by the accept balance
+    void HandOff(const std::vector<int32_t>& fds);
     // handle tcp socket readable event(read())
-    void OnSocketRead(int32_t fd);
+    void OnSocketRead(const EpollLoopContextPtr& loop, int32_t fd);
+    // take the shm hello of connection and watch the wakeups of its channel, return 1 when done, 0 if the hello
+    // did not come yet, -1 on error
+    int32_t AcceptShm(const EpollLoopContextPtr& loop, const ConnectionPtr& conn);
+    // the peer of a shm connection wrote or made room
+    void OnShmWake(const EpollLoopContextPtr& loop, ConnectionId id);
+    // cut the input buffer of connection into messages and call back for each one, return the number of
+    // messages, -1 on a bad frame
+    int32_t DispatchMessages(const EpollLoopContextPtr& loop, const ConnectionPtr& conn);
+    // put connection on the ready list of loop, read again in the next iteration
+    void QueueReady(const EpollLoopContextPtr& loop, const ConnectionPtr& conn);
+    // give every connection on the ready list of loop another turn
+    void ReadReady(const EpollLoopContextPtr& loop);
     // handle tcp socket writeable event(write())
-    void OnSocketWrite(int32_t fd);
-    // one loop per thread, call epoll_wait and return ready socket(accept,readable,writeable,error...)
-    void EpollLoop();
+    void OnSocketWrite(const EpollLoopContextPtr& loop, int32_t fd);
+    // writev() the output buffer and sendfile() the files of connection until all sent or EAGAIN(then arm
+    // EPOLLOUT), return -1 on error
+    int32_t FlushConnection(const EpollLoopContextPtr& loop, const ConnectionPtr& conn);
+    // sendfile() the first file of connection, return 1 when done, 0 on EAGAIN(or closed by done), -1 on error
+    int32_t FlushFile(const EpollLoopContextPtr& loop, const ConnectionPtr& conn);
+    // writev()/sendfile() for FlushConnection(), return 0 when all sent or EAGAIN, -1 on error
+    int32_t WriteConnection(const EpollLoopContextPtr& loop, const ConnectionPtr& conn);
+    // the socket buffer of connection is full, watch EPOLLOUT
+    void WaitWritable(const EpollLoopContextPtr& loop, const ConnectionPtr& conn);
+    // epoll_ctl() the events of connection if its state(writing, paused) changed them
+    void UpdateEvents(EpollLoopContext* loop, const ConnectionPtr& conn);
+    // pause or resume reading connection by its output bytes, return whether it changed
+    bool CheckWatermarks(EpollLoopContext* loop, const ConnectionPtr& conn);
+    // pause or resume reading the whole server by its output bytes, and read the held connections of loop again
+    // when below
+    void CheckGlobalWatermark(const EpollLoopContextPtr& loop);
+    // do not read connection until the server is below its global watermark
+    void HoldRead(const EpollLoopContextPtr& loop, const ConnectionPtr& conn);
+    // flush all connections which queued data in this loop iteration
+    void FlushPendingConnections(const EpollLoopContextPtr& loop);
+    // add conn to the flush list of loop, flushed at the end of this iteration
+    void QueueFlush(EpollLoopContext* loop, const ConnectionPtr& conn);
+    // close connection and release its state
+    void CloseConnection(const EpollLoopContextPtr& loop, int32_t fd);
+    // add a timer on the current loop, or on every loop before Start()
+    TimerId AddTimer(uint32_t delay_ms, uint32_t interval_ms, callback_timer_t callback);
+    // idle timer of connection id fired: close it if nothing happened since, otherwise check again later
+    void OnIdleTimer(const EpollLoopContextPtr& loop, ConnectionId id);
+    // arm the idle timer of connection to fire after delay_ms
+    void ArmIdleTimer(const EpollLoopContextPtr& loop, const ConnectionPtr& conn, uint64_t delay_ms);
+    // run the recv callback of a message on a worker
+    void OffloadMessage(const EpollLoopContextPtr& loop, const Packet& data);
+    // queue data on connection id of loop, or on whatever connection is on data.fd if id is invalid
+    int32_t SendInLoop(EpollLoopContext* loop, const Packet& data, ConnectionId id);
+    // build a message with fill on connection id of loop
+    int32_t SendInPlaceInLoop(EpollLoopContext* loop, ConnectionId id, const callback_fill_t& fill);
+    // queue a message of a rpc stream on connection id of loop
+    int32_t SendStreamInLoop(EpollLoopContext* loop, ConnectionId id, const RpcHeader& header, const char* body,
+                             size_t size);
+    // queue a file range on connection id of loop
+    int32_t SendFileInLoop(EpollLoopContext* loop, ConnectionId id, int32_t file_fd, uint64_t offset, uint64_t len,
+                           const callback_sendfile_t& done);
+    // the loop of this server which is running on current thread, nullptr if called outside of loops
+    EpollLoopContext* CurrentLoop() const;
+    // the loop which had the last connection on fd, nullptr if none. any thread
+    EpollLoopContextPtr OwnerLoop(int32_t fd) const;
 
 private:
     std::string _local_ip; // tcp local ip
     uint16_t _local_port { 0 }; // tcp bind local port
-    int32_t _listen_fd { -1 }; // listen fd
-    int32_t _epoll_fd { -1 }; // epoll fd
-    std::shared_ptr<std::thread> _thread_loop { nullptr }; // one loop per thread(call epoll_wait in loop)
-    bool _loop_flag { true }; // if loop_flag_ is false, then exit the epoll loop
+    std::string _unix_path; // unix socket path of a local transport
+    Transport _transport { Transport::kTcp }; // tcp, or a local transport told by _local_ip(sets _unix_path)
+    uint32_t _loop_num { kDefaultLoopNum }; // number of epoll loops
+    std::vector<EpollLoopContextPtr> _loops; // all epoll loops, one thread per loop
+    std::vector<EventLoopPtr> _shared_loops; // loops given by the user, the server creates its own if empty
+    ConnectionOwners _owners; // loop index of the connection on every fd, for sends from other threads
+    std::atomic<bool> _loop_flag { true }; // false once stopped, Stop() may race with the destructor or itself
     callback_recv_t _recv_callback { nullptr }; // callback when received
+    callback_recv_view_t _recv_view_callback { nullptr }; // zero copy callback when received
+    FrameCodec _codec; // message framing of tcp stream
+    uint32_t _idle_timeout_ms { 0 }; // close connections idle that long, 0 means never
+    std::vector<PendingTimer> _pending_timers; // timers given before Start(), added to every loop
+    WorkerPoolPtr _workers { nullptr }; // runs recv callbacks off the loops if set
+    WorkerTasks _worker_tasks;           // the callbacks given to _workers, closed by Stop()
+    RpcServicePtr _service { nullptr }; // rpc methods, instead of the recv callback if set
+    uint32_t _read_budget_bytes { kDefaultReadBudgetBytes }; // bytes read from a connection per turn, 0 means all
+    uint32_t _read_budget_messages { kDefaultReadBudgetMessages }; // messages per turn, 0 means no limit
+    uint64_t _high_watermark { kDefaultHighWatermark }; // output bytes of a connection pausing its reading
+    uint64_t _low_watermark { kDefaultLowWatermark };   // output bytes of a connection resuming it
+    uint64_t _global_high_watermark { 0 }; // output bytes of the server pausing all reading, 0 means no limit
+    uint64_t _global_low_watermark { 0 };  // output bytes of the server resuming it
+    std::atomic<bool> _global_paused { false }; // above the global watermark, set and cleared by any loop
+    callback_watermark_t _watermark_callback { nullptr }; // told when reading stops or resumes
+    uint32_t _accept_batch { kDefaultAcceptBatch }; // connections accepted per wakeup, 0 means no limit
+    uint32_t _defer_accept_s { 0 }; // TCP_DEFER_ACCEPT of the listen sockets, 0 means off
+    AcceptBalance _accept_balance { AcceptBalance::kReusePort }; // accept on the loops or hand off by acceptor
+    EpollAcceptorPtr _acceptor { nullptr }; // the accept thread, if _accept_balance is not kReusePort
+    uint32_t _busy_poll_us { 0 }; // spin window of the own loops, 0 means off
+    bool _socket_busy_poll { false }; // SO_BUSY_POLL on the sockets too, cleared if the kernel refuses
 };
 
 } // namespace erpc
@@ -1,10 +1,29 @@
-#include "epoll_server.h"
+#include "uring_server.h"
 
 using namespace erpc;
 
+// request and response of the method "sum", see wire_schema.h
+struct SumRequest : public WireSchema<WireArray<int64_t>> {
+    typedef Field<0> Values;
+};
+
+struct SumResponse : public WireSchema<int64_t, uint32_t> {
+    typedef Field<0> Sum;
+    typedef Field<1> Count;
+};
+
 int main(int argc, char* argv[]) {
     std::string local_ip {"127.0.0.1"};
     uint16_t local_port { 6666 };
+    uint32_t loop_num { 1 };
+    std::string codec { "raw" };
+    std::string backend { "epoll" };
+    uint16_t metrics_port { 0 };
+    uint32_t idle_timeout_ms { 0 };
+    int32_t worker_num { -1 };
+    std::string mode { "echo" };
+    std::string accept { "reuseport" };
+    uint32_t busy_poll_us { 0 };
 
     if (argc >= 2) {
         local_ip = std::string(argv[1]);
@@ -14,29 +33,194 @@ int main(int argc, char* argv[]) {
         local_port = std::atoi(argv[2]);
     }
 
-    // create a epoll tcp server
-    auto epoll_server = std::make_shared<EpollTcpServer>(local_ip, local_port);
+    if (argc >= 4) {
+        // number of epoll loops(threads), 0 means one loop per cpu core
+        loop_num = std::atoi(argv[3]);
+    }
+
+    if (argc >= 5) {
+        // message framing: raw, fixed32 or varint
+        codec = std::string(argv[4]);
+    }
+
+    if (argc >= 6) {
+        // event backend: epoll or uring(falls back to epoll if the kernel can not)
+        backend = std::string(argv[5]);
+    }
+
+    if (argc >= 7) {
+        // serve a text dump of loop metrics on this port, 0 means off
+        metrics_port = std::atoi(argv[6]);
+    }
+
+    if (argc >= 8) {
+        // close connections idle for this many milliseconds, 0 means never
+        idle_timeout_ms = std::atoi(argv[7]);
+    }
+
+    if (argc >= 9) {
+        // run callbacks on this many worker threads(0 means one per cpu core), -1 means on the loops
+        worker_num = std::atoi(argv[8]);
+    }
+
+    if (argc >= 10) {
+        // echo: echo every message back, rpc: serve the methods "echo", "reverse", "sum" and the stream "count"(epoll
+        // backend), file: reply the content of the file named by every message(epoll backend)
+        mode = std::string(argv[9]);
+    }
+
+    if (argc >= 11) {
+        // reuseport: every loop accepts, roundrobin or least: an acceptor thread hands connections to the loops
+        // in turn, or to the one with fewest connections(epoll backend)
+        accept = std::string(argv[10]);
+    }
+
+    if (argc >= 12) {
+        // busy poll the loops for this many microseconds after events, 0 means off(epoll backend)
+        busy_poll_us = std::atoi(argv[11]);
+    }
+
+    // create a tcp server on the chosen backend
+    ETBasePtr epoll_server = CreateTcpServer(local_ip, local_port, TcpBackendFromString(backend), loop_num);
     if (!epoll_server) {
-        std::cout << "tcp_server create faield!" << std::endl;
+        ERPC_LOG_ERROR("tcp_server create faield!");
         exit(-1);
     }
 
-    // recv callback in lambda mode, you can set your own callback here
-    auto recv_call = [&](const PacketPtr& data) -> void {
+    // recv callback in lambda mode, you can set your own callback here.
+    // zero copy: data refers to the receive buffer of server, no malloc from read() to here
+    auto recv_call = [&](const Packet& data) -> void {
         // just echo packet
         epoll_server->SendData(data);
         return;
     };
 
-    // register recv callback to epoll tcp server
-    epoll_server->RegisterOnRecvCallback(recv_call);
+    // cut tcp stream into messages, echo back every complete message
+    epoll_server->SetFrameCodec(FrameCodecTypeFromString(codec));
+
+    // reap idle connections
+    epoll_server->SetIdleTimeout(idle_timeout_ms);
+
+    if (accept != "reuseport" || busy_poll_us > 0) {
+        auto server = std::dynamic_pointer_cast<EpollTcpServer>(epoll_server);
+        if (!server) {
+            ERPC_LOG_ERROR("acceptor and busy poll need the epoll backend!");
+            exit(-1);
+        }
+        if (accept != "reuseport") {
+            server->SetAcceptor(accept == "least" ? AcceptBalance::kLeastConnections : AcceptBalance::kRoundRobin);
+        }
+        server->SetBusyPoll(busy_poll_us, true);
+    }
+
+    // offload callbacks to workers
+    WorkerPoolPtr workers;
+    if (worker_num >= 0) {
+        workers = std::make_shared<WorkerPool>(worker_num);
+        workers->Start();
+        epoll_server->SetWorkerPool(workers);
+    }
+
+    if (mode == "rpc") {
+        // the handlers write their response straight into the output buffer of the connection
+        auto service = std::make_shared<RpcService>();
+        service->Register("echo", [](const RpcContext& /*ctx*/, const char* request, size_t size, RpcWriter* response) {
+            response->Append(request, size);
+            return static_cast<uint16_t>(kRpcOk);
+        });
+        service->Register("reverse", [](const RpcContext& /*ctx*/, const char* request, size_t size, RpcWriter* response) {
+            std::string reversed(request, size);
+            std::reverse(reversed.begin(), reversed.end());
+            response->Append(reversed);
+            return static_cast<uint16_t>(kRpcOk);
+        });
+        // read in place from the request, built in place into the response
+        service->RegisterWire<SumRequest, SumResponse>("sum", [](const RpcContext& /*ctx*/,
+                                                                 const WireReader<SumRequest>& request,
+                                                                 WireBuilder<SumResponse>* response) {
+            WireArray<int64_t> values = request.Get<SumRequest::Values>();
+            int64_t sum = 0;
+            for (uint32_t i = 0; i < values.size(); ++i) {
+                sum += values[i];
+            }
+            response->Set<SumResponse::Sum>(sum);
+            response->Set<SumResponse::Count>(values.size());
+            return static_cast<uint16_t>(kRpcOk);
+        });
+        // server streaming: the first message is a count, the reply is that many records, as fast as the client
+        // takes them and no faster
+        service->RegisterStream("count", [](const RpcContext& /*ctx*/, const RpcStreamPtr& stream) {
+            auto left = std::make_shared<uint64_t>(0);
+            std::weak_ptr<RpcStream> weak = stream;
+            auto produce = [weak, left] {
+                RpcStreamPtr stream = weak.lock();
+                while (stream && *left > 0 && stream->Writable()) {
+                    stream->Write("record " + std::to_string((*left)--));
+                }
+                if (stream && *left == 0) {
+                    stream->Close();
+                }
+            };
+            RpcStreamCallbacks callbacks;
+            callbacks.on_message = [left, produce](const char* data, size_t size) {
+                if (*left == 0) {
+                    *left = std::strtoull(std::string(data, size).c_str(), nullptr, 10);
+                    produce();
+                }
+            };
+            callbacks.on_writable = produce;
+            stream->SetCallbacks(callbacks);
+        });
+        epoll_server->SetRpcService(service);
+    } else if (mode == "file") {
+        auto server = std::dynamic_pointer_cast<EpollTcpServer>(epoll_server);
+        if (!server) {
+            ERPC_LOG_ERROR("file mode needs the epoll backend!");
+            exit(-1);
+        }
+        // the file goes from the page cache to the socket by sendfile(), closed when sent(or the connection lost)
+        epoll_server->RegisterOnRecvCallback([server](const Packet& data) {
+            std::string path(data.data(), data.size());
+            int32_t file_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (file_fd < 0 || ::fstat(file_fd, &st) < 0 ||
+                server->SendFile(data.conn_id, file_fd, 0, st.st_size, [file_fd](uint64_t sent, int32_t error) {
+                    ERPC_LOG_DEBUG("file %d sent %lu bytes, error=%d", file_fd, static_cast<unsigned long>(sent), error);
+                    ::close(file_fd);
+                }) < 0) {
+                ERPC_LOG_WARN("can not send file %s!", path.c_str());
+                if (file_fd >= 0) {
+                    ::close(file_fd);
+                }
+                // an empty reply tells the client
+                Packet reply;
+                reply.fd = data.fd;
+                reply.conn_id = data.conn_id;
+                server->SendData(reply);
+            }
+        });
+    } else {
+        // register recv callback to epoll tcp server
+        epoll_server->RegisterOnRecvCallback(recv_call);
+    }
 
     // start the epoll tcp server
     if (!epoll_server->Start()) {
-        std::cout << "tcp_server start failed!" << std::endl;
+        ERPC_LOG_ERROR("tcp_server start failed!");
         exit(1);
     }
-    std::cout << "############tcp_server started!################" << std::endl;
+    ERPC_LOG_INFO("############tcp_server started!################");
+
+    MetricsEndpointPtr metrics_endpoint;
+    if (metrics_port != 0) {
+        // curl local_ip:metrics_port/metrics
+        metrics_endpoint = std::make_shared<MetricsEndpoint>(local_ip, metrics_port, [&] {
+            return MetricsToText("erpc_server", epoll_server->Metrics());
+        });
+        if (!metrics_endpoint->Start()) {
+            exit(1);
+        }
+    }
 
     // block here
     while (true) {
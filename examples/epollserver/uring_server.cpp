@@ -0,0 +1,992 @@
+#include "uring_server.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <time.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// multishot recv is the newest feature used(linux 6.0), older headers build the epoll fallback only
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define ERPC_HAVE_IO_URING 1
+#endif
+
+namespace erpc {
+
+ETBasePtr CreateTcpServer(const std::string& local_ip, uint16_t local_port, TcpBackend backend, uint32_t loop_num) {
+    if (backend == TcpBackend::kUring) {
+        if (ParseTransport(local_ip) != Transport::kTcp) {
+            ERPC_LOG_WARN("io_uring backend serves tcp only, %s falls back to epoll!", local_ip.c_str());
+        } else if (UringTcpServer::Supported()) {
+            return std::make_shared<UringTcpServer>(local_ip, local_port, loop_num);
+        } else {
+            ERPC_LOG_WARN("io_uring not supported, fall back to epoll!");
+        }
+    }
+    return std::make_shared<EpollTcpServer>(local_ip, local_port, loop_num);
+}
+
+TcpBackend TcpBackendFromString(const std::string& name) {
+    if (name == "uring") {
+        return TcpBackend::kUring;
+    }
+    return TcpBackend::kEpoll;
+}
+
+#ifdef ERPC_HAVE_IO_URING
+
+// operation of a submission, kept in the high bits of user_data, the fd in the low bits
+enum UringOp : uint64_t {
+    kUringOpAccept = 1,
+    kUringOpRecv   = 2,
+    kUringOpSend   = 3,
+    kUringOpWakeup = 4,
+};
+
+static const uint16_t kUringBufferGroup = 0; // buffer group id of provided recv buffers
+
+static inline uint64_t EncodeUserData(UringOp op, int32_t fd) {
+    return (static_cast<uint64_t>(op) << 32) | static_cast<uint32_t>(fd);
+}
+
+// a minimal io_uring: mmaped submission/completion queues and one ring of provided recv buffers
+class IoUring {
+public:
+    IoUring()                                = default;
+    IoUring(const IoUring& other)            = delete;
+    IoUring& operator=(const IoUring& other) = delete;
+    ~IoUring() {
+        if (_buf_ring) {
+            munmap(_buf_ring, _buf_ring_size);
+        }
+        free(_buffers);
+        if (_sqes) {
+            munmap(_sqes, _sqes_size);
+        }
+        if (_cq_ptr && _cq_ptr != _sq_ptr) {
+            munmap(_cq_ptr, _cq_ring_size);
+        }
+        if (_sq_ptr) {
+            munmap(_sq_ptr, _sq_ring_size);
+        }
+        if (_ring_fd >= 0) {
+            ::close(_ring_fd);
+        }
+    }
+
+public:
+    // create the ring and map its queues
+    bool Init(uint32_t entries) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        _ring_fd = static_cast<int32_t>(syscall(__NR_io_uring_setup, entries, &params));
+        if (_ring_fd < 0) {
+            return false;
+        }
+        if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+            // need a timeout on io_uring_enter and no dropped completions
+            return false;
+        }
+
+        _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+        }
+        _sq_ptr = mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       _ring_fd, IORING_OFF_SQ_RING);
+        if (_sq_ptr == MAP_FAILED) {
+            _sq_ptr = nullptr;
+            return false;
+        }
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            _cq_ptr = _sq_ptr;
+        } else {
+            _cq_ptr = mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           _ring_fd, IORING_OFF_CQ_RING);
+            if (_cq_ptr == MAP_FAILED) {
+                _cq_ptr = nullptr;
+                return false;
+            }
+        }
+        _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          _ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+        _sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+        char* sq = static_cast<char*>(_sq_ptr);
+        _sq_head = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+        _sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+        _sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        _sq_entries = params.sq_entries;
+        uint32_t* sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+        for (uint32_t i = 0; i < _sq_entries; ++i) {
+            // sqe i is always at slot i
+            sq_array[i] = i;
+        }
+        _sqe_tail = *_sq_tail;
+        _sqe_submitted = _sqe_tail;
+
+        char* cq = static_cast<char*>(_cq_ptr);
+        _cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+        _cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+        _cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // register count buffers of size bytes as the provided buffer ring of recv
+    bool InitRecvBuffers(uint32_t count, uint32_t size) {
+        _buf_count = count;
+        _buf_size = size;
+        _buf_ring_size = count * sizeof(struct io_uring_buf);
+        void* ring = mmap(nullptr, _buf_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (ring == MAP_FAILED) {
+            return false;
+        }
+        _buf_ring = static_cast<struct io_uring_buf_ring*>(ring);
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(_buf_ring);
+        reg.ring_entries = count;
+        reg.bgid = kUringBufferGroup;
+        if (syscall(__NR_io_uring_register, _ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            return false;
+        }
+
+        _buffers = static_cast<char*>(malloc(static_cast<size_t>(count) * size));
+        if (!_buffers) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            RecycleBuffer(static_cast<uint16_t>(i));
+        }
+        return true;
+    }
+
+    // a free sqe(zeroed), nullptr if the submission queue is full even after submitting
+    struct io_uring_sqe* GetSqe() {
+        uint32_t head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+        if (_sqe_tail - head >= _sq_entries) {
+            Submit(0, 0);
+            head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+            if (_sqe_tail - head >= _sq_entries) {
+                return nullptr;
+            }
+        }
+        struct io_uring_sqe* sqe = &_sqes[_sqe_tail & _sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        ++_sqe_tail;
+        return sqe;
+    }
+
+    // submit queued sqes, and wait for at least wait_nr completions up to timeout_ms(< 0 means no timeout)
+    int32_t Submit(uint32_t wait_nr, int64_t timeout_ms) {
+        __atomic_store_n(_sq_tail, _sqe_tail, __ATOMIC_RELEASE);
+        uint32_t to_submit = _sqe_tail - _sqe_submitted;
+        _sqe_submitted = _sqe_tail;
+
+        uint32_t flags = 0;
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        if (wait_nr > 0) {
+            if (timeout_ms >= 0) {
+                ts.tv_sec = timeout_ms / 1000;
+                ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+                arg.ts = reinterpret_cast<uint64_t>(&ts);
+            }
+            flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        }
+        int ret = static_cast<int>(syscall(__NR_io_uring_enter, _ring_fd, to_submit, wait_nr, flags,
+                                           wait_nr > 0 ? &arg : nullptr, sizeof(arg)));
+        if (ret < 0 && (errno == ETIME || errno == EINTR || errno == EBUSY)) {
+            // timeout, signal, or completion queue overflowed: just go on reaping
+            return 0;
+        }
+        return ret;
+    }
+
+    // call handler(user_data, res, flags) for every completion
+    template <typename Handler>
+    uint32_t ForEachCompletion(Handler handler) {
+        uint32_t head = *_cq_head;
+        uint32_t tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        uint32_t count = 0;
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &_cqes[head & _cq_mask];
+            handler(cqe->user_data, cqe->res, cqe->flags);
+            ++head;
+            ++count;
+            // give back the slot before handling more, so handler may queue new sqes freely
+            __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+            if (head == tail) {
+                tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+            }
+        }
+        return count;
+    }
+
+    // memory of provided buffer bid
+    const char* Buffer(uint16_t bid) const {
+        return _buffers + static_cast<size_t>(bid) * _buf_size;
+    }
+
+    // hand provided buffer bid back to the kernel
+    void RecycleBuffer(uint16_t bid) {
+        // entries start at the ring itself(tail overlays resv of entry 0). not through bufs[]: the header declares it
+        // behind an empty struct, which takes room in c++
+        struct io_uring_buf* bufs = reinterpret_cast<struct io_uring_buf*>(_buf_ring);
+        struct io_uring_buf* buf = &bufs[_buf_tail & (_buf_count - 1)];
+        buf->addr = reinterpret_cast<uint64_t>(Buffer(bid));
+        buf->len = _buf_size;
+        buf->bid = bid;
+        ++_buf_tail;
+        __atomic_store_n(&_buf_ring->tail, _buf_tail, __ATOMIC_RELEASE);
+    }
+
+private:
+    int32_t _ring_fd { -1 };
+    void* _sq_ptr { nullptr };
+    void* _cq_ptr { nullptr };
+    size_t _sq_ring_size { 0 };
+    size_t _cq_ring_size { 0 };
+    size_t _sqes_size { 0 };
+    struct io_uring_sqe* _sqes { nullptr };
+    uint32_t* _sq_head { nullptr };
+    uint32_t* _sq_tail { nullptr };
+    uint32_t _sq_mask { 0 };
+    uint32_t _sq_entries { 0 };
+    uint32_t _sqe_tail { 0 };      // next sqe to fill
+    uint32_t _sqe_submitted { 0 }; // sqes before this are submitted
+    uint32_t* _cq_head { nullptr };
+    uint32_t* _cq_tail { nullptr };
+    uint32_t _cq_mask { 0 };
+    struct io_uring_cqe* _cqes { nullptr };
+    struct io_uring_buf_ring* _buf_ring { nullptr };
+    size_t _buf_ring_size { 0 };
+    char* _buffers { nullptr };
+    uint32_t _buf_count { 0 };
+    uint32_t _buf_size { 0 };
+    uint16_t _buf_tail { 0 };
+};
+
+// the loop running on current thread
+static thread_local UringLoopContext* t_current_uring_loop = nullptr;
+
+// the message the worker on current thread is running a recv callback for
+static thread_local WorkerContext t_uring_worker_context;
+
+UringTcpServer::UringTcpServer(const std::string& local_ip, uint16_t local_port, uint32_t loop_num)
+    : _local_ip(local_ip),
+      _local_port(local_port),
+      _loop_num(loop_num) {
+    if (_loop_num == 0) {
+        // one loop per cpu core
+        _loop_num = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+UringTcpServer::~UringTcpServer() {
+    Stop();
+}
+
+bool UringTcpServer::Supported() {
+    // multishot recv needs linux 6.0
+    struct utsname name;
+    int major = 0;
+    int minor = 0;
+    if (uname(&name) != 0 || sscanf(name.release, "%d.%d", &major, &minor) != 2 || major < 6) {
+        return false;
+    }
+    // io_uring may still be disabled(sysctl, seccomp), so try a real ring
+    IoUring ring;
+    return ring.Init(8) && ring.InitRecvBuffers(8, 64);
+}
+
+bool UringTcpServer::Start() {
+    assert(_loops.empty());
+    if (_service) {
+        if (_codec.Type() == FrameCodecType::kRaw) {
+            ERPC_LOG_ERROR("rpc needs a length prefix codec(fixed32 or varint)!");
+            return false;
+        }
+        _service->Seal();
+    }
+
+    for (uint32_t i = 0; i < _loop_num; ++i) {
+        auto loop = std::make_shared<UringLoopContext>();
+        loop->index = i;
+        _loops.push_back(loop);
+        if (!InitLoop(loop)) {
+            return false;
+        }
+        for (auto& timer : _pending_timers) {
+            loop->timers.AddTimer(timer.delay_ms, timer.callback, timer.interval_ms);
+        }
+    }
+    ERPC_LOG_INFO("UringTcpServer Init success! loop_num=%u", _loop_num);
+
+    for (auto& loop : _loops) {
+        loop->thread_loop = std::make_shared<std::thread>(&UringTcpServer::UringLoop, this, loop);
+        if (!loop->thread_loop) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool UringTcpServer::InitLoop(const UringLoopContextPtr& loop) {
+    auto ring = std::make_shared<IoUring>();
+    if (!ring->Init(kUringEntries) || !ring->InitRecvBuffers(kUringRecvBuffers, kUringRecvBufferSize)) {
+        ERPC_LOG_ERROR("io_uring setup failed! errno=%d", errno);
+        return false;
+    }
+    loop->ring = ring;
+
+    loop->listen_fd = CreateListenSocket();
+    if (loop->listen_fd < 0) {
+        return false;
+    }
+    // other threads wake the ring by writing this eventfd
+    if (!loop->inbox.Init()) {
+        ERPC_LOG_ERROR("create wakeup eventfd failed! errno=%d", errno);
+        return false;
+    }
+    return ArmAccept(loop) && ArmWakeup(loop);
+}
+
+bool UringTcpServer::Stop() {
+    if (!_loop_flag.exchange(false)) {
+        // stopped already
+        return true;
+    }
+    for (auto& loop : _loops) {
+        // wake it up from io_uring_enter at once, then it closes its ring, listen socket and connections
+        loop->inbox.Post([] {});
+    }
+    for (auto& loop : _loops) {
+        if (!loop->thread_loop || !loop->thread_loop->joinable()) {
+            continue;
+        }
+        if (std::this_thread::get_id() == loop->thread_loop->get_id()) {
+            // stopped by a callback of its own, the thread ends after this iteration
+            loop->thread_loop->detach();
+        } else {
+            loop->thread_loop->join();
+        }
+    }
+    // the pool outlives the server: no recv callback runs on it from now on
+    _worker_tasks.Close();
+    ERPC_LOG_INFO("stop io_uring!");
+    if (_recv_callback || _recv_view_callback) {
+        UnRegisterOnRecvCallback();
+    }
+    return true;
+}
+
+int32_t UringTcpServer::CreateListenSocket() {
+    int listenfd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenfd < 0) {
+        ERPC_LOG_ERROR("create socket %s:%u failed!", _local_ip.c_str(), _local_port);
+        return -1;
+    }
+
+    // a restarted server binds again while connections of the previous one are still in TIME_WAIT
+    int reuse = 1;
+    if (::setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+        ERPC_LOG_ERROR("setsockopt SO_REUSEADDR failed! errno=%d", errno);
+        ::close(listenfd);
+        return -1;
+    }
+
+    if (_loop_num > 1) {
+        // every ring binds the same ip:port, and the kernel balances new connections over these listen sockets
+        if (::setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+            ERPC_LOG_ERROR("setsockopt SO_REUSEPORT failed! errno=%d", errno);
+            ::close(listenfd);
+            return -1;
+        }
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_local_port);
+    addr.sin_addr.s_addr  = inet_addr(_local_ip.c_str());
+    if (::bind(listenfd, (struct sockaddr*)&addr, sizeof(struct sockaddr)) != 0) {
+        ERPC_LOG_ERROR("bind socket %s:%u failed! errno=%d", _local_ip.c_str(), _local_port, errno);
+        ::close(listenfd);
+        return -1;
+    }
+    if (::listen(listenfd, SOMAXCONN) < 0) {
+        ERPC_LOG_ERROR("listen failed! errno=%d", errno);
+        ::close(listenfd);
+        return -1;
+    }
+    ERPC_LOG_INFO("create and bind socket %s:%u success!", _local_ip.c_str(), _local_port);
+    return listenfd;
+}
+
+bool UringTcpServer::ArmAccept(const UringLoopContextPtr& loop) {
+    struct io_uring_sqe* sqe = loop->ring->GetSqe();
+    if (!sqe) {
+        ERPC_LOG_ERROR("io_uring submission queue full!");
+        return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = EncodeUserData(kUringOpAccept, loop->listen_fd);
+    return true;
+}
+
+bool UringTcpServer::ArmRecv(const UringLoopContextPtr& loop, const UringConnectionPtr& conn) {
+    struct io_uring_sqe* sqe = loop->ring->GetSqe();
+    if (!sqe) {
+        ERPC_LOG_ERROR("io_uring submission queue full!");
+        return false;
+    }
+    // every completion carries one provided buffer, the recv stays armed until eof/error/out of buffers
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kUringBufferGroup;
+    sqe->user_data = EncodeUserData(kUringOpRecv, conn->fd);
+    conn->recving = true;
+    return true;
+}
+
+bool UringTcpServer::ArmSend(const UringLoopContextPtr& loop, const UringConnectionPtr& conn) {
+    struct io_uring_sqe* sqe = loop->ring->GetSqe();
+    if (!sqe) {
+        ERPC_LOG_ERROR("io_uring submission queue full!");
+        return false;
+    }
+    int32_t cnt = conn->output.PeekIovec(conn->iov, kMaxIovecs);
+    // the kernel reads the chunks until completion, later sends must not touch them
+    conn->output.Seal();
+    memset(&conn->msg, 0, sizeof(conn->msg));
+    conn->msg.msg_iov = conn->iov;
+    conn->msg.msg_iovlen = cnt;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn->msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = EncodeUserData(kUringOpSend, conn->fd);
+    conn->sending = true;
+    return true;
+}
+
+bool UringTcpServer::ArmWakeup(const UringLoopContextPtr& loop) {
+    struct io_uring_sqe* sqe = loop->ring->GetSqe();
+    if (!sqe) {
+        ERPC_LOG_ERROR("io_uring submission queue full!");
+        return false;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loop->inbox.fd();
+    sqe->addr = reinterpret_cast<uint64_t>(&loop->wakeup_value);
+    sqe->len = sizeof(loop->wakeup_value);
+    sqe->user_data = EncodeUserData(kUringOpWakeup, loop->inbox.fd());
+    return true;
+}
+
+void UringTcpServer::OnWakeup(const UringLoopContextPtr& loop, int32_t res) {
+    if (res < 0 && res != -EAGAIN && res != -EINTR) {
+        ERPC_LOG_WARN("read wakeup eventfd failed! res=%d", res);
+    }
+    // the eventfd is consumed by the read, run what was posted and wait for the next one
+    loop->inbox.RunPending();
+    if (_loop_flag) {
+        ArmWakeup(loop);
+    }
+}
+
+void UringTcpServer::OnAccept(const UringLoopContextPtr& loop, int32_t res, uint32_t flags) {
+    if (res >= 0) {
+        auto conn = std::make_shared<UringConnection>(loop->pool);
+        conn->fd = res;
+        conn->id = NewConnectionId(res);
+        conn->last_active_ms = loop->now_ms;
+        loop->connections.Insert(conn->id, conn);
+        if (_idle_timeout_ms > 0) {
+            ArmIdleTimer(loop, conn, _idle_timeout_ms);
+        }
+        loop->metrics.Add(kMetricAccepted);
+        loop->metrics.Add(kMetricConnections);
+        ERPC_LOG_DEBUG("loop %u accept connection fd: %d", loop->index, res);
+        if (!ArmRecv(loop, conn)) {
+            CloseConnection(loop, conn);
+        }
+    } else {
+        ERPC_LOG_WARN("accept error! res=%d", res);
+    }
+    if (!(flags & IORING_CQE_F_MORE) && _loop_flag) {
+        // multishot accept stopped, arm it again
+        ArmAccept(loop);
+    }
+}
+
+void UringTcpServer::OnRecv(const UringLoopContextPtr& loop, int32_t fd, int32_t res, uint32_t flags) {
+    UringConnectionPtr conn = loop->connections.Get(fd);
+    if (!conn) {
+        return;
+    }
+    bool more = flags & IORING_CQE_F_MORE;
+    if (!more) {
+        conn->recving = false;
+    }
+    loop->metrics.Add(kMetricReadCalls);
+
+    if (res > 0) {
+        // copy out of the provided buffer and hand it back to the kernel at once
+        uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (!conn->closing) {
+            conn->input.EnsureWritable(res);
+            memcpy(conn->input.WritePtr(), loop->ring->Buffer(bid), res);
+            conn->input.HasWritten(res);
+            conn->last_active_ms = loop->now_ms;
+        }
+        loop->metrics.Add(kMetricBytesRead, res);
+        loop->ring->RecycleBuffer(bid);
+        if (!conn->closing && DispatchMessages(loop, conn) < 0) {
+            ERPC_LOG_WARN("fd: %d bad frame, close it!", fd);
+            CloseConnection(loop, conn);
+        } else if (!conn->closing && conn->input.Readable() == 0) {
+            conn->input.Shrink();
+        }
+    } else if (res == -ENOBUFS) {
+        // all provided buffers are in use, recv stopped and is armed again below
+    } else {
+        // eof(res == 0) or error
+        if (res < 0) {
+            ERPC_LOG_WARN("fd: %d recv error! res=%d", fd, res);
+        }
+        CloseConnection(loop, conn);
+    }
+
+    if (!more && !conn->recving) {
+        if (conn->closing) {
+            TryReleaseConnection(loop, conn);
+        } else if (!ArmRecv(loop, conn)) {
+            CloseConnection(loop, conn);
+        }
+    }
+}
+
+void UringTcpServer::OnSend(const UringLoopContextPtr& loop, int32_t fd, int32_t res) {
+    UringConnectionPtr conn = loop->connections.Get(fd);
+    if (!conn) {
+        return;
+    }
+    conn->sending = false;
+    loop->metrics.Add(kMetricWriteCalls);
+    if (res < 0) {
+        ERPC_LOG_WARN("fd: %d write error, close it! res=%d", fd, res);
+        CloseConnection(loop, conn);
+    } else {
+        conn->output.Consume(res);
+        conn->last_active_ms = loop->now_ms;
+        loop->metrics.Add(kMetricBytesWritten, res);
+        loop->metrics.Sub(kMetricOutputBytes, res);
+    }
+
+    if (conn->closing) {
+        TryReleaseConnection(loop, conn);
+    } else if (!conn->output.Empty() && !ArmSend(loop, conn)) {
+        // short write or more data queued during the send
+        CloseConnection(loop, conn);
+    }
+}
+
+void UringTcpServer::CloseConnection(const UringLoopContextPtr& loop, const UringConnectionPtr& conn) {
+    if (conn->fd < 0) {
+        return;
+    }
+    if (!conn->closing) {
+        conn->closing = true;
+        if (conn->idle_timer != kInvalidTimerId) {
+            loop->timers.CancelTimer(conn->idle_timer);
+            conn->idle_timer = kInvalidTimerId;
+        }
+        // terminates the armed recv and fails the pending send, so that their completions arrive soon
+        ::shutdown(conn->fd, SHUT_RDWR);
+    }
+    TryReleaseConnection(loop, conn);
+}
+
+void UringTcpServer::TryReleaseConnection(const UringLoopContextPtr& loop, const UringConnectionPtr& conn) {
+    if (conn->fd < 0 || conn->recving || conn->sending) {
+        // released already, or the fd must not be reused before its last completion
+        return;
+    }
+    loop->connections.Erase(conn->fd);
+    ::close(conn->fd);
+    conn->fd = -1;
+    loop->metrics.Sub(kMetricOutputBytes, conn->output.Size());
+    loop->metrics.Add(kMetricClosed);
+    loop->metrics.Sub(kMetricConnections);
+}
+
+void UringTcpServer::SetFrameCodec(FrameCodecType type) {
+    assert(_loops.empty());
+    _codec = FrameCodec(type);
+}
+
+MetricsSnapshot UringTcpServer::Metrics() const {
+    MetricsSnapshot snapshot;
+    for (auto& loop : _loops) {
+        snapshot.push_back(loop->metrics.Snapshot());
+    }
+    return snapshot;
+}
+
+TimerId UringTcpServer::RunAfter(uint32_t delay_ms, callback_timer_t callback) {
+    return AddTimer(delay_ms, 0, std::move(callback));
+}
+
+TimerId UringTcpServer::RunEvery(uint32_t interval_ms, callback_timer_t callback) {
+    return AddTimer(interval_ms, interval_ms, std::move(callback));
+}
+
+TimerId UringTcpServer::AddTimer(uint32_t delay_ms, uint32_t interval_ms, callback_timer_t callback) {
+    UringLoopContext* loop = CurrentLoop();
+    if (loop) {
+        return loop->timers.AddTimer(delay_ms, std::move(callback), interval_ms);
+    }
+    if (_loops.empty()) {
+        // not started yet, every loop gets one when it starts
+        PendingTimer timer;
+        timer.delay_ms = delay_ms;
+        timer.interval_ms = interval_ms;
+        timer.callback = std::move(callback);
+        _pending_timers.push_back(std::move(timer));
+        return kInvalidTimerId;
+    }
+    ERPC_LOG_ERROR("timer must be added in loop thread or before Start()!");
+    return kInvalidTimerId;
+}
+
+bool UringTcpServer::CancelTimer(TimerId id) {
+    UringLoopContext* loop = CurrentLoop();
+    if (!loop) {
+        ERPC_LOG_ERROR("timer must be cancelled in loop thread!");
+        return false;
+    }
+    return loop->timers.CancelTimer(id);
+}
+
+void UringTcpServer::SetIdleTimeout(uint32_t idle_ms) {
+    assert(_loops.empty());
+    _idle_timeout_ms = idle_ms;
+}
+
+void UringTcpServer::SetWorkerPool(const WorkerPoolPtr& workers) {
+    assert(_loops.empty());
+    _workers = workers;
+}
+
+bool UringTcpServer::SetRpcService(const RpcServicePtr& service) {
+    assert(_loops.empty());
+    _service = service;
+    return true;
+}
+
+void UringTcpServer::ArmIdleTimer(const UringLoopContextPtr& loop, const UringConnectionPtr& conn, uint64_t delay_ms) {
+    uint32_t index = loop->index;
+    ConnectionId id = conn->id;
+    conn->idle_timer = loop->timers.AddTimer(delay_ms, [this, index, id] { OnIdleTimer(_loops[index], id); });
+}
+
+void UringTcpServer::OnIdleTimer(const UringLoopContextPtr& loop, ConnectionId id) {
+    UringConnectionPtr conn = loop->connections.Find(id);
+    if (!conn) {
+        return;
+    }
+    int32_t fd = conn->fd;
+    conn->idle_timer = kInvalidTimerId;
+    uint64_t idle = loop->now_ms - conn->last_active_ms;
+    if (idle >= _idle_timeout_ms) {
+        ERPC_LOG_INFO("fd: %d idle for %lu ms, close it!", fd, static_cast<unsigned long>(idle));
+        CloseConnection(loop, conn);
+        return;
+    }
+    ArmIdleTimer(loop, conn, _idle_timeout_ms - idle);
+}
+
+void UringTcpServer::RegisterOnRecvCallback(callback_recv_t callback) {
+    assert(!_recv_callback && !_recv_view_callback);
+    _recv_callback = callback;
+}
+
+void UringTcpServer::RegisterOnRecvCallback(callback_recv_view_t callback) {
+    assert(!_recv_callback && !_recv_view_callback);
+    _recv_view_callback = callback;
+}
+
+void UringTcpServer::UnRegisterOnRecvCallback() {
+    assert(_recv_callback || _recv_view_callback);
+    _recv_callback = nullptr;
+    _recv_view_callback = nullptr;
+}
+
+int32_t UringTcpServer::DispatchMessages(const UringLoopContextPtr& loop, const UringConnectionPtr& conn) {
+    uint32_t header_size = 0;
+    uint32_t body_size = 0;
+    int32_t ret = 0;
+    uint32_t count = 0;
+    uint64_t begin = MetricsNowNs();
+    while ((ret = _codec.Decode(conn->input.Peek(), conn->input.Readable(), &header_size, &body_size)) > 0) {
+        const char* body = conn->input.Peek() + header_size;
+        if (_service) {
+            // the response is written into the output buffer by the handler
+            RpcContext ctx;
+            ctx.fd = conn->fd;
+            ctx.conn_id = conn->id;
+            ctx.loop_index = loop->index;
+            size_t queued = conn->output.Size();
+            bool served = _service->Serve(_codec, body, body_size, &ctx, &conn->output);
+            conn->input.Retrieve(header_size + body_size);
+            if (!served) {
+                ERPC_LOG_WARN("fd: %d not a rpc request, close it!", conn->fd);
+                return -1;
+            }
+            loop->metrics.Add(kMetricOutputBytes, conn->output.Size() - queued);
+            if (!conn->sending && !conn->pending) {
+                conn->pending = true;
+                loop->pending_conns.push_back(conn);
+            }
+        } else if (_workers) {
+            // the view keeps the receive block alive until the worker is done with it
+            Packet data(conn->fd, conn->input.View(body, body_size));
+            data.conn_id = conn->id;
+            conn->input.Retrieve(header_size + body_size);
+            OffloadMessage(loop, data);
+        } else if (_recv_view_callback) {
+            // hand out the message in place, the view keeps the receive block alive
+            Packet data(conn->fd, conn->input.View(body, body_size));
+            data.conn_id = conn->id;
+            conn->input.Retrieve(header_size + body_size);
+            _recv_view_callback(data);
+        } else {
+            PacketPtr data = std::make_shared<Packet>(conn->fd, std::string(body, body_size));
+            data->conn_id = conn->id;
+            conn->input.Retrieve(header_size + body_size);
+            if (_recv_callback) {
+                _recv_callback(data);
+            }
+        }
+        ++count;
+    }
+    if (count > 0) {
+        loop->metrics.Add(kMetricCallbacks, count);
+        loop->metrics.Add(kMetricCallbackNs, MetricsNowNs() - begin);
+    }
+    return ret;
+}
+
+void UringTcpServer::OffloadMessage(const UringLoopContextPtr& loop, const Packet& data) {
+    uint32_t index = loop->index;
+    _worker_tasks.Submit(_workers, [this, index, data] {
+        // SendData() on this worker finds its way back to the loop and connection through this
+        WorkerContext saved = t_uring_worker_context;
+        t_uring_worker_context.owner = this;
+        t_uring_worker_context.loop_index = index;
+        t_uring_worker_context.fd = data.fd;
+        t_uring_worker_context.conn_id = data.conn_id;
+        if (_recv_view_callback) {
+            _recv_view_callback(data);
+        } else if (_recv_callback) {
+            PacketPtr packet = std::make_shared<Packet>(data.fd, data.view.ToString());
+            packet->conn_id = data.conn_id;
+            _recv_callback(packet);
+        }
+        t_uring_worker_context = saved;
+    });
+}
+
+UringLoopContext* UringTcpServer::CurrentLoop() const {
+    UringLoopContext* loop = t_current_uring_loop;
+    if (!loop || loop->index >= _loops.size() || _loops[loop->index].get() != loop) {
+        // not a loop thread, or a loop thread of another server
+        return nullptr;
+    }
+    return loop;
+}
+
+int32_t UringTcpServer::SendData(const PacketPtr& data) {
+    return SendData(*data);
+}
+
+int32_t UringTcpServer::SendData(const Packet& data) {
+    if (data.fd == -1 && data.conn_id == kInvalidConnectionId) {
+        return -1;
+    }
+    UringLoopContext* loop = CurrentLoop();
+    if (loop) {
+        return SendInLoop(loop, data, data.conn_id);
+    }
+
+    if (t_uring_worker_context.owner == this) {
+        // in a callback running on a worker: hand the packet(and the receive block it may refer to) to the loop
+        uint32_t index = t_uring_worker_context.loop_index;
+        ConnectionId id = data.conn_id;
+        if (id == kInvalidConnectionId && data.fd == t_uring_worker_context.fd) {
+            // a packet made up by the callback, for the connection it was called for
+            id = t_uring_worker_context.conn_id;
+        }
+        Packet packet(data);
+        _loops[index]->inbox.Post([this, index, id, packet] {
+            SendInLoop(_loops[index].get(), packet, id);
+        });
+        return data.size();
+    }
+
+    ERPC_LOG_ERROR("fd: %d SendData must be called in loop thread or a recv callback!", data.fd);
+    return -1;
+}
+
+int32_t UringTcpServer::SendInLoop(UringLoopContext* loop, const Packet& data, ConnectionId id) {
+    UringConnectionPtr conn = id != kInvalidConnectionId ? loop->connections.Find(id) : loop->connections.Get(data.fd);
+    if (!conn || conn->closing) {
+        return -1;
+    }
+    if (!_codec.Fits(data.size())) {
+        // the peer would take it for a bad frame and close the connection
+        ERPC_LOG_ERROR("fd: %d message of %zu bytes is over the max frame size!", conn->fd, data.size());
+        return -1;
+    }
+
+    char header[kMaxFrameHeaderSize];
+    uint32_t header_size = _codec.EncodeHeader(data.size(), header);
+    conn->output.Append(header, header_size);
+    conn->output.Append(data.data(), data.size());
+    loop->metrics.Add(kMetricOutputBytes, header_size + data.size());
+    // a send in flight picks up the rest when it completes
+    if (!conn->sending && !conn->pending) {
+        conn->pending = true;
+        loop->pending_conns.push_back(conn);
+    }
+    return data.size();
+}
+
+void UringTcpServer::FlushPendingConnections(const UringLoopContextPtr& loop) {
+    std::vector<UringConnectionPtr> pending_conns;
+    pending_conns.swap(loop->pending_conns);
+    for (auto& conn : pending_conns) {
+        conn->pending = false;
+        if (conn->closing || conn->sending || conn->output.Empty()) {
+            continue;
+        }
+        if (!ArmSend(loop, conn)) {
+            CloseConnection(loop, conn);
+        }
+    }
+}
+
+void UringTcpServer::UringLoop(UringLoopContextPtr loop) {
+    t_current_uring_loop = loop.get();
+    IoUring* ring = loop->ring.get();
+
+    auto handler = [&](uint64_t user_data, int32_t res, uint32_t flags) {
+        int32_t fd = static_cast<int32_t>(user_data & 0xffffffff);
+        switch (user_data >> 32) {
+        case kUringOpAccept:
+            OnAccept(loop, res, flags);
+            break;
+        case kUringOpRecv:
+            OnRecv(loop, fd, res, flags);
+            break;
+        case kUringOpSend:
+            OnSend(loop, fd, res);
+            break;
+        case kUringOpWakeup:
+            OnWakeup(loop, res);
+            break;
+        default:
+            ERPC_LOG_WARN("unknow io_uring completion! user_data=%llu", static_cast<unsigned long long>(user_data));
+            break;
+        }
+    };
+
+    loop->now_ms = TimerWheel::NowMs();
+    loop->timers.SetNow(loop->now_ms);
+    while (_loop_flag) {
+        // sleep until the nearest timer, or for good if there is none: Stop() and sends of workers wake it up
+        // through the inbox eventfd
+        int64_t timeout = loop->timers.NextTimeout(loop->now_ms);
+        // one syscall submits everything queued in last iteration and waits for completions
+        if (ring->Submit(1, timeout) < 0) {
+            ERPC_LOG_ERROR("io_uring_enter failed! errno=%d", errno);
+            break;
+        }
+        loop->now_ms = TimerWheel::NowMs();
+        // timers added by the completions below count from now, not from the last Advance()
+        loop->timers.SetNow(loop->now_ms);
+        uint32_t num = ring->ForEachCompletion(handler);
+        loop->metrics.Add(kMetricLoopWaits);
+        if (num > 0) {
+            loop->metrics.Add(kMetricLoopEvents, num);
+        } else {
+            loop->metrics.Add(kMetricEmptyWakeups);
+        }
+        // run expired timers, they may queue sends too
+        loop->timers.Advance(loop->now_ms);
+        // sends queued by callbacks go out with next submit
+        FlushPendingConnections(loop);
+    }
+
+    // closing the ring cancels everything still armed
+    for (int32_t fd : loop->connections.Fds()) {
+        ::close(fd);
+        loop->connections.Erase(fd);
+    }
+    loop->pending_conns.clear();
+    ::close(loop->listen_fd);
+    loop->ring.reset();
+    t_current_uring_loop = nullptr;
+}
+
+#else // ERPC_HAVE_IO_URING
+
+// built without io_uring headers: never selected by CreateTcpServer()
+class IoUring {};
+
+UringTcpServer::UringTcpServer(const std::string& local_ip, uint16_t local_port, uint32_t loop_num)
+    : _local_ip(local_ip),
+      _local_port(local_port),
+      _loop_num(loop_num) {}
+UringTcpServer::~UringTcpServer() {}
+bool UringTcpServer::Supported() { return false; }
+bool UringTcpServer::Start() { return false; }
+bool UringTcpServer::Stop() { return true; }
+int32_t UringTcpServer::SendData(const PacketPtr&) { return -1; }
+int32_t UringTcpServer::SendData(const Packet&) { return -1; }
+void UringTcpServer::RegisterOnRecvCallback(callback_recv_t callback) { _recv_callback = callback; }
+void UringTcpServer::RegisterOnRecvCallback(callback_recv_view_t callback) { _recv_view_callback = callback; }
+void UringTcpServer::UnRegisterOnRecvCallback() {}
+void UringTcpServer::SetFrameCodec(FrameCodecType type) { _codec = FrameCodec(type); }
+MetricsSnapshot UringTcpServer::Metrics() const { return MetricsSnapshot(); }
+TimerId UringTcpServer::RunAfter(uint32_t, callback_timer_t) { return kInvalidTimerId; }
+TimerId UringTcpServer::RunEvery(uint32_t, callback_timer_t) { return kInvalidTimerId; }
+bool UringTcpServer::CancelTimer(TimerId) { return false; }
+void UringTcpServer::SetIdleTimeout(uint32_t idle_ms) { _idle_timeout_ms = idle_ms; }
+void UringTcpServer::SetWorkerPool(const WorkerPoolPtr& workers) { _workers = workers; }
+bool UringTcpServer::SetRpcService(const RpcServicePtr& service) { _service = service; return true; }
+
+#endif // ERPC_HAVE_IO_URING
+
+} // namespace erpc
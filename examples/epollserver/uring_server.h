@@ -0,0 +1,172 @@
+#pragma once
+
+#include "epoll_server.h"
+
+namespace erpc {
+
+static const uint32_t kUringEntries = 4096;       // submission queue size of one ring
+static const uint32_t kUringRecvBuffers = 512;    // number of provided recv buffers of one ring(power of 2)
+static const uint32_t kUringRecvBufferSize = 4096; // size of one provided recv buffer
+
+// event backend of tcp server
+enum class TcpBackend : uint8_t {
+    kEpoll = 0, // epoll_wait + read + writev
+    kUring = 1, // io_uring multishot accept/recv and async sendmsg
+};
+
+// create a tcp server on the given backend. io_uring falls back to epoll when the kernel(or the headers
+// this is built with) does not support what UringTcpServer needs
+ETBasePtr CreateTcpServer(const std::string& local_ip,
+                          uint16_t local_port,
+                          TcpBackend backend = TcpBackend::kEpoll,
+                          uint32_t loop_num = kDefaultLoopNum);
+
+// parse backend name(epoll, uring) given on command line, unknown name means epoll
+TcpBackend TcpBackendFromString(const std::string& name);
+
+class IoUring;
+
+// state of one connection of UringTcpServer, only touched by its loop
+typedef struct UringConnection {
+    explicit UringConnection(const BufferPoolPtr& pool)
+        : input(pool) {}
+
+    int32_t fd { -1 };       // socket
+    ConnectionId id { kInvalidConnectionId }; // fd and generation, tells it from a later connection on fd
+    bool recving { false };  // a multishot recv is armed
+    bool sending { false };  // a sendmsg is in flight, reading msg and iov
+    bool pending { false };  // in the flush list of its loop
+    bool closing { false };  // shut down, closed once recv and send finished
+    InputBuffer input;       // received bytes not forming a complete message yet
+    OutputBuffer output;     // unsent bytes
+    uint64_t last_active_ms { 0 };           // last time bytes were received or sent
+    TimerId idle_timer { kInvalidTimerId };  // checks last_active_ms when idle timeout is set
+    struct msghdr msg;            // header of the sendmsg in flight
+    struct iovec iov[kMaxIovecs]; // iovecs of the sendmsg in flight
+} UringConnection;
+
+typedef std::shared_ptr<UringConnection> UringConnectionPtr;
+
+// one ring of UringTcpServer with its own listen socket(SO_REUSEPORT) and thread, same model as EpollLoopContext
+typedef struct UringLoopContext {
+    uint32_t index { 0 };     // index of this loop
+    int32_t listen_fd { -1 }; // listen fd of this loop
+    std::shared_ptr<IoUring> ring { nullptr }; // submission/completion queues and provided recv buffers
+    std::shared_ptr<std::thread> thread_loop { nullptr }; // thread submitting and reaping the ring
+    BufferPoolPtr pool { BufferPool::Create() }; // receive buffers of connections of this loop
+    ConnectionTable<UringConnection> connections; // connections accepted by this loop, indexed by fd
+    std::vector<UringConnectionPtr> pending_conns; // connections with data queued in this iteration
+    LoopMetrics metrics; // written by this loop only, reads and writes count completions
+    TimerWheel timers; // timers of this loop, the wait timeout is derived from the nearest one
+    uint64_t now_ms { 0 }; // time after last wait, the clock of this loop
+    LoopInbox inbox; // sends posted by workers, a read of its eventfd stays queued on the ring
+    uint64_t wakeup_value { 0 }; // buffer of that read
+} UringLoopContext;
+
+typedef std::shared_ptr<UringLoopContext> UringLoopContextPtr;
+
+// tcp server on io_uring: accept and recv stay armed in the kernel(multishot), received bytes land in
+// buffers registered with the ring, and everything queued by callbacks in one iteration is submitted
+// together with the wait for next completions, so one io_uring_enter() replaces epoll_wait + read + write
+class UringTcpServer : public ETBase {
+public:
+    UringTcpServer()                                       = default;
+    UringTcpServer(const UringTcpServer& other)            = delete;
+    UringTcpServer& operator=(const UringTcpServer& other) = delete;
+    UringTcpServer(UringTcpServer&& other)                 = delete;
+    UringTcpServer& operator=(UringTcpServer&& other)      = delete;
+    ~UringTcpServer() override;
+
+    // the local ip and port of tcp server, and the number of rings(threads) serving it
+    UringTcpServer(const std::string& local_ip, uint16_t local_port, uint32_t loop_num = kDefaultLoopNum);
+
+public:
+    // whether the running kernel supports multishot accept/recv and provided buffer rings
+    static bool Supported();
+
+    // start tcp server
+    bool Start() override;
+    // stop tcp server, every loop closes its ring and connections when it exits
+    bool Stop() override;
+    // send packet, same rules as EpollTcpServer::SendData()
+    int32_t SendData(const PacketPtr& data) override;
+    int32_t SendData(const Packet& data) override;
+    // register a callback when packet received, it runs on the loop owning the connection
+    void RegisterOnRecvCallback(callback_recv_t callback) override;
+    void RegisterOnRecvCallback(callback_recv_view_t callback) override;
+    void UnRegisterOnRecvCallback() override;
+    // set how the tcp stream is cut into messages(raw by default), must be called before Start()
+    void SetFrameCodec(FrameCodecType type) override;
+    // counters and gauges of every ring, index is the loop index
+    MetricsSnapshot Metrics() const override;
+    // timers on the current loop, see EpollTcpBase
+    TimerId RunAfter(uint32_t delay_ms, callback_timer_t callback) override;
+    TimerId RunEvery(uint32_t interval_ms, callback_timer_t callback) override;
+    bool CancelTimer(TimerId id) override;
+    // close connections idle for idle_ms, must be called before Start()
+    void SetIdleTimeout(uint32_t idle_ms) override;
+    // run recv callbacks on workers, must be called before Start(). Stop() drops the ones not started and waits for
+    // the others
+    void SetWorkerPool(const WorkerPoolPtr& workers) override;
+    // dispatch every message to a method of service, must be called before Start()
+    bool SetRpcService(const RpcServicePtr& service) override;
+
+protected:
+    // create ring and listen socket of one loop
+    bool InitLoop(const UringLoopContextPtr& loop);
+    // create, bind and listen a socket
+    int32_t CreateListenSocket();
+
+    // queue a multishot accept / multishot recv / sendmsg on the ring
+    bool ArmAccept(const UringLoopContextPtr& loop);
+    bool ArmRecv(const UringLoopContextPtr& loop, const UringConnectionPtr& conn);
+    bool ArmSend(const UringLoopContextPtr& loop, const UringConnectionPtr& conn);
+    bool ArmWakeup(const UringLoopContextPtr& loop);
+
+    // handle completions
+    void OnAccept(const UringLoopContextPtr& loop, int32_t res, uint32_t flags);
+    void OnRecv(const UringLoopContextPtr& loop, int32_t fd, int32_t res, uint32_t flags);
+    void OnSend(const UringLoopContextPtr& loop, int32_t fd, int32_t res);
+    void OnWakeup(const UringLoopContextPtr& loop, int32_t res);
+
+    // cut the input buffer of connection into messages and call back for each one, return -1 on a bad frame
+    int32_t DispatchMessages(const UringLoopContextPtr& loop, const UringConnectionPtr& conn);
+    // send everything queued by callbacks in this iteration
+    void FlushPendingConnections(const UringLoopContextPtr& loop);
+    // shut down connection, it is closed when no operation refers to it any more
+    void CloseConnection(const UringLoopContextPtr& loop, const UringConnectionPtr& conn);
+    // close fd and release state if nothing is in flight
+    void TryReleaseConnection(const UringLoopContextPtr& loop, const UringConnectionPtr& conn);
+    // add a timer on the current loop, or on every loop before Start()
+    TimerId AddTimer(uint32_t delay_ms, uint32_t interval_ms, callback_timer_t callback);
+    // idle timer of connection fired: close it if nothing happened since, otherwise check again later
+    void OnIdleTimer(const UringLoopContextPtr& loop, ConnectionId id);
+    // arm the idle timer of connection to fire after delay_ms
+    void ArmIdleTimer(const UringLoopContextPtr& loop, const UringConnectionPtr& conn, uint64_t delay_ms);
+    // run the recv callback of a message on a worker
+    void OffloadMessage(const UringLoopContextPtr& loop, const Packet& data);
+    // queue data on connection id of loop, or on whatever connection is on data.fd if id is invalid
+    int32_t SendInLoop(UringLoopContext* loop, const Packet& data, ConnectionId id);
+    // the loop of this server which is running on current thread, nullptr if called outside of loops
+    UringLoopContext* CurrentLoop() const;
+
+    // one loop per thread: submit and wait, then handle all completions
+    void UringLoop(UringLoopContextPtr loop);
+
+private:
+    std::string _local_ip; // tcp local ip
+    uint16_t _local_port { 0 }; // tcp bind local port
+    uint32_t _loop_num { kDefaultLoopNum }; // number of rings
+    std::vector<UringLoopContextPtr> _loops; // all rings, one thread per ring
+    std::atomic<bool> _loop_flag { true }; // if loop_flag_ is false, then exit the loop
+    callback_recv_t _recv_callback { nullptr }; // callback when received
+    callback_recv_view_t _recv_view_callback { nullptr }; // zero copy callback when received
+    FrameCodec _codec; // message framing of tcp stream
+    uint32_t _idle_timeout_ms { 0 }; // close connections idle that long, 0 means never
+    std::vector<PendingTimer> _pending_timers; // timers given before Start(), added to every loop
+    WorkerPoolPtr _workers { nullptr }; // runs recv callbacks off the loops if set
+    WorkerTasks _worker_tasks;           // the callbacks given to _workers, closed by Stop()
+    RpcServicePtr _service { nullptr }; // rpc methods, instead of the recv callback if set
+};
+
+} // namespace erpc